@@ -0,0 +1,314 @@
+/**
+ * @file bench_threadpool.cpp
+ * @brief Micro-benchmarks of the ThreadPool: per-task overhead, latency, batching and scaling.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <pcosynchro/pcothread.h>
+
+#include "threadpool.h"
+
+namespace {
+
+/**
+ * @brief Task doing no work, it only counts itself as done when run or cancelled.
+ */
+class EmptyRunnable : public Runnable {
+public:
+    explicit EmptyRunnable(std::atomic<int64_t> &done) : done(done) {}
+
+    void run() override {
+        done.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void cancelRun() override {
+        done.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::string id() override {
+        return "Empty";
+    }
+
+private:
+    std::atomic<int64_t> &done; // Counter of the finished tasks
+};
+
+/**
+ * @brief Waits until the given number of tasks ran or were cancelled.
+ * @param done Counter of the finished tasks
+ * @param target Number of tasks to wait for
+ */
+void waitFor(const std::atomic<int64_t> &done, int64_t target) {
+    while (done.load(std::memory_order_relaxed) < target) {
+        std::this_thread::yield();
+    }
+}
+
+QueueBackend backendOf(int64_t arg) {
+    return arg == 0 ? QueueBackend::Monitor : QueueBackend::LockFree;
+}
+
+const char* backendName(int64_t arg) {
+    return arg == 0 ? "Monitor" : "LockFree";
+}
+
+constexpr int TasksPerIteration = 1000;
+
+/**
+ * @brief Hot state of a worker laid out like ThreadInfo before it was aligned: the states of
+ * workers allocated next to each other share cache lines.
+ */
+struct SharedLineState {
+    std::atomic<bool> isRunning{false}; // Written by the worker around each task
+    std::atomic<uint64_t> nbTasks{0};   // Written by the worker after each task
+};
+
+/**
+ * @brief The same hot state, on a cache line of its own like in ThreadInfo.
+ */
+struct PaddedState {
+    alignas(64) std::atomic<bool> isRunning{false}; // Written by the worker around each task
+    std::atomic<uint64_t> nbTasks{0};               // Written by the worker after each task
+};
+
+} // namespace
+
+/**
+ * @brief Empty tasks submitted one by one from a single producer.
+ * Args: number of workers, backend (0 Monitor, 1 LockFree).
+ */
+static void BM_EmptyTaskThroughput(benchmark::State &state) {
+    std::atomic<int64_t> done{0};
+    ThreadPool pool(static_cast<int>(state.range(0)), TasksPerIteration, std::chrono::milliseconds{1000},
+                    backendOf(state.range(1)));
+    int64_t submitted = 0;
+
+    for (auto _ : state) {
+        for (int i = 0; i < TasksPerIteration; ++i) {
+            pool.start(pool.makeTask<EmptyRunnable>(done));
+        }
+        submitted += TasksPerIteration;
+        waitFor(done, submitted);
+    }
+    state.SetItemsProcessed(submitted);
+    state.SetLabel(backendName(state.range(1)));
+}
+BENCHMARK(BM_EmptyTaskThroughput)->ArgsProduct({{1, 2, 4, 8}, {0, 1}})->UseRealTime();
+
+/**
+ * @brief Same as BM_EmptyTaskThroughput with tasks allocated with new instead of the slab.
+ * Args: number of workers, backend (0 Monitor, 1 LockFree).
+ */
+static void BM_EmptyTaskThroughputHeap(benchmark::State &state) {
+    std::atomic<int64_t> done{0};
+    ThreadPool pool(static_cast<int>(state.range(0)), TasksPerIteration, std::chrono::milliseconds{1000},
+                    backendOf(state.range(1)));
+    int64_t submitted = 0;
+
+    for (auto _ : state) {
+        for (int i = 0; i < TasksPerIteration; ++i) {
+            pool.start(std::make_unique<EmptyRunnable>(done));
+        }
+        submitted += TasksPerIteration;
+        waitFor(done, submitted);
+    }
+    state.SetItemsProcessed(submitted);
+    state.SetLabel(backendName(state.range(1)));
+}
+BENCHMARK(BM_EmptyTaskThroughputHeap)->ArgsProduct({{1, 4}, {0, 1}})->UseRealTime();
+
+/**
+ * @brief Submit-to-start latency percentiles, read from the pool's metrics.
+ * Tasks are submitted one at a time so that the queue stays short.
+ * Args: number of workers, backend (0 Monitor, 1 LockFree).
+ */
+static void BM_SubmitToStartLatency(benchmark::State &state) {
+    std::atomic<int64_t> done{0};
+    ThreadPool pool(static_cast<int>(state.range(0)), 16, std::chrono::milliseconds{1000},
+                    backendOf(state.range(1)));
+    pool.enableMetrics();
+    int64_t submitted = 0;
+
+    for (auto _ : state) {
+        pool.start(pool.makeTask<EmptyRunnable>(done));
+        waitFor(done, ++submitted);
+    }
+
+    PoolMetrics metrics = pool.snapshot();
+    state.counters["p50_ns"] = static_cast<double>(metrics.waitTime.percentile(0.50).count());
+    state.counters["p90_ns"] = static_cast<double>(metrics.waitTime.percentile(0.90).count());
+    state.counters["p99_ns"] = static_cast<double>(metrics.waitTime.percentile(0.99).count());
+    state.counters["mean_ns"] = static_cast<double>(metrics.waitTime.mean().count());
+    state.SetLabel(backendName(state.range(1)));
+}
+BENCHMARK(BM_SubmitToStartLatency)->ArgsProduct({{1, 4}, {0, 1}})->UseRealTime();
+
+/**
+ * @brief Tasks submitted one by one, baseline of BM_BatchSubmit.
+ * Args: number of tasks per round, backend (0 Monitor, 1 LockFree).
+ */
+static void BM_SingleSubmit(benchmark::State &state) {
+    const int nbTasks = static_cast<int>(state.range(0));
+    std::atomic<int64_t> done{0};
+    ThreadPool pool(4, nbTasks, std::chrono::milliseconds{1000}, backendOf(state.range(1)));
+    int64_t submitted = 0;
+
+    for (auto _ : state) {
+        for (int i = 0; i < nbTasks; ++i) {
+            pool.start(pool.makeTask<EmptyRunnable>(done));
+        }
+        submitted += nbTasks;
+        waitFor(done, submitted);
+    }
+    state.SetItemsProcessed(submitted);
+    state.SetLabel(backendName(state.range(1)));
+}
+BENCHMARK(BM_SingleSubmit)->ArgsProduct({{16, 256}, {0, 1}})->UseRealTime();
+
+/**
+ * @brief Tasks submitted through startBatch().
+ * Args: number of tasks per batch, backend (0 Monitor, 1 LockFree).
+ */
+static void BM_BatchSubmit(benchmark::State &state) {
+    const int nbTasks = static_cast<int>(state.range(0));
+    std::atomic<int64_t> done{0};
+    ThreadPool pool(4, nbTasks, std::chrono::milliseconds{1000}, backendOf(state.range(1)));
+    int64_t submitted = 0;
+
+    for (auto _ : state) {
+        std::vector<TaskPtr> batch;
+        batch.reserve(nbTasks);
+        for (int i = 0; i < nbTasks; ++i) {
+            batch.push_back(pool.makeTask<EmptyRunnable>(done));
+        }
+        pool.startBatch(std::move(batch));
+        submitted += nbTasks;
+        waitFor(done, submitted);
+    }
+    state.SetItemsProcessed(submitted);
+    state.SetLabel(backendName(state.range(1)));
+}
+BENCHMARK(BM_BatchSubmit)->ArgsProduct({{16, 256}, {0, 1}})->UseRealTime();
+
+/**
+ * @brief Cost of handing a task to a parked thread, up to the end of the task.
+ * The worker is given time to park between two iterations (not measured).
+ * Args: backend (0 Monitor, 1 LockFree).
+ */
+static void BM_IdleWakeup(benchmark::State &state) {
+    std::atomic<int64_t> done{0};
+    ThreadPool pool(1, 1, std::chrono::milliseconds{10000}, backendOf(state.range(0)));
+    int64_t submitted = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        PcoThread::usleep(200);
+        state.ResumeTiming();
+
+        pool.start(pool.makeTask<EmptyRunnable>(done));
+        waitFor(done, ++submitted);
+    }
+    state.SetLabel(backendName(state.range(0)));
+}
+BENCHMARK(BM_IdleWakeup)->Arg(0)->Arg(1)->UseRealTime();
+
+/**
+ * @brief Several producers submitting empty tasks at the same time.
+ * Args: producers, workers, maxNbWaiting, idleTimeout in ms, backend (0 Monitor, 1 LockFree).
+ * With a short idleTimeout, threads expire between bursts and have to be created again.
+ */
+static void BM_Scaling(benchmark::State &state) {
+    const int nbProducers = static_cast<int>(state.range(0));
+    const int tasksPerProducer = TasksPerIteration / nbProducers;
+    std::atomic<int64_t> done{0};
+    ThreadPool pool(static_cast<int>(state.range(1)), static_cast<int>(state.range(2)),
+                    std::chrono::milliseconds{state.range(3)}, backendOf(state.range(4)));
+    int64_t submitted = 0;
+
+    for (auto _ : state) {
+        std::vector<std::unique_ptr<PcoThread>> producers;
+        for (int p = 0; p < nbProducers; ++p) {
+            producers.push_back(std::make_unique<PcoThread>([&pool, &done, tasksPerProducer]() {
+                for (int i = 0; i < tasksPerProducer; ++i) {
+                    pool.start(pool.makeTask<EmptyRunnable>(done));
+                }
+            }));
+        }
+        for (auto &producer : producers) {
+            producer->join();
+        }
+        submitted += static_cast<int64_t>(tasksPerProducer) * nbProducers;
+        waitFor(done, submitted);
+    }
+    state.SetItemsProcessed(submitted);
+    state.SetLabel(backendName(state.range(4)));
+}
+BENCHMARK(BM_Scaling)
+    ->ArgsProduct({{1, 2, 4, 8}, {1, 2, 4, 8}, {16, 1024}, {1, 1000}, {0, 1}})
+    ->ArgNames({"producers", "workers", "maxNbWaiting", "idleMs", "backend"})
+    ->UseRealTime();
+
+/**
+ * @brief Tasks spawning subtasks from the workers, which go to their local deques.
+ * Every worker writes its deque, its ThreadInfo and the idle counters of the pool at the same
+ * time, which is where false sharing between neighbouring fields shows up. Compare over
+ * commits, or under `perf stat -e cache-misses`, to see the cross-core traffic.
+ * Args: number of workers, backend (0 Monitor, 1 LockFree).
+ */
+static void BM_LocalFanOut(benchmark::State &state) {
+    const int nbWorkers = static_cast<int>(state.range(0));
+    constexpr int Children = 64;
+    std::atomic<int64_t> done{0};
+    ThreadPool pool(nbWorkers, TasksPerIteration, std::chrono::milliseconds{1000}, backendOf(state.range(1)));
+    int64_t submitted = 0;
+
+    for (auto _ : state) {
+        for (int i = 0; i < nbWorkers; ++i) {
+            pool.submit([&pool, &done]() {
+                for (int c = 0; c < Children; ++c) {
+                    pool.start(pool.makeTask<EmptyRunnable>(done));
+                }
+            });
+        }
+        submitted += static_cast<int64_t>(nbWorkers) * Children;
+        waitFor(done, submitted);
+    }
+    state.SetItemsProcessed(submitted);
+    state.SetLabel(backendName(state.range(1)));
+}
+BENCHMARK(BM_LocalFanOut)->ArgsProduct({{1, 2, 4, 8}, {0, 1}})->UseRealTime();
+
+/**
+ * @brief Each benchmark thread writes the hot state of its own worker, in an array of
+ * neighbouring states: the shared-line layout against the padded one, in the same binary.
+ * The gap between the two is the cross-core traffic removed by aligning ThreadInfo, it only
+ * shows with as many cores as threads.
+ * Template argument: the layout of the state.
+ */
+template<typename WorkerState>
+static void BM_WorkerStateLayout(benchmark::State &state) {
+    static WorkerState states[8];
+    WorkerState &own = states[state.thread_index()];
+
+    for (auto _ : state) {
+        for (int i = 0; i < TasksPerIteration; ++i) {
+            own.isRunning.store(true, std::memory_order_relaxed);
+            own.nbTasks.fetch_add(1, std::memory_order_relaxed);
+            own.isRunning.store(false, std::memory_order_relaxed);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * TasksPerIteration);
+}
+BENCHMARK_TEMPLATE(BM_WorkerStateLayout, SharedLineState)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_WorkerStateLayout, PaddedState)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,315 @@
+/**
+ * @file coroutinetask.h
+ * @brief Header file defining Task<T>, the C++20 coroutine type run on the ThreadPool, with syncWait() and detach().
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef COROUTINETASK_H
+#define COROUTINETASK_H
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <pcosynchro/pcomutex.h>
+#include <pcosynchro/pcoconditionvariable.h>
+
+#include "poollog.h"
+
+template<typename T>
+class Task;
+
+namespace detail {
+
+/**
+ * @brief Part of the promise of a Task shared by every result type.
+ */
+class TaskPromiseBase {
+public:
+    /**
+     * @brief Awaiter of the end of a Task: resumes the awaiting coroutine inline, by symmetric transfer.
+     */
+    struct FinalAwaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        template<typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept {
+            std::coroutine_handle<> continuation = finished.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        error = std::current_exception();
+    }
+
+    std::coroutine_handle<> continuation; // Coroutine awaiting this one, resumed at its end
+    std::exception_ptr error;             // Exception that escaped the coroutine
+};
+
+/**
+ * @brief Promise of a Task returning a value.
+ * @tparam T Type of the value
+ */
+template<typename T>
+class TaskPromise : public TaskPromiseBase {
+public:
+    Task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value(U&& result) {
+        value.emplace(std::forward<U>(result));
+    }
+
+    /**
+     * @brief Returns the result of the coroutine.
+     * @return The value given to co_return.
+     * @throws The exception that escaped the coroutine.
+     */
+    T take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+
+private:
+    std::optional<T> value; // Value given to co_return
+};
+
+/**
+ * @brief Promise of a Task<void>.
+ */
+template<>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    /**
+     * @brief Rethrows the exception that escaped the coroutine, if any.
+     */
+    void take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief Lazy coroutine producing a T.
+ * The coroutine starts when it is awaited, on the awaiting thread, and resumes the awaiting
+ * coroutine inline when it ends. Moving between threads is explicit: co_await pool.schedule().
+ * A Task owns its coroutine frame and can be awaited once. Use syncWait() to wait for a Task
+ * from a plain function and detach() to run one without waiting for it.
+ * @tparam T Type of the result, void for none
+ */
+template<typename T = void>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    /**
+     * @brief Awaiter starting the coroutine, by symmetric transfer, and returning its result.
+     */
+    struct Awaiter {
+        std::coroutine_handle<promise_type> handle; // The awaited coroutine
+
+        bool await_ready() const noexcept {
+            return !handle || handle.done();
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+
+        T await_resume() {
+            return handle.promise().take();
+        }
+    };
+
+    Awaiter operator co_await() && noexcept {
+        return Awaiter{handle};
+    }
+
+    Awaiter operator co_await() & noexcept {
+        return Awaiter{handle};
+    }
+
+private:
+    friend promise_type;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle(handle) {}
+
+    std::coroutine_handle<promise_type> handle; // The coroutine, null once moved from
+};
+
+namespace detail {
+
+template<typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+/**
+ * @brief Eager coroutine destroying itself at its end, used by syncWait() and detach().
+ */
+struct DetachedCoroutine {
+    struct promise_type {
+        DetachedCoroutine get_return_object() const noexcept {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() const noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() const noexcept {
+            return {};
+        }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() const noexcept {
+            std::terminate();
+        }
+    };
+};
+
+/**
+ * @brief Runs a task and reports its end through a function.
+ * @param task The task to run
+ * @param done Called with the outcome of the task, a function of (std::optional<R>&&, std::exception_ptr)
+ */
+template<typename T, typename Done>
+DetachedCoroutine runDetached(Task<T> task, Done done) {
+    std::exception_ptr error;
+    if constexpr (std::is_void_v<T>) {
+        try {
+            co_await std::move(task);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done(error);
+    } else {
+        std::optional<T> result;
+        try {
+            result.emplace(co_await std::move(task));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done(std::move(result), error);
+    }
+}
+
+} // namespace detail
+
+/**
+ * @brief Runs a task and blocks the calling thread until it ends.
+ * The task starts on the calling thread, and moves to the pool at its first co_await of schedule().
+ * @param task The task
+ * @return The result of the task.
+ * @throws The exception that escaped the task.
+ */
+template<typename T>
+T syncWait(Task<T> task) {
+    PcoMutex mutex;
+    PcoConditionVariable cond;
+    bool finished = false;
+    std::exception_ptr failure;
+    std::optional<std::conditional_t<std::is_void_v<T>, char, T>> value;
+
+    auto finish = [&](std::exception_ptr error) {
+        mutex.lock();
+        failure = error;
+        finished = true;
+        cond.notifyAll();
+        mutex.unlock();
+    };
+    if constexpr (std::is_void_v<T>) {
+        detail::runDetached(std::move(task), finish);
+    } else {
+        detail::runDetached(std::move(task), [&](std::optional<T>&& result, std::exception_ptr error) {
+            value = std::move(result);
+            finish(error);
+        });
+    }
+
+    mutex.lock();
+    while (!finished) {
+        cond.wait(&mutex);
+    }
+    mutex.unlock();
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+    if constexpr (!std::is_void_v<T>) {
+        return std::move(*value);
+    }
+}
+
+/**
+ * @brief Runs a task without waiting for it: its frame is freed when it ends.
+ * An exception escaping the task is logged and dropped.
+ * @param task The task, it starts on the calling thread
+ */
+inline void detach(Task<void> task) {
+    detail::runDetached(std::move(task), [](std::exception_ptr error) {
+        if (error) {
+            try {
+                std::rethrow_exception(error);
+            } catch (const std::exception& e) {
+                poolLog<LogLevel::Error>("Detached coroutine failed: ", e.what());
+            } catch (...) {
+                poolLog<LogLevel::Error>("Detached coroutine failed");
+            }
+        }
+    });
+}
+
+#endif // COROUTINETASK_H
@@ -0,0 +1,210 @@
+/**
+ * @file cputopology.h
+ * @brief Header file defining CpuTopology, the NUMA layout of the machine, and the thread pinning helpers.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef CPUTOPOLOGY_H
+#define CPUTOPOLOGY_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * @brief CPUs of the machine grouped by NUMA node.
+ * On Linux, the nodes are read from /sys/devices/system/node and restricted to the CPUs the
+ * process may run on. Elsewhere, or without sysfs, the machine is seen as a single node.
+ */
+class CpuTopology {
+public:
+    /**
+     * @brief Detects the topology of the machine.
+     * @return The detected topology, with at least one node holding at least one CPU.
+     */
+    static CpuTopology detect() {
+        CpuTopology topology;
+        std::set<int> allowed = allowedCpus();
+
+        std::error_code error;
+        std::vector<std::pair<int, std::vector<int>>> nodes;
+        for (const auto &entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+            std::string name = entry.path().filename().string();
+            if (name.size() <= 4 || name.compare(0, 4, "node") != 0 ||
+                !std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+                continue;
+            }
+            std::ifstream file(entry.path() / "cpulist");
+            std::string list;
+            std::getline(file, list);
+            std::vector<int> cpus;
+            for (int cpu : parseCpuList(list)) {
+                if (allowed.count(cpu)) {
+                    cpus.push_back(cpu);
+                }
+            }
+            if (!cpus.empty()) {
+                nodes.emplace_back(std::stoi(name.substr(4)), std::move(cpus));
+            }
+        }
+        std::sort(nodes.begin(), nodes.end());
+        for (auto &node : nodes) {
+            topology.nodes.push_back(std::move(node.second));
+        }
+
+        if (topology.nodes.empty()) {
+            topology.nodes.emplace_back(allowed.begin(), allowed.end());
+        }
+        return topology;
+    }
+
+    /**
+     * @brief Builds a topology from explicit node contents, mostly for tests.
+     * @param nodes The CPUs of each node
+     */
+    explicit CpuTopology(std::vector<std::vector<int>> nodes) : nodes(std::move(nodes)) {}
+
+    /**
+     * @brief Returns the number of NUMA nodes.
+     * @return The number of nodes, at least one.
+     */
+    size_t nbNodes() const {
+        return nodes.size();
+    }
+
+    /**
+     * @brief Returns the CPUs of a node.
+     * @param node Index of the node
+     * @return The CPUs, in increasing order.
+     */
+    const std::vector<int>& cpusOf(size_t node) const {
+        return nodes[node];
+    }
+
+    /**
+     * @brief Returns the CPUs of the machine, interleaved across the nodes.
+     * The i-th CPU of each node comes before the (i+1)-th of any node, so taking the first n
+     * CPUs spreads n threads evenly over the nodes.
+     * @return The interleaved list of CPUs.
+     */
+    std::vector<int> interleavedCpus() const {
+        std::vector<int> cpus;
+        for (size_t i = 0;; ++i) {
+            bool found = false;
+            for (const auto &node : nodes) {
+                if (i < node.size()) {
+                    cpus.push_back(node[i]);
+                    found = true;
+                }
+            }
+            if (!found) {
+                return cpus;
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the node of a CPU.
+     * @param cpu The CPU
+     * @return The index of its node, 0 if the CPU is unknown.
+     */
+    size_t nodeOf(int cpu) const {
+        for (size_t node = 0; node < nodes.size(); ++node) {
+            if (std::binary_search(nodes[node].begin(), nodes[node].end(), cpu)) {
+                return node;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Restricts the calling thread to a set of CPUs.
+     * @param cpus The CPUs the thread may run on
+     * @return True if the affinity was set, false if it is not supported or failed.
+     */
+    static bool pinCurrentThread(const std::vector<int>& cpus) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpus;
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Parses a list of CPUs in the sysfs format, such as "0-3,8,10-11".
+     * @param list The list
+     * @return The CPUs of the list.
+     */
+    static std::vector<int> parseCpuList(const std::string& list) {
+        std::vector<int> cpus;
+        std::stringstream stream(list);
+        std::string range;
+        while (std::getline(stream, range, ',')) {
+            if (range.empty() || !::isdigit(static_cast<unsigned char>(range[0]))) {
+                continue;
+            }
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+private:
+    CpuTopology() = default;
+
+    /**
+     * @brief Returns the CPUs the process may run on.
+     * @return The CPUs of the affinity mask, or all the CPUs if it cannot be read.
+     */
+    static std::set<int> allowedCpus() {
+        std::set<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.insert(cpu);
+                }
+            }
+        }
+#endif
+        if (cpus.empty()) {
+            unsigned count = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned cpu = 0; cpu < count; ++cpu) {
+                cpus.insert(static_cast<int>(cpu));
+            }
+        }
+        return cpus;
+    }
+
+    std::vector<std::vector<int>> nodes; // CPUs of each node, in increasing order
+};
+
+#endif // CPUTOPOLOGY_H
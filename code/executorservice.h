@@ -0,0 +1,431 @@
+/**
+ * @file executorservice.h
+ * @brief Header file defining ExecutorService, which hosts several logical pools sharing the worker threads of one ThreadPool.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef EXECUTORSERVICE_H
+#define EXECUTORSERVICE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <pcosynchro/pcomutex.h>
+#include <pcosynchro/pcoconditionvariable.h>
+
+#include "functiontask.h"
+#include "poollog.h"
+#include "prioritylanes.h"
+#include "runnable.h"
+#include "threadpool.h"
+
+/**
+ * @brief Settings of a logical pool of an ExecutorService.
+ */
+struct LogicalPoolConfig {
+    std::string name;                           // Name of the pool, for the statistics
+    unsigned weight = 1;                        // Share of the workers while the pools compete, relative to the others
+    size_t maxNbWaiting = 1000;                 // Maximum number of tasks waiting in the queue of the pool
+    TaskPriority priority = TaskPriority::Normal; // Pools of a higher priority are served first, with aging
+    size_t maxThreads = 0;                      // Maximum number of workers running tasks of the pool at once, 0 for the whole budget
+};
+
+/**
+ * @brief Statistics of a logical pool, as returned by ExecutorService::stats().
+ */
+struct LogicalPoolStats {
+    std::string name;           // Name of the pool
+    uint64_t tasksSubmitted = 0; // Tasks accepted by start() and submit()
+    uint64_t tasksRejected = 0; // Tasks cancelled through cancelRun() because the queue of the pool was full
+    uint64_t tasksCancelled = 0; // Queued tasks cancelled through cancelRun() by a shutdown
+    uint64_t tasksRun = 0;      // Tasks whose run() returned or threw
+    size_t queueDepth = 0;      // Tasks waiting in the queue of the pool (gauge)
+    size_t nbRunning = 0;       // Workers running a task of the pool (gauge)
+};
+
+/**
+ * @brief Several logical pools, each with its own queue, priority and maxNbWaiting, sharing
+ * the budget of worker threads of a single ThreadPool.
+ * The tasks wait in the queue of their logical pool; the ThreadPool only holds one pump task
+ * per busy worker, at most budget of them. A pump runs the tasks of the pools until every
+ * queue is empty, picking the next pool by stride scheduling: among the pools of the highest
+ * priority with a waiting task, the one that got the least service relative to its weight.
+ * A pool that was idle starts again at the current virtual time, without credit for the time
+ * it did not use. A pool skipped Lanes::AgingThreshold times in a row by pools of a higher
+ * priority is served next, as in the waiting queue of the ThreadPool. The workers a pool does
+ * not use go to the busy ones.
+ * A full queue rejects the submitted task through its cancelRun(), start() never blocks.
+ */
+class ExecutorService {
+public:
+    using PoolId = size_t;
+
+    /**
+     * @brief Constructor
+     * @param budget Number of worker threads shared by the logical pools
+     * @param idleTimeout Duration before idle worker threads terminate
+     * @throws std::invalid_argument if budget is not positive or idleTimeout is negative
+     */
+    ExecutorService(int budget, std::chrono::milliseconds idleTimeout)
+        : budget(budget > 0 ? static_cast<size_t>(budget) : 0),
+          workers(checkBudget(budget), budget, idleTimeout) {}
+
+    ExecutorService(const ExecutorService&) = delete;
+    ExecutorService& operator=(const ExecutorService&) = delete;
+
+    /**
+     * @brief Destructor
+     * Runs the queued tasks, then waits for the pumps before the workers are stopped.
+     */
+    ~ExecutorService() {
+        shutdown();
+        mutex.lock();
+        while (nbPumps > 0) {
+            cond.wait(&mutex);
+        }
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Adds a logical pool.
+     * @param config Settings of the pool
+     * @return The identifier of the pool.
+     * @throws std::invalid_argument if the weight or maxNbWaiting is zero
+     */
+    PoolId addPool(LogicalPoolConfig config) {
+        if (config.weight == 0) {
+            throw std::invalid_argument("weight must be positive");
+        }
+        if (config.maxNbWaiting == 0) {
+            throw std::invalid_argument("maxNbWaiting must be positive");
+        }
+        if (config.maxThreads == 0 || config.maxThreads > budget) {
+            config.maxThreads = budget;
+        }
+        mutex.lock();
+        pools.emplace_back();
+        LogicalPool& pool = pools.back();
+        pool.config = std::move(config);
+        pool.pass = virtualTime;
+        PoolId id = pools.size() - 1;
+        mutex.unlock();
+        return id;
+    }
+
+    /**
+     * @brief Starts a task in a logical pool, without ever blocking.
+     * @param id The logical pool
+     * @param runnable The task, run or cancelled through its cancelRun()
+     * @return True if the task was queued, false if the queue of the pool is full (cancelRun()
+     *         was called) or the service is shut down.
+     * @throws std::invalid_argument if runnable is null or the pool does not exist
+     */
+    bool start(PoolId id, std::unique_ptr<Runnable> runnable) {
+        return start(id, TaskPtr(runnable.release()));
+    }
+
+    /**
+     * @brief start() for a task built with the makeTask() of workerPool().
+     * @param id The logical pool
+     * @param runnable The task, run or cancelled through its cancelRun()
+     * @return True if the task was queued, false otherwise.
+     * @throws std::invalid_argument if runnable is null or the pool does not exist
+     */
+    bool start(PoolId id, TaskPtr runnable) {
+        if (!runnable) {
+            throw std::invalid_argument("runnable cannot be null");
+        }
+        mutex.lock();
+        if (id >= pools.size()) {
+            mutex.unlock();
+            throw std::invalid_argument("unknown pool");
+        }
+        if (isShuttingDown) {
+            mutex.unlock();
+            return false;
+        }
+
+        LogicalPool& pool = pools[id];
+        if (pool.tasks.size() >= pool.config.maxNbWaiting) {
+            ++pool.tasksRejected;
+            mutex.unlock();
+            runnable->cancelRun();
+            return false;
+        }
+        // A pool coming back from idle gets no credit for the time it did not use
+        if (pool.tasks.empty() && pool.nbRunning == 0) {
+            pool.pass = std::max(pool.pass, virtualTime);
+        }
+        pool.tasks.push_back(std::move(runnable));
+        ++pool.tasksSubmitted;
+
+        bool newPump = nbPumps < budget;
+        if (newPump) {
+            ++nbPumps;
+        }
+        mutex.unlock();
+
+        // trySubmit() never waits for a worker. The queue of the workers has a slot per pump,
+        // so only a shutdown refuses one, its cancelRun() or destructor giving its place back.
+        if (newPump) {
+            workers.trySubmit(workers.makeTask<PumpTask>(*this));
+        }
+        return true;
+    }
+
+    /**
+     * @brief Submits a callable to a logical pool, without having to write a Runnable subclass.
+     * @param id The logical pool
+     * @param f The callable
+     * @param args Arguments given to the callable, copied or moved into the task
+     * @return A future holding the result of the callable, or a TaskCancelledError if it is cancelled.
+     * @throws std::invalid_argument if the pool does not exist
+     */
+    template<typename F, typename... Args>
+    auto submit(PoolId id, F&& f, Args&&... args) -> TaskFuture<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+        using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+        using Call = PackagedCall<R, std::decay_t<F>, std::decay_t<Args>...>;
+
+        auto state = std::make_shared<FutureState<R>>();
+        start(id, workers.makeTask<FunctionTask>(Call(state, std::forward<F>(f), std::forward<Args>(args)...)));
+        return TaskFuture<R>(std::move(state));
+    }
+
+    /**
+     * @brief Stops accepting tasks.
+     * @param drain True to still run the queued tasks, false to cancel them through their cancelRun()
+     * @return The number of tasks cancelled.
+     */
+    size_t shutdown(bool drain = true) {
+        std::vector<std::pair<LogicalPool*, TaskPtr>> cancelled;
+        mutex.lock();
+        isShuttingDown = true;
+        if (!drain) {
+            for (auto &pool : pools) {
+                for (auto &task : pool.tasks) {
+                    cancelled.emplace_back(&pool, std::move(task));
+                }
+                pool.tasksCancelled += pool.tasks.size();
+                pool.tasks.clear();
+            }
+        }
+        mutex.unlock();
+
+        for (auto &entry : cancelled) {
+            entry.second->cancelRun();
+        }
+        return cancelled.size();
+    }
+
+    /**
+     * @brief Returns the statistics of a logical pool.
+     * @param id The logical pool
+     * @return Its counters and gauges.
+     * @throws std::invalid_argument if the pool does not exist
+     */
+    LogicalPoolStats stats(PoolId id) {
+        mutex.lock();
+        if (id >= pools.size()) {
+            mutex.unlock();
+            throw std::invalid_argument("unknown pool");
+        }
+        const LogicalPool& pool = pools[id];
+        LogicalPoolStats result;
+        result.name = pool.config.name;
+        result.tasksSubmitted = pool.tasksSubmitted;
+        result.tasksRejected = pool.tasksRejected;
+        result.tasksCancelled = pool.tasksCancelled;
+        result.tasksRun = pool.tasksRun;
+        result.queueDepth = pool.tasks.size();
+        result.nbRunning = pool.nbRunning;
+        mutex.unlock();
+        return result;
+    }
+
+    /**
+     * @brief Returns the number of logical pools.
+     * @return The number of calls to addPool().
+     */
+    size_t nbPools() {
+        mutex.lock();
+        size_t count = pools.size();
+        mutex.unlock();
+        return count;
+    }
+
+    /**
+     * @brief Returns the ThreadPool whose workers run the logical pools, for its metrics,
+     * tracing or makeTask(). Tasks started on it directly are not accounted to any logical pool.
+     * @return The shared pool.
+     */
+    ThreadPool& workerPool() {
+        return workers;
+    }
+
+private:
+    static constexpr uint64_t Stride = 1 << 20; // Virtual time of a task of a pool of weight 1
+
+    /**
+     * @brief A logical pool, protected by the mutex of the service.
+     */
+    struct LogicalPool {
+        LogicalPoolConfig config;       // Settings of the pool
+        std::deque<TaskPtr> tasks;      // Waiting tasks, in submission order
+        uint64_t pass = 0;              // Virtual time of the pool, advanced by Stride / weight per task
+        unsigned skipped = 0;           // Picks in a row that went to a pool of a higher priority while this one waited
+        size_t nbRunning = 0;           // Workers running a task of the pool
+        uint64_t tasksSubmitted = 0;    // See LogicalPoolStats
+        uint64_t tasksRejected = 0;     // See LogicalPoolStats
+        uint64_t tasksCancelled = 0;    // See LogicalPoolStats
+        uint64_t tasksRun = 0;          // See LogicalPoolStats
+    };
+
+    /**
+     * @brief Task of the ThreadPool serving the logical pools until they are all empty.
+     * Cancelled or destroyed before it ran, it gives its place back.
+     */
+    class PumpTask : public Runnable {
+    public:
+        explicit PumpTask(ExecutorService& service) : service(service) {}
+
+        ~PumpTask() override {
+            if (!finished) {
+                service.endPump();
+            }
+        }
+
+        void run() override {
+            finished = true;
+            service.pump();
+        }
+
+        void cancelRun() override {
+            finished = true;
+            service.endPump();
+        }
+
+        std::string id() override {
+            return "ExecutorPump";
+        }
+
+    private:
+        ExecutorService& service;   // Service whose pools are served
+        bool finished = false;      // Set once the pump ran or was cancelled
+    };
+
+    /**
+     * @brief Checks the budget before the ThreadPool is built.
+     * @param budget Number of worker threads
+     * @return The budget.
+     * @throws std::invalid_argument if budget is not positive
+     */
+    static int checkBudget(int budget) {
+        if (budget <= 0) {
+            throw std::invalid_argument("budget must be greater than 0");
+        }
+        return budget;
+    }
+
+    /**
+     * @brief Picks the pool to serve next and charges it for one task (under the mutex).
+     * @return The pool, null if no pool has a waiting task and room for another worker.
+     */
+    LogicalPool* pick() {
+        LogicalPool* best = nullptr;
+        LogicalPool* starving = nullptr;
+        for (auto &pool : pools) {
+            if (pool.tasks.empty() || pool.nbRunning >= pool.config.maxThreads) {
+                continue;
+            }
+            if (pool.skipped >= Lanes::AgingThreshold && (!starving || pool.pass < starving->pass)) {
+                starving = &pool;
+            }
+            if (!best || pool.config.priority > best->config.priority ||
+                (pool.config.priority == best->config.priority && pool.pass < best->pass)) {
+                best = &pool;
+            }
+        }
+        if (starving) {
+            best = starving;
+        }
+        if (!best) {
+            return nullptr;
+        }
+
+        for (auto &pool : pools) {
+            if (&pool == best) {
+                pool.skipped = 0;
+            } else if (!pool.tasks.empty() && pool.config.priority < best->config.priority) {
+                ++pool.skipped;
+            }
+        }
+        virtualTime = std::max(virtualTime, best->pass);
+        best->pass += Stride / best->config.weight;
+        return best;
+    }
+
+    /**
+     * @brief Body of a pump: runs the tasks of the pools, one at a time, until none can be
+     * picked. Nothing of the service may be touched once it gave its place back.
+     */
+    void pump() {
+        mutex.lock();
+        while (LogicalPool* pool = pick()) {
+            TaskPtr task = std::move(pool->tasks.front());
+            pool->tasks.pop_front();
+            ++pool->nbRunning;
+            mutex.unlock();
+
+            try {
+                task->run();
+            } catch (const std::exception& e) {
+                poolLog<LogLevel::Error>("Task execution failed: ", e.what());
+            }
+            task.reset();
+
+            mutex.lock();
+            --pool->nbRunning;
+            ++pool->tasksRun;
+        }
+        // Given back under the same lock as the last pick: a task queued from now on starts a new pump
+        if (--nbPumps == 0) {
+            cond.notifyAll();
+        }
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Gives the place of a pump that did not run back, and tells the destructor once
+     * the last one ended. Nothing of the service may be touched afterwards by the caller.
+     */
+    void endPump() {
+        mutex.lock();
+        if (--nbPumps == 0) {
+            cond.notifyAll();
+        }
+        mutex.unlock();
+    }
+
+    size_t budget;                          // Maximum number of pumps, one per worker thread
+    PcoMutex mutex;                         // Protects everything below
+    PcoConditionVariable cond;              // Signaled when the last pump ends
+    std::deque<LogicalPool> pools;          // The logical pools, a deque as they cannot be moved
+    uint64_t virtualTime = 0;               // Pass of the pool picked last, given to the pools coming back from idle
+    size_t nbPumps = 0;                     // Pump tasks started and not ended yet
+    bool isShuttingDown = false;            // Set by shutdown()
+    ThreadPool workers;                     // Shared worker threads, destroyed first
+};
+
+#endif // EXECUTORSERVICE_H
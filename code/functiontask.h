@@ -0,0 +1,304 @@
+/**
+ * @file functiontask.h
+ * @brief Header file defining FunctionTask and TaskFuture, used to run plain callables on the ThreadPool.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef FUNCTIONTASK_H
+#define FUNCTIONTASK_H
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <pcosynchro/pcomutex.h>
+#include <pcosynchro/pcoconditionvariable.h>
+
+#include "runnable.h"
+
+/**
+ * @brief Error reported by TaskFuture::get() when the task was cancelled instead of run.
+ * This happens on queue overflow (cancelRun()) or when the pool drops the task at shutdown.
+ */
+class TaskCancelledError : public std::runtime_error {
+public:
+    TaskCancelledError() : std::runtime_error("Task was cancelled before running") {}
+};
+
+/**
+ * @brief State shared by a submitted callable and its TaskFuture.
+ * @tparam R Return type of the callable
+ */
+template<typename R>
+class FutureState {
+public:
+    using Value = std::conditional_t<std::is_void_v<R>, char, R>;
+
+    /**
+     * @brief Stores the result of the callable and wakes up the waiters.
+     * @param result The value returned by the callable
+     */
+    void setValue(Value result) {
+        mutex.lock();
+        value.emplace(std::move(result));
+        ready = true;
+        cond.notifyAll();
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Stores the exception thrown by the callable and wakes up the waiters.
+     * @param exception The exception to rethrow from get()
+     */
+    void setException(std::exception_ptr exception) {
+        mutex.lock();
+        error = std::move(exception);
+        ready = true;
+        cond.notifyAll();
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Blocks until the callable ran or was cancelled.
+     */
+    void wait() {
+        mutex.lock();
+        while (!ready) {
+            cond.wait(&mutex);
+        }
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Checks if get() would return without blocking.
+     * @return True if the result is available, false otherwise.
+     */
+    bool isReady() {
+        mutex.lock();
+        bool result = ready;
+        mutex.unlock();
+        return result;
+    }
+
+    /**
+     * @brief Waits for and moves out the result.
+     * @return The value returned by the callable.
+     * @throws The exception thrown by the callable, or TaskCancelledError.
+     */
+    Value take() {
+        wait();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+
+private:
+    PcoMutex mutex;                 // Protects the fields below
+    PcoConditionVariable cond;      // Signaled once the result is set
+    bool ready = false;             // True once value or error is set
+    std::optional<Value> value;     // Result of the callable
+    std::exception_ptr error;       // Exception of the callable, or TaskCancelledError
+};
+
+/**
+ * @brief Handle on the result of a callable submitted with ThreadPool::submit().
+ * @tparam R Return type of the callable
+ */
+template<typename R>
+class TaskFuture {
+public:
+    TaskFuture() = default;
+
+    /**
+     * @brief Constructor
+     * @param state The state shared with the submitted task
+     */
+    explicit TaskFuture(std::shared_ptr<FutureState<R>> state) : state(std::move(state)) {}
+
+    /**
+     * @brief Waits for the callable and returns its result.
+     * Can only be called once.
+     * @return The value returned by the callable.
+     * @throws The exception thrown by the callable, or TaskCancelledError if it never ran.
+     */
+    R get() {
+        auto shared = std::move(state);
+        if constexpr (std::is_void_v<R>) {
+            shared->take();
+        } else {
+            return shared->take();
+        }
+    }
+
+    /**
+     * @brief Blocks until the callable ran or was cancelled.
+     */
+    void wait() const {
+        state->wait();
+    }
+
+    /**
+     * @brief Checks if get() would return without blocking.
+     * @return True if the result is available, false otherwise.
+     */
+    bool isReady() const {
+        return state->isReady();
+    }
+
+    /**
+     * @brief Checks if the future refers to a task.
+     * @return False once get() was called or for a default constructed future.
+     */
+    bool valid() const {
+        return state != nullptr;
+    }
+
+private:
+    std::shared_ptr<FutureState<R>> state; // State shared with the submitted task
+};
+
+/**
+ * @brief A callable bound to its arguments and to the state of its TaskFuture.
+ * @tparam R Return type of the callable
+ * @tparam F Type of the callable
+ * @tparam Args Types of the bound arguments
+ */
+template<typename R, typename F, typename... Args>
+class PackagedCall {
+public:
+    template<typename Fn, typename... A>
+    PackagedCall(std::shared_ptr<FutureState<R>> state, Fn&& f, A&&... args)
+        : f(std::forward<Fn>(f)), args(std::forward<A>(args)...), state(std::move(state)) {}
+
+    /**
+     * @brief Calls the callable and publishes its result or exception.
+     */
+    void run() {
+        try {
+            if constexpr (std::is_void_v<R>) {
+                std::apply(f, std::move(args));
+                state->setValue(0);
+            } else {
+                state->setValue(std::apply(f, std::move(args)));
+            }
+        } catch (...) {
+            state->setException(std::current_exception());
+        }
+    }
+
+    /**
+     * @brief Publishes a TaskCancelledError instead of running the callable.
+     */
+    void cancel() {
+        state->setException(std::make_exception_ptr(TaskCancelledError()));
+    }
+
+private:
+    F f;                                    // The callable
+    std::tuple<Args...> args;               // Its arguments
+    std::shared_ptr<FutureState<R>> state;  // State shared with the TaskFuture
+};
+
+/**
+ * @brief Runnable wrapping any job object exposing run() and cancel().
+ * The job is type-erased into an inline buffer of InlineSize bytes, so small captures do
+ * not need an allocation of their own. Bigger jobs fall back to the heap. All FunctionTask
+ * objects have the same size whatever they wrap.
+ * If the task is destroyed without having been run or cancelled (e.g. dropped at shutdown),
+ * the job is cancelled so that its TaskFuture never blocks forever.
+ */
+class FunctionTask : public Runnable {
+public:
+    static constexpr size_t InlineSize = 64; // Size of the inline buffer
+
+    /**
+     * @brief Constructor
+     * @param job The job to run, moved into the inline buffer when it fits
+     */
+    template<typename Job, typename = std::enable_if_t<!std::is_same_v<std::decay_t<Job>, FunctionTask>>>
+    explicit FunctionTask(Job&& job) {
+        using J = std::decay_t<Job>;
+        if constexpr (fitsInline<J>()) {
+            target = new (storage) J(std::forward<Job>(job));
+            ops = &inlineOps<J>;
+        } else {
+            target = new J(std::forward<Job>(job));
+            ops = &heapOps<J>;
+        }
+    }
+
+    FunctionTask(const FunctionTask&) = delete;
+    FunctionTask& operator=(const FunctionTask&) = delete;
+
+    ~FunctionTask() override {
+        if (!finished) {
+            ops->cancel(target);
+        }
+        ops->destroy(target);
+    }
+
+    void run() override {
+        finished = true;
+        ops->run(target);
+    }
+
+    void cancelRun() override {
+        finished = true;
+        ops->cancel(target);
+    }
+
+    std::string id() override {
+        return "FunctionTask";
+    }
+
+    /**
+     * @brief Checks if a job of type J is stored in the inline buffer.
+     * @return True if no allocation is needed for J, false otherwise.
+     */
+    template<typename J>
+    static constexpr bool fitsInline() {
+        return sizeof(J) <= InlineSize && alignof(J) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible_v<J>;
+    }
+
+private:
+    /**
+     * @brief Hand written vtable of the stored job.
+     */
+    struct Ops {
+        void (*run)(void*);
+        void (*cancel)(void*);
+        void (*destroy)(void*);
+    };
+
+    template<typename J>
+    static inline const Ops inlineOps = {
+        [](void* p) { static_cast<J*>(p)->run(); },
+        [](void* p) { static_cast<J*>(p)->cancel(); },
+        [](void* p) { static_cast<J*>(p)->~J(); }
+    };
+
+    template<typename J>
+    static inline const Ops heapOps = {
+        [](void* p) { static_cast<J*>(p)->run(); },
+        [](void* p) { static_cast<J*>(p)->cancel(); },
+        [](void* p) { delete static_cast<J*>(p); }
+    };
+
+    alignas(std::max_align_t) unsigned char storage[InlineSize]; // Inline buffer for small jobs
+    void* target;                   // The stored job, in storage or on the heap
+    const Ops* ops;                 // Operations on the stored job
+    bool finished = false;          // True once the job was run or cancelled
+};
+
+#endif // FUNCTIONTASK_H
@@ -0,0 +1,134 @@
+/**
+ * @file mpmcqueue.h
+ * @brief Header file defining MpmcQueue, a bounded lock-free multi-producer/multi-consumer ring buffer.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef MPMCQUEUE_H
+#define MPMCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+
+/**
+ * @brief Bounded lock-free MPMC queue (Dmitry Vyukov's sequenced ring buffer).
+ * Each cell carries a sequence number telling producers and consumers whether it is
+ * free or filled for their position, so push and pop only need one CAS on their own index.
+ * The sequence of the cell of position pos is 2 * pos while it is free and 2 * pos + 1 once
+ * filled; the doubling keeps both states distinct from the next lap even with a single cell.
+ * @tparam T Type of the stored elements, must be default constructible and movable
+ */
+template<typename T>
+class MpmcQueue {
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Maximum number of elements held by the queue
+     * @throws std::invalid_argument if capacity is zero
+     */
+    explicit MpmcQueue(size_t capacity)
+        : capacity(capacity),
+          cells(capacity > 0 ? std::make_unique<Cell[]>(capacity) : nullptr) {
+        if (capacity == 0) {
+            throw std::invalid_argument("MpmcQueue capacity must be greater than 0");
+        }
+        for (size_t i = 0; i < capacity; ++i) {
+            cells[i].sequence.store(2 * i, std::memory_order_relaxed);
+        }
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    /**
+     * @brief Tries to append an element.
+     * @param value The element, only moved from if the push succeeds
+     * @return True if the element was queued, false if the queue is full.
+     */
+    bool tryPush(T& value) {
+        Cell* cell;
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos % capacity];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            auto dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(2 * pos);
+            if (dif == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false; // The cell still holds the element of the previous lap
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(value);
+        cell->sequence.store(2 * pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Tries to remove the oldest element.
+     * @param value Receives the element if the pop succeeds
+     * @return True if an element was removed, false if the queue is empty.
+     */
+    bool tryPop(T& value) {
+        Cell* cell;
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells[pos % capacity];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            auto dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(2 * pos + 1);
+            if (dif == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false; // The cell has not been filled for this lap yet
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->data);
+        cell->sequence.store(2 * (pos + capacity), std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Returns an approximation of the number of queued elements.
+     * Exact when no push or pop is in progress.
+     * @return The number of elements in the queue.
+     */
+    size_t sizeApprox() const {
+        size_t tail = enqueuePos.load(std::memory_order_seq_cst);
+        size_t head = dequeuePos.load(std::memory_order_seq_cst);
+        return tail > head ? tail - head : 0;
+    }
+
+    /**
+     * @brief Checks if the queue looks empty.
+     * @return True if no element is queued, false otherwise.
+     */
+    bool empty() const {
+        return sizeApprox() == 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence; // 2 * pos when free for position pos, 2 * pos + 1 when filled
+        T data;                       // Stored element
+    };
+
+    const size_t capacity;                          // Number of cells in the ring
+    std::unique_ptr<Cell[]> cells;                  // The ring buffer itself
+    alignas(64) std::atomic<size_t> enqueuePos;     // Next position to write, shared by producers
+    alignas(64) std::atomic<size_t> dequeuePos;     // Next position to read, shared by consumers
+};
+
+#endif // MPMCQUEUE_H
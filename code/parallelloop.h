@@ -0,0 +1,427 @@
+/**
+ * @file parallelloop.h
+ * @brief Header file defining parallelFor() and parallelReduce(), data-parallel loops run on a ThreadPool.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef PARALLELLOOP_H
+#define PARALLELLOOP_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include <pcosynchro/pcomutex.h>
+#include <pcosynchro/pcoconditionvariable.h>
+
+#include "runnable.h"
+#include "threadpool.h"
+
+/**
+ * @brief Shared state of one parallelFor() or parallelReduce(), over the items [0, nbItems).
+ * The calling thread first runs a few items alone to measure their cost, which gives the
+ * grain: the number of items a chunk needs to last about TargetChunkTime. The rest of the
+ * range is then split in halves recursively down to the grain, each right half becoming a
+ * piece any thread can claim with an atomic flag. Up to one task per thread of the pool is
+ * offered with trySubmit(), which never blocks: from a worker it lands on its local deque and
+ * is stolen by the idle threads, from another thread in the shared queue. Such a task claims
+ * pieces until none is left, so that the queue of the pool never fills up with tasks of the
+ * loop. The calling thread claims pieces too instead of blocking, and only sleeps once every
+ * piece is running.
+ * @tparam Result Type of the partial results of the chunks, std::monostate for parallelFor()
+ */
+template<typename Result>
+class ParallelLoop : public std::enable_shared_from_this<ParallelLoop<Result>> {
+public:
+    using Chunk = std::function<Result(size_t, size_t)>;   // Processes the items [begin, end)
+    using Combine = std::function<Result(Result, Result)>; // Merges the results of two adjacent ranges
+
+    static constexpr size_t PiecesPerThread = 64;                       // Upper bound of the pieces per thread
+    static constexpr std::chrono::nanoseconds TargetChunkTime{100000};  // Duration aimed at for a chunk
+    static constexpr std::chrono::nanoseconds ProbeTime{10000};         // Duration of the measuring run
+
+    /**
+     * @brief Runs a loop and waits for it, the calling thread taking part in it.
+     * @param pool The pool running the loop
+     * @param nbItems Number of items, at least 1
+     * @param chunk Processes a range of items
+     * @param combine Merges the results of two adjacent ranges, the left one first
+     * @param grain Items per chunk, 0 to derive it from the measured cost of an item
+     * @return The results of every chunk, combined from left to right.
+     * @throws The first exception thrown by a chunk, or TaskCancelledError.
+     */
+    static Result run(ThreadPool& pool, size_t nbItems, Chunk chunk, Combine combine, size_t grain) {
+        auto loop = std::make_shared<ParallelLoop>(pool, nbItems, std::move(chunk), std::move(combine));
+        return loop->execute(grain);
+    }
+
+    /**
+     * @brief Constructor, use run() instead.
+     * @param pool The pool running the loop
+     * @param nbItems Number of items
+     * @param chunk Processes a range of items
+     * @param combine Merges the results of two adjacent ranges
+     */
+    ParallelLoop(ThreadPool& pool, size_t nbItems, Chunk chunk, Combine combine)
+        : pool(pool), nbItems(nbItems), chunk(std::move(chunk)), combine(std::move(combine)) {}
+
+private:
+    /**
+     * @brief A range of items handed to one thread.
+     */
+    struct Piece {
+        size_t begin = 0;                   // First item
+        size_t end = 0;                     // Past the last item, lowered by the owner as it splits the piece
+        std::atomic<bool> ready{false};     // Set once begin and end are written
+        std::atomic<bool> claimed{false};   // Set by the thread processing the piece
+        std::optional<Result> partial;      // Result of [begin, end) once processed
+    };
+
+    /**
+     * @brief Task offered to the pool, it claims the pieces of the loop until none is left.
+     * If the pool cancels or drops it, the other threads of the loop process the pieces.
+     */
+    class HelperTask : public Runnable {
+    public:
+        explicit HelperTask(std::shared_ptr<ParallelLoop> loop) : loop(std::move(loop)) {}
+
+        ~HelperTask() override {
+            if (!finished) {
+                loop->leaveHelper();
+            }
+        }
+
+        void run() override {
+            finished = true;
+            while (loop->helpOnce()) {}
+            loop->leaveHelper();
+        }
+
+        void cancelRun() override {
+            finished = true;
+            loop->leaveHelper();
+        }
+
+        std::string id() override {
+            return "ParallelLoop";
+        }
+
+    private:
+        std::shared_ptr<ParallelLoop> loop; // Loop helped, kept alive by the task
+        bool finished = false;              // Set once run() or cancelRun() was called
+    };
+
+    /**
+     * @brief Body of run(), on the calling thread.
+     * @param grainHint Items per chunk, 0 to measure it
+     * @return The combined result.
+     */
+    Result execute(size_t grainHint) {
+        maxHelpers = pool.maxNbThreads();
+        const size_t nbWorkers = maxHelpers + 1;
+
+        // Measure the cost of an item on the first ones, doubling their number up to ProbeTime
+        const size_t maxProbe = std::max<size_t>(1, nbItems / (4 * nbWorkers));
+        auto probeStart = std::chrono::steady_clock::now();
+        std::optional<Result> head;
+        size_t probed = 0;
+        for (size_t count = 1; probed < maxProbe; count *= 2) {
+            size_t last = probed + std::min(count, maxProbe - probed);
+            Result partial = chunk(probed, last);
+            head = head ? combine(std::move(*head), std::move(partial)) : std::move(partial);
+            probed = last;
+            if (std::chrono::steady_clock::now() - probeStart >= ProbeTime) {
+                break;
+            }
+        }
+        const size_t rest = nbItems - probed;
+        if (rest == 0) {
+            return std::move(*head);
+        }
+
+        grain = grainHint;
+        if (grain == 0) {
+            auto probeTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - probeStart).count();
+            auto perItem = std::max<int64_t>(1, probeTime / static_cast<int64_t>(probed));
+            grain = std::max<size_t>(1, static_cast<size_t>(TargetChunkTime.count() / perItem));
+        }
+        // Bound the number of pieces, which also bounds the memory they take
+        grain = std::max(grain, (rest + PiecesPerThread * nbWorkers - 1) / (PiecesPerThread * nbWorkers));
+
+        // Too little work to be worth sharing
+        if (grain >= rest) {
+            return combine(std::move(*head), chunk(probed, nbItems));
+        }
+
+        // Halving a range bigger than the grain gives pieces of at least grain / 2 items
+        capacity = 2 * ((rest + grain - 1) / grain) + 1;
+        pieces = std::make_unique<Piece[]>(capacity);
+        remaining = rest;
+
+        size_t root = addPiece(probed, nbItems);
+        pieces[root].claimed = true;
+        process(root);
+        while (remaining.load(std::memory_order_acquire) > 0) {
+            if (!helpOnce()) {
+                waitForChange();
+            }
+        }
+
+        mutex.lock();
+        std::exception_ptr failure = error;
+        mutex.unlock();
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+
+        // Combine the partial results in the order of their ranges
+        std::vector<Piece*> done;
+        for (size_t i = 0; i < std::min(nbPieces.load(), capacity); ++i) {
+            done.push_back(&pieces[i]);
+        }
+        std::sort(done.begin(), done.end(), [](Piece* a, Piece* b) { return a->begin < b->begin; });
+        Result result = std::move(*head);
+        for (Piece* piece : done) {
+            result = combine(std::move(result), std::move(*piece->partial));
+        }
+        return result;
+    }
+
+    /**
+     * @brief Publishes a new piece.
+     * @param begin First item
+     * @param end Past the last item
+     * @return The index of the piece, capacity if there is no room left.
+     */
+    size_t addPiece(size_t begin, size_t end) {
+        size_t index = nbPieces.fetch_add(1);
+        if (index >= capacity) {
+            return capacity;
+        }
+        pieces[index].begin = begin;
+        pieces[index].end = end;
+        pieces[index].ready = true;
+        return index;
+    }
+
+    /**
+     * @brief Publishes the range [begin, end) as a new piece, and offers a helper to the pool.
+     * @param begin First item
+     * @param end Past the last item
+     * @return True if the piece was published, false if the range stays with the caller.
+     */
+    bool spawn(size_t begin, size_t end) {
+        if (addPiece(begin, end) == capacity) {
+            return false;
+        }
+        // A refused helper is destroyed, which releases its place: the threads already on the
+        // loop claim the piece
+        if (nbHelpers.fetch_add(1) < maxHelpers) {
+            pool.trySubmit(std::make_unique<HelperTask>(this->shared_from_this()));
+        } else {
+            nbHelpers.fetch_sub(1);
+        }
+        if (callerWaiting) {
+            // Pairs with waitForChange(): either the caller sees the piece or we see it waiting
+            wakeCaller();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Called once by each helper that stops working on the loop.
+     */
+    void leaveHelper() {
+        nbHelpers.fetch_sub(1);
+    }
+
+    /**
+     * @brief Processes a claimed piece: splits it down to the grain, then runs what is left.
+     * @param index The piece
+     */
+    void process(size_t index) {
+        Piece& piece = pieces[index];
+        size_t begin = piece.begin;
+        size_t end = piece.end;
+        while (end - begin > grain && !failed && spawn(begin + (end - begin) / 2, end)) {
+            end = begin + (end - begin) / 2;
+        }
+        piece.end = end;
+
+        if (!failed) {
+            try {
+                piece.partial = chunk(begin, end);
+            } catch (...) {
+                fail(std::current_exception());
+            }
+        }
+        if (remaining.fetch_sub(end - begin, std::memory_order_acq_rel) == end - begin) {
+            wakeCaller();
+        }
+    }
+
+    /**
+     * @brief Claims and processes one piece no thread took yet, on the calling thread.
+     * @return True if a piece was processed, false if every piece is claimed.
+     */
+    bool helpOnce() {
+        size_t count = std::min(nbPieces.load(), capacity);
+        bool allClaimed = true;
+        for (size_t i = firstUnclaimed.load(std::memory_order_relaxed); i < count; ++i) {
+            if (!pieces[i].ready) {
+                allClaimed = false;
+            } else if (!pieces[i].claimed && !pieces[i].claimed.exchange(true)) {
+                if (allClaimed) {
+                    firstUnclaimed.store(i + 1, std::memory_order_relaxed);
+                }
+                process(i);
+                return true;
+            } else if (allClaimed) {
+                firstUnclaimed.store(i + 1, std::memory_order_relaxed);
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Checks if a published piece is not claimed yet.
+     * @return True if the caller has work to do.
+     */
+    bool hasUnclaimed() const {
+        size_t count = std::min(nbPieces.load(), capacity);
+        for (size_t i = firstUnclaimed.load(std::memory_order_relaxed); i < count; ++i) {
+            if (pieces[i].ready && !pieces[i].claimed) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Blocks the calling thread until the loop is over or a piece becomes available.
+     */
+    void waitForChange() {
+        mutex.lock();
+        callerWaiting = true;
+        while (remaining.load(std::memory_order_acquire) > 0 && !hasUnclaimed()) {
+            cond.wait(&mutex);
+        }
+        callerWaiting = false;
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Wakes up the calling thread if it sleeps in waitForChange().
+     */
+    void wakeCaller() {
+        mutex.lock();
+        cond.notifyAll();
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Records the exception of a chunk, the chunks not started yet are skipped.
+     * @param exception The exception to rethrow from run()
+     */
+    void fail(std::exception_ptr exception) {
+        mutex.lock();
+        if (!error) {
+            error = std::move(exception);
+        }
+        mutex.unlock();
+        failed = true;
+    }
+
+    ThreadPool& pool;                       // Pool running the loop
+    const size_t nbItems;                   // Number of items of the loop
+    Chunk chunk;                            // Processes a range of items
+    Combine combine;                        // Merges two partial results
+    size_t grain = 1;                       // Items below which a piece is not split, set before the first piece
+    size_t capacity = 0;                    // Size of pieces
+    std::unique_ptr<Piece[]> pieces;        // Pieces, in creation order
+    std::atomic<size_t> nbPieces{0};        // Pieces created, may exceed capacity
+    std::atomic<size_t> firstUnclaimed{0};  // Hint: the pieces before it are all claimed
+    size_t maxHelpers = 0;                  // Helpers offered to the pool at most at once
+    std::atomic<size_t> nbHelpers{0};       // Helpers queued or running
+    std::atomic<size_t> remaining{0};       // Items after the probe not processed yet
+    std::atomic<bool> failed{false};        // Set once a chunk threw
+    std::atomic<bool> callerWaiting{false}; // Set while the calling thread sleeps in waitForChange()
+    PcoMutex mutex;                         // Protects error, used to wait for the pieces
+    PcoConditionVariable cond;              // Signaled when a piece is added or the loop ends
+    std::exception_ptr error;               // First exception thrown by a chunk
+};
+
+/**
+ * @brief Calls body(i) for every i in [begin, end), on the pool and on the calling thread.
+ * Returns once every call returned. The order of the calls is unspecified.
+ * @param pool The pool running the loop
+ * @param begin First index
+ * @param end Past the last index
+ * @param body Called with each index, from several threads at the same time
+ * @param grain Indices per chunk, 0 to derive it from the measured cost of body
+ * @throws The first exception thrown by body, the chunks not started yet are skipped.
+ */
+template<typename Index, typename Body>
+void parallelFor(ThreadPool& pool, Index begin, Index end, Body&& body, size_t grain = 0) {
+    static_assert(std::is_integral_v<Index>, "parallelFor() iterates over integers");
+    if (!(begin < end)) {
+        return;
+    }
+    ParallelLoop<std::monostate>::run(
+        pool, static_cast<size_t>(end - begin),
+        [&body, begin](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                body(static_cast<Index>(begin + static_cast<Index>(i)));
+            }
+            return std::monostate();
+        },
+        [](std::monostate, std::monostate) { return std::monostate(); }, grain);
+}
+
+/**
+ * @brief Folds every index of [begin, end) into a value, on the pool and on the calling thread.
+ * Every chunk starts from init and folds its indices with op, the results of the chunks are
+ * then merged with combine in the order of the indices. The result is the one of a sequential
+ * fold as long as init is an identity of combine and combine is associative.
+ * @param pool The pool running the loop
+ * @param begin First index
+ * @param end Past the last index
+ * @param init Identity of combine, the starting value of every chunk
+ * @param op Folds an index into a partial result: op(T partial, Index i) -> T
+ * @param combine Merges two adjacent partial results: combine(T left, T right) -> T
+ * @param grain Indices per chunk, 0 to derive it from the measured cost of op
+ * @return The folded value, init if the range is empty.
+ * @throws The first exception thrown by op or combine.
+ */
+template<typename Index, typename T, typename Op, typename Combine>
+T parallelReduce(ThreadPool& pool, Index begin, Index end, T init, Op op, Combine combine, size_t grain = 0) {
+    static_assert(std::is_integral_v<Index>, "parallelReduce() iterates over integers");
+    if (!(begin < end)) {
+        return init;
+    }
+    return ParallelLoop<T>::run(
+        pool, static_cast<size_t>(end - begin),
+        [&op, &init, begin](size_t first, size_t last) {
+            T partial = init;
+            for (size_t i = first; i < last; ++i) {
+                partial = op(std::move(partial), static_cast<Index>(begin + static_cast<Index>(i)));
+            }
+            return partial;
+        },
+        [&combine](T left, T right) { return combine(std::move(left), std::move(right)); }, grain);
+}
+
+#endif // PARALLELLOOP_H
@@ -0,0 +1,381 @@
+/**
+ * @file poollog.h
+ * @brief Header file defining poolLog() and AsyncLogSink, the asynchronous logger of the pool's diagnostics.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef POOLLOG_H
+#define POOLLOG_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <pcosynchro/pcologger.h>
+#include <pcosynchro/pcothread.h>
+
+/**
+ * @brief Severity of a log record.
+ */
+enum class LogLevel : uint8_t {
+    Debug,      // Details of the pool's internals
+    Info,       // Noteworthy events
+    Warning,    // Unexpected events the pool recovers from
+    Error,      // Failures, such as a task throwing from run()
+    Off         // Used as THREADPOOL_LOG_LEVEL to compile every record out
+};
+
+// Lowest level compiled in, as the integer value of a LogLevel: records below it cost nothing
+#ifndef THREADPOOL_LOG_LEVEL
+#define THREADPOOL_LOG_LEVEL 1
+#endif
+
+constexpr LogLevel MinLogLevel = static_cast<LogLevel>(THREADPOOL_LOG_LEVEL);
+
+/**
+ * @brief Fixed-size log record, formatted in place by the logging thread.
+ * Text longer than MaxText is truncated.
+ */
+struct LogRecord {
+    static constexpr size_t MaxText = 125; // Room left for the text in a 128 bytes record
+
+    uint16_t length = 0;            // Number of characters of text
+    LogLevel level = LogLevel::Info; // Severity of the record
+    char text[MaxText];             // The message, not null-terminated
+
+    /**
+     * @brief Appends a string, truncated to the room left.
+     * @param value The string
+     */
+    void append(std::string_view value) {
+        size_t count = std::min(value.size(), MaxText - length);
+        std::memcpy(text + length, value.data(), count);
+        length = static_cast<uint16_t>(length + count);
+    }
+
+    void append(const char* value) {
+        append(std::string_view(value ? value : "(null)"));
+    }
+
+    void append(const std::string& value) {
+        append(std::string_view(value));
+    }
+
+    void append(char value) {
+        append(std::string_view(&value, 1));
+    }
+
+    void append(bool value) {
+        append(std::string_view(value ? "true" : "false"));
+    }
+
+    /**
+     * @brief Appends a number, without going through a stream.
+     * @param value The number
+     */
+    template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+    void append(T value) {
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        append(std::string_view(buffer, static_cast<size_t>(result.ptr - buffer)));
+    }
+};
+
+/**
+ * @brief Ring of log records with a single producer, the thread owning it, and a single consumer.
+ */
+class LogRing {
+public:
+    static constexpr size_t Capacity = 256; // Records buffered per thread, 32 KiB
+
+    /**
+     * @brief Returns the next free record, to be filled then published with commit().
+     * Producer side.
+     * @return The record, null if the ring is full.
+     */
+    LogRecord* reserve() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == Capacity) {
+            return nullptr;
+        }
+        LogRecord* record = &records[h % Capacity];
+        record->length = 0;
+        return record;
+    }
+
+    /**
+     * @brief Publishes the record returned by the last reserve(). Producer side.
+     */
+    void commit() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Hands the published records to a function, oldest first. Consumer side.
+     * @param f Called with each record, whose slot is freed once it returns
+     * @return The number of records handed over.
+     */
+    template<typename F>
+    size_t drain(F&& f) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        for (size_t i = t; i != h; ++i) {
+            f(records[i % Capacity]);
+            tail.store(i + 1, std::memory_order_release);
+        }
+        return h - t;
+    }
+
+    /**
+     * @brief Checks if every published record was drained. Consumer side.
+     * @return True if the ring is empty.
+     */
+    bool empty() const {
+        return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+    std::atomic<bool> orphaned{false}; // Set when the owning thread exits, the ring is dropped once drained
+
+private:
+    std::array<LogRecord, Capacity> records;     // The buffered records
+    alignas(64) std::atomic<size_t> head{0};     // Next record to write, written by the owning thread
+    alignas(64) std::atomic<size_t> tail{0};     // Next record to read, written by the consumer
+};
+
+/**
+ * @brief Process-wide sink of the pool's diagnostics.
+ * Each logging thread formats its records in a ring of its own, without any lock or system
+ * call, and never blocks: when its ring is full, the record is dropped and counted. A
+ * background writer drains the rings and hands the records to the output, pcosynchro's
+ * logger() by default. Records of one thread keep their order; records of different threads
+ * are not ordered.
+ */
+class AsyncLogSink {
+public:
+    using Output = std::function<void(LogLevel, std::string_view)>;
+
+    static constexpr std::chrono::milliseconds WriterPeriod{10}; // Longest sleep of the writer with records pending
+
+    /**
+     * @brief Returns the sink, starting its writer on the first call.
+     * @return The sink of the process.
+     */
+    static AsyncLogSink& instance() {
+        static AsyncLogSink sink;
+        return sink;
+    }
+
+    AsyncLogSink(const AsyncLogSink&) = delete;
+    AsyncLogSink& operator=(const AsyncLogSink&) = delete;
+
+    /**
+     * @brief Destructor
+     * Stops the writer once every pending record is written.
+     */
+    ~AsyncLogSink() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stop = true;
+        }
+        wakeCond.notify_one();
+        writer->join();
+    }
+
+    /**
+     * @brief Formats a record in the ring of the calling thread.
+     * @param level Severity of the record
+     * @param args Pieces of the message: strings, characters, booleans and numbers
+     */
+    template<typename... Args>
+    void log(LogLevel level, const Args&... args) {
+        LogRing& ring = localRing();
+        LogRecord* record = ring.reserve();
+        if (!record) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        record->level = level;
+        (record->append(args), ...);
+        ring.commit();
+
+        // A sleeping writer is woken once, the next records find it awake
+        if (writerSleeping.load(std::memory_order_relaxed) && writerSleeping.exchange(false)) {
+            wakeCond.notify_one();
+        }
+    }
+
+    /**
+     * @brief Writes the records pending when it is called, on the calling thread.
+     */
+    void flush() {
+        drainAll();
+    }
+
+    /**
+     * @brief Replaces the output of the records.
+     * @param newOutput Called by a single thread at a time with each record, empty for logger()
+     */
+    void setOutput(Output newOutput) {
+        std::lock_guard<std::mutex> lock(drainMutex);
+        output = newOutput ? std::move(newOutput) : Output(&writeToLogger);
+    }
+
+    /**
+     * @brief Returns the number of records dropped because the ring of their thread was full.
+     * @return The number of lost records since the start of the process.
+     */
+    uint64_t droppedCount() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the tag of a level, as written in front of the records.
+     * @param level The level
+     * @return Its upper-case name.
+     */
+    static const char* levelName(LogLevel level) {
+        switch (level) {
+        case LogLevel::Debug: return "DEBUG";
+        case LogLevel::Info: return "INFO";
+        case LogLevel::Warning: return "WARNING";
+        case LogLevel::Error: return "ERROR";
+        default: return "OFF";
+        }
+    }
+
+private:
+    /**
+     * @brief Ring of a thread, registered with the sink on the thread's first record.
+     */
+    struct RingHandle {
+        explicit RingHandle(AsyncLogSink& sink) : ring(std::make_shared<LogRing>()) {
+            std::lock_guard<std::mutex> lock(sink.ringsMutex);
+            sink.rings.push_back(ring);
+        }
+
+        ~RingHandle() {
+            ring->orphaned.store(true, std::memory_order_release);
+        }
+
+        std::shared_ptr<LogRing> ring; // Shared with the sink, which drops it once orphaned and drained
+    };
+
+    AsyncLogSink() : output(&writeToLogger) {
+        // Constructed first, logger() is destroyed after the sink's last records
+        logger();
+        writer = std::make_unique<PcoThread>([this]() { writerLoop(); });
+    }
+
+    /**
+     * @brief Returns the ring of the calling thread, created on its first record.
+     * @return The ring.
+     */
+    LogRing& localRing() {
+        thread_local RingHandle handle(*this);
+        return *handle.ring;
+    }
+
+    /**
+     * @brief Default output, through pcosynchro's logger().
+     * @param level Severity of the record
+     * @param text The message
+     */
+    static void writeToLogger(LogLevel level, std::string_view text) {
+        logger() << "[" << levelName(level) << "] " << std::string(text) << "\n";
+    }
+
+    /**
+     * @brief Writes the pending records of every ring, and drops the drained rings of exited threads.
+     * @return The number of records written.
+     */
+    size_t drainAll() {
+        std::lock_guard<std::mutex> drainLock(drainMutex);
+        std::vector<std::shared_ptr<LogRing>> current;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            current = rings;
+        }
+
+        size_t count = 0;
+        bool hasOrphans = false;
+        for (auto &ring : current) {
+            count += ring->drain([this](const LogRecord& record) {
+                output(record.level, std::string_view(record.text, record.length));
+            });
+            hasOrphans = hasOrphans || ring->orphaned.load(std::memory_order_acquire);
+        }
+
+        if (hasOrphans) {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (size_t i = 0; i < rings.size();) {
+                // Records published before the flag was set are written on the next pass
+                if (rings[i]->orphaned.load(std::memory_order_acquire) && rings[i]->empty()) {
+                    rings[i] = std::move(rings.back());
+                    rings.pop_back();
+                } else {
+                    ++i;
+                }
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Body of the writer: drains the rings, sleeping up to WriterPeriod while they are empty.
+     */
+    void writerLoop() {
+        while (true) {
+            if (drainAll() > 0) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            if (stop) {
+                break;
+            }
+            writerSleeping = true;
+            wakeCond.wait_for(lock, WriterPeriod);
+            writerSleeping = false;
+        }
+        drainAll();
+    }
+
+    std::mutex ringsMutex;                      // Protects rings
+    std::vector<std::shared_ptr<LogRing>> rings; // Rings of the threads that logged, alive or orphaned
+    std::mutex drainMutex;                      // Makes the drainer the single consumer of the rings, protects output
+    Output output;                              // Destination of the records
+    std::atomic<uint64_t> dropped{0};           // Records lost to a full ring
+    std::mutex wakeMutex;                       // Protects stop, used for the writer's timed sleep
+    std::condition_variable wakeCond;           // Wakes the writer up
+    bool stop = false;                          // Set by the destructor to end the writer
+    std::atomic<bool> writerSleeping{false};    // Set while the writer sleeps, cleared by the producer that wakes it
+    std::unique_ptr<PcoThread> writer;          // Background writer
+};
+
+/**
+ * @brief Logs a diagnostic of the pool through the AsyncLogSink.
+ * Records below THREADPOOL_LOG_LEVEL are removed at compile time.
+ * @tparam Level Severity of the record
+ * @param args Pieces of the message: strings, characters, booleans and numbers
+ */
+template<LogLevel Level, typename... Args>
+inline void poolLog(const Args&... args) {
+    if constexpr (Level >= MinLogLevel && Level != LogLevel::Off) {
+        AsyncLogSink::instance().log(Level, args...);
+    }
+}
+
+#endif // POOLLOG_H
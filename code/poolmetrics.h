@@ -0,0 +1,187 @@
+/**
+ * @file poolmetrics.h
+ * @brief Header file defining the metrics collected by the ThreadPool and the snapshot returned to the user.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef POOLMETRICS_H
+#define POOLMETRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "taskslab.h"
+
+/**
+ * @brief A task in one of the pool's queues, with its number and the time it was queued at.
+ * The time is only taken while the metrics or the elastic sizing are enabled, it is left at
+ * its epoch otherwise.
+ */
+struct QueuedTask {
+    TaskPtr task;                                       // The task itself
+    std::chrono::steady_clock::time_point enqueuedAt;   // Time the task was queued at
+    uint64_t id = 0;                                    // Number given by the pool at submission, never 0
+};
+
+/**
+ * @brief Copy of a LatencyHistogram, with helpers to read it.
+ * Bucket 0 counts the zero durations, bucket i > 0 the durations in [2^(i-1), 2^i) nanoseconds.
+ */
+struct HistogramSnapshot {
+    static constexpr size_t NbBuckets = 64; // One bucket per power of two of nanoseconds
+
+    std::array<uint64_t, NbBuckets> buckets{}; // Number of samples in each bucket
+    uint64_t count = 0;                         // Total number of samples
+    uint64_t sumNs = 0;                         // Sum of the samples, in nanoseconds
+
+    /**
+     * @brief Returns the average of the samples.
+     * @return The mean duration, zero without samples.
+     */
+    std::chrono::nanoseconds mean() const {
+        return std::chrono::nanoseconds(count ? sumNs / count : 0);
+    }
+
+    /**
+     * @brief Returns an upper bound of a percentile, precise to a factor of two.
+     * @param fraction The percentile, between 0 and 1 (0.99 for the 99th percentile)
+     * @return The upper bound of the bucket holding the percentile, zero without samples.
+     */
+    std::chrono::nanoseconds percentile(double fraction) const {
+        if (count == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+        auto rank = static_cast<uint64_t>(fraction * static_cast<double>(count - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < NbBuckets; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::chrono::nanoseconds(i == 0 ? 0 : (i >= 63 ? INT64_MAX : (int64_t{1} << i) - 1));
+            }
+        }
+        return std::chrono::nanoseconds(INT64_MAX);
+    }
+
+    /**
+     * @brief Adds the samples of another snapshot.
+     * @param other The snapshot to merge
+     */
+    void merge(const HistogramSnapshot& other) {
+        for (size_t i = 0; i < NbBuckets; ++i) {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+        sumNs += other.sumNs;
+    }
+};
+
+/**
+ * @brief Lock-free histogram of durations with power of two buckets.
+ * Recording is a couple of relaxed atomic increments, meant to be done by a single thread
+ * (the owner of the shard) so that the cache line is not shared.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram() {
+        for (auto &bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Records one duration.
+     * @param duration The duration, negative values count as zero
+     */
+    void record(std::chrono::steady_clock::duration duration) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        auto value = static_cast<uint64_t>(ns > 0 ? ns : 0);
+        buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sumNs.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Adds the recorded samples to a snapshot.
+     * @param snapshot The snapshot to fill
+     */
+    void addTo(HistogramSnapshot& snapshot) const {
+        HistogramSnapshot copy;
+        for (size_t i = 0; i < HistogramSnapshot::NbBuckets; ++i) {
+            copy.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        }
+        copy.count = count.load(std::memory_order_relaxed);
+        copy.sumNs = sumNs.load(std::memory_order_relaxed);
+        snapshot.merge(copy);
+    }
+
+private:
+    /**
+     * @brief Returns the bucket of a duration: the number of significant bits of its value.
+     * @param ns The duration in nanoseconds
+     * @return The index of the bucket.
+     */
+    static size_t bucketOf(uint64_t ns) {
+        return ns == 0 ? 0 : 64 - static_cast<size_t>(__builtin_clzll(ns));
+    }
+
+    std::array<std::atomic<uint64_t>, HistogramSnapshot::NbBuckets> buckets; // Samples per bucket
+    std::atomic<uint64_t> count{0};     // Number of samples
+    std::atomic<uint64_t> sumNs{0};     // Sum of the samples, in nanoseconds
+};
+
+/**
+ * @brief Counters and histograms of one thread slot of the pool.
+ * Each worker slot writes to its own shard, the threads outside the pool share the last one.
+ */
+struct alignas(64) MetricsShard {
+    std::atomic<uint64_t> tasksSubmitted{0};  // Tasks accepted by start(), submit() and co.
+    std::atomic<uint64_t> tasksRejected{0};   // Tasks the pool called cancelRun() on for lack of room
+    std::atomic<uint64_t> tasksCancelled{0};  // Queued tasks the pool called cancelRun() on at shutdown
+    std::atomic<uint64_t> tasksRun{0};        // Tasks whose run() returned or threw
+    std::atomic<uint64_t> tasksFailed{0};     // Tasks whose run() threw
+    std::atomic<uint64_t> spinSuccesses{0};   // Idle waits in which spinning found work
+    std::atomic<uint64_t> spinFailures{0};    // Idle waits that spun for nothing and went on to park
+    std::atomic<uint64_t> tasksRejectedNew{0};   // Overflows of OverflowPolicy::RejectNew
+    std::atomic<uint64_t> tasksDroppedOldest{0}; // Overflows of OverflowPolicy::DropOldest
+    std::atomic<uint64_t> tasksRunByCaller{0};   // Overflows of OverflowPolicy::CallerRuns
+    std::atomic<uint64_t> tasksTimedOut{0};      // Overflows of OverflowPolicy::BlockWithTimeout that found no slot in time
+    std::atomic<uint64_t> sizingWaitNs{0};    // Queue latency summed for the elastic sizing, reset by each sample
+    std::atomic<uint64_t> sizingTasks{0};     // Tasks counted in sizingWaitNs
+    std::atomic<uint64_t> nextTaskId{0};      // Task numbers handed out by the threads of the shard
+    LatencyHistogram waitTime;                // Time between queuing and the start of run()
+    LatencyHistogram runTime;                 // Duration of run()
+    LatencyHistogram monitorWait;             // Time spent entering the pool's monitor
+};
+
+/**
+ * @brief Metrics of a ThreadPool, as returned by ThreadPool::snapshot().
+ * Counters only cover the periods during which the metrics were enabled, except the gauges.
+ */
+struct PoolMetrics {
+    uint64_t tasksSubmitted = 0;    // Tasks accepted by the pool
+    uint64_t tasksRejected = 0;     // Tasks cancelled through cancelRun() because there was no room
+    uint64_t tasksCancelled = 0;    // Queued tasks cancelled through cancelRun() by a shutdown
+    uint64_t tasksRun = 0;          // Tasks run to completion (or to an exception)
+    uint64_t tasksFailed = 0;       // Tasks whose run() threw an exception
+    uint64_t spinSuccesses = 0;     // Idle waits in which spinning found work (see IdleStrategy)
+    uint64_t spinFailures = 0;      // Idle waits that spun for nothing before parking
+    uint64_t tasksRejectedNew = 0;  // Submitted tasks cancelled by OverflowPolicy::RejectNew
+    uint64_t tasksDroppedOldest = 0; // Queued tasks cancelled by OverflowPolicy::DropOldest
+    uint64_t tasksRunByCaller = 0;  // Tasks run inline by their producer with OverflowPolicy::CallerRuns
+    uint64_t tasksTimedOut = 0;     // Tasks cancelled by OverflowPolicy::BlockWithTimeout after waiting in vain
+    uint64_t threadsCreated = 0;    // Worker threads created
+    uint64_t threadsExpired = 0;    // Worker threads terminated by idleTimeout
+    size_t queueDepth = 0;          // Tasks waiting in the shared queue and the local deques (gauge)
+    size_t nbThreads = 0;           // Live worker threads (gauge)
+    size_t nbIdleThreads = 0;       // Parked worker threads (gauge)
+    HistogramSnapshot waitTime;     // Queue latency: from submission to the start of run()
+    HistogramSnapshot runTime;      // Service time: duration of run()
+    HistogramSnapshot monitorWait;  // Monitor contention: time spent in monitorIn()
+};
+
+#endif // POOLMETRICS_H
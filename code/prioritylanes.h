@@ -0,0 +1,365 @@
+/**
+ * @file prioritylanes.h
+ * @brief Header file defining the priority levels of the tasks and the per-priority queues of the ThreadPool.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef PRIORITYLANES_H
+#define PRIORITYLANES_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+
+#include "mpmcqueue.h"
+
+/**
+ * @brief Priority of a task in the waiting queue.
+ */
+enum class TaskPriority {
+    Low,     // Batch work, served when nothing more urgent waits (or through aging)
+    Normal,  // Default priority
+    High     // Interactive work, served first
+};
+
+/**
+ * @brief How maxNbWaiting bounds the waiting queue.
+ */
+enum class WaitingLimit {
+    Global,  // maxNbWaiting tasks in total, whatever their priority
+    PerLane  // maxNbWaiting tasks for each priority
+};
+
+/**
+ * @brief Common constants of the priority lanes.
+ */
+struct Lanes {
+    static constexpr size_t Count = 3;           // Number of priorities
+    static constexpr unsigned AgingThreshold = 8; // Pops a waiting lane can be skipped before it is served
+
+    /**
+     * @brief Returns the lane of a priority.
+     * @param priority The priority
+     * @return The index of its lane, 0 being the lowest priority.
+     */
+    static size_t of(TaskPriority priority) {
+        return static_cast<size_t>(priority);
+    }
+};
+
+/**
+ * @brief Waiting queue made of one FIFO lane per priority, not thread safe (used under the pool's monitor).
+ * The highest non-empty lane is found in O(1) through a bitmask of non-empty lanes. To avoid
+ * starvation, a non-empty lane skipped AgingThreshold times in a row is served next.
+ * Only sizeApprox() may be called without holding the monitor.
+ * @tparam T Type of the stored elements, must be movable
+ */
+template<typename T>
+class PriorityLanes {
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Maximum number of waiting elements, in total or per lane
+     * @param limit Whether capacity applies to all the lanes or to each one
+     */
+    PriorityLanes(size_t capacity, WaitingLimit limit) : capacity(capacity), limit(limit) {}
+
+    /**
+     * @brief Appends an element to the lane of its priority.
+     * @param value The element
+     * @param priority Its priority
+     */
+    void push(T value, TaskPriority priority) {
+        size_t lane = Lanes::of(priority);
+        lanes[lane].push_back(std::move(value));
+        nonEmpty |= 1u << lane;
+        setCount(size() + 1);
+    }
+
+    /**
+     * @brief Removes the next element to serve: the oldest of the highest non-empty lane,
+     * unless a lower lane has been starving for AgingThreshold pops.
+     * The queue must not be empty.
+     * @return The element.
+     */
+    T pop() {
+        size_t served = HighestLane[nonEmpty];
+        for (size_t lane = 0; lane < served; ++lane) {
+            if ((nonEmpty & (1u << lane)) && skipped[lane] >= Lanes::AgingThreshold) {
+                served = lane;
+                break;
+            }
+        }
+        for (size_t lane = 0; lane < Lanes::Count; ++lane) {
+            if (lane == served) {
+                skipped[lane] = 0;
+            } else if (nonEmpty & (1u << lane)) {
+                ++skipped[lane];
+            }
+        }
+        return take(served);
+    }
+
+    /**
+     * @brief Removes the element to reject when the queue overflows.
+     * With WaitingLimit::PerLane it is the oldest element of the given lane, otherwise the
+     * oldest element of the lowest non-empty lane. The queue must not be empty.
+     * @param priority Priority of the element that overflowed the queue
+     * @return The element.
+     */
+    T popOverflow(TaskPriority priority) {
+        if (limit == WaitingLimit::PerLane) {
+            return take(Lanes::of(priority));
+        }
+        return take(LowestLane[nonEmpty]);
+    }
+
+    /**
+     * @brief Removes the most recently pushed element of a lane, used to reject it on overflow.
+     * The lane must not be empty.
+     * @param priority Priority of the element
+     * @return The element.
+     */
+    T popNewest(TaskPriority priority) {
+        size_t lane = Lanes::of(priority);
+        T value = std::move(lanes[lane].back());
+        lanes[lane].pop_back();
+        if (lanes[lane].empty()) {
+            nonEmpty &= ~(1u << lane);
+        }
+        setCount(size() - 1);
+        return value;
+    }
+
+    /**
+     * @brief Checks if an element of the given priority can be queued without overflow.
+     * @param priority Priority of the element
+     * @return True if there is room for it, false otherwise.
+     */
+    bool hasRoom(TaskPriority priority) const {
+        return limitedSize(priority) < capacity;
+    }
+
+    /**
+     * @brief Returns the number of elements counted against the limit of a priority.
+     * @param priority The priority
+     * @return The size of its lane with WaitingLimit::PerLane, the total size otherwise.
+     */
+    size_t limitedSize(TaskPriority priority) const {
+        return limit == WaitingLimit::PerLane ? lanes[Lanes::of(priority)].size() : size();
+    }
+
+    /**
+     * @brief Returns the number of free slots for an element of the given priority.
+     * @param priority The priority
+     * @return The number of elements of that priority that can still be queued.
+     */
+    size_t freeSlots(TaskPriority priority) const {
+        size_t used = limitedSize(priority);
+        return capacity > used ? capacity - used : 0;
+    }
+
+    /**
+     * @brief Checks if every lane is empty.
+     * @return True if no element is queued, false otherwise.
+     */
+    bool empty() const {
+        return size() == 0;
+    }
+
+    /**
+     * @brief Returns the number of queued elements.
+     * @return The total size of the lanes.
+     */
+    size_t size() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the number of queued elements without holding the monitor.
+     * Used by spinning threads as a hint, the value may already be stale.
+     * @return The total size of the lanes, as last written under the monitor.
+     */
+    size_t sizeApprox() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Removes every element.
+     */
+    void clear() {
+        for (auto &lane : lanes) {
+            lane.clear();
+        }
+        skipped.fill(0);
+        nonEmpty = 0;
+        setCount(0);
+    }
+
+private:
+    static_assert(Lanes::Count == 3, "The lookup tables below are written for three lanes");
+
+    // Highest and lowest set bit of each value of nonEmpty
+    static constexpr size_t HighestLane[8] = {0, 0, 1, 1, 2, 2, 2, 2};
+    static constexpr size_t LowestLane[8] = {0, 0, 1, 0, 2, 0, 1, 0};
+
+    /**
+     * @brief Pops the oldest element of a non-empty lane.
+     * @param lane Index of the lane
+     * @return The element.
+     */
+    T take(size_t lane) {
+        T value = std::move(lanes[lane].front());
+        lanes[lane].pop_front();
+        if (lanes[lane].empty()) {
+            nonEmpty &= ~(1u << lane);
+        }
+        setCount(size() - 1);
+        return value;
+    }
+
+    /**
+     * @brief Updates the number of elements, only written by the holder of the monitor.
+     * @param value The new number of elements
+     */
+    void setCount(size_t value) {
+        count.store(value, std::memory_order_relaxed);
+    }
+
+    const size_t capacity;                          // Maximum number of elements, in total or per lane
+    const WaitingLimit limit;                       // Whether capacity is global or per lane
+    std::array<std::deque<T>, Lanes::Count> lanes;  // One FIFO per priority, 0 being the lowest
+    std::array<unsigned, Lanes::Count> skipped{};   // Pops each waiting lane was skipped for
+    unsigned nonEmpty = 0;                          // Bit i set when lanes[i] is not empty
+    std::atomic<size_t> count{0};                   // Total number of elements, read by sizeApprox() without the monitor
+};
+
+/**
+ * @brief Lock-free waiting queue made of one MpmcQueue per priority.
+ * Consumers serve the highest non-empty lane, with the same aging as PriorityLanes. The skip
+ * counters are only approximate under contention, which is enough to bound starvation.
+ * With WaitingLimit::Global, an atomic counter reserves a slot before each push.
+ * @tparam T Type of the stored elements, must be default constructible and movable
+ */
+template<typename T>
+class LockFreeLanes {
+public:
+    /**
+     * @brief Constructor
+     * @param capacity Maximum number of waiting elements, in total or per lane (at least 1)
+     * @param limit Whether capacity applies to all the lanes or to each one
+     */
+    LockFreeLanes(size_t capacity, WaitingLimit limit) : capacity(capacity), limit(limit), count(0) {
+        for (auto &lane : lanes) {
+            lane = std::make_unique<MpmcQueue<T>>(capacity);
+        }
+        for (auto &counter : skipped) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Tries to append an element to the lane of its priority.
+     * @param value The element, only moved from if the push succeeds
+     * @param priority Its priority
+     * @return True if the element was queued, false if there is no room for it.
+     */
+    bool tryPush(T& value, TaskPriority priority) {
+        if (limit == WaitingLimit::Global) {
+            if (count.fetch_add(1) >= capacity) {
+                --count;
+                return false;
+            }
+            // A consumer may still be freeing the cell of this position: count is lowered when
+            // a pop ends, not in position order. The slot is given back and the ring is full.
+            if (!lanes[Lanes::of(priority)]->tryPush(value)) {
+                --count;
+                return false;
+            }
+            return true;
+        }
+        return lanes[Lanes::of(priority)]->tryPush(value);
+    }
+
+    /**
+     * @brief Tries to remove the next element to serve.
+     * @param value Receives the element if the pop succeeds
+     * @return True if an element was removed, false if every lane is empty.
+     */
+    bool tryPop(T& value) {
+        // A starving lane is served first
+        for (size_t lane = 0; lane < Lanes::Count; ++lane) {
+            if (skipped[lane].load(std::memory_order_relaxed) >= Lanes::AgingThreshold &&
+                popLane(lane, value)) {
+                return true;
+            }
+        }
+        for (size_t lane = Lanes::Count; lane-- > 0;) {
+            if (popLane(lane, value)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Checks if every lane looks empty.
+     * @return True if no element is queued, false otherwise.
+     */
+    bool empty() const {
+        for (const auto &lane : lanes) {
+            if (!lane->empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Returns an approximation of the number of queued elements.
+     * @return The total size of the lanes.
+     */
+    size_t sizeApprox() const {
+        size_t total = 0;
+        for (const auto &lane : lanes) {
+            total += lane->sizeApprox();
+        }
+        return total;
+    }
+
+private:
+    /**
+     * @brief Pops from one lane and updates the aging counters.
+     * @param lane Index of the lane
+     * @param value Receives the element if the pop succeeds
+     * @return True if an element was removed, false if the lane is empty.
+     */
+    bool popLane(size_t lane, T& value) {
+        if (!lanes[lane]->tryPop(value)) {
+            return false;
+        }
+        if (limit == WaitingLimit::Global) {
+            --count;
+        }
+        skipped[lane].store(0, std::memory_order_relaxed);
+        for (size_t other = 0; other < Lanes::Count; ++other) {
+            if (other != lane && !lanes[other]->empty()) {
+                skipped[other].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        return true;
+    }
+
+    const size_t capacity;                                       // Maximum number of elements, in total or per lane
+    const WaitingLimit limit;                                    // Whether capacity is global or per lane
+    std::array<std::unique_ptr<MpmcQueue<T>>, Lanes::Count> lanes; // One ring per priority, 0 being the lowest
+    std::array<std::atomic<unsigned>, Lanes::Count> skipped;     // Pops each waiting lane was skipped for
+    std::atomic<size_t> count;                                   // Reserved slots with WaitingLimit::Global
+};
+
+#endif // PRIORITYLANES_H
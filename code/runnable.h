@@ -0,0 +1,40 @@
+/**
+ * @file runnable.h
+ * @brief Header file defining the Runnable interface, the unit of work executed by the ThreadPool.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef RUNNABLE_H
+#define RUNNABLE_H
+
+#include <string>
+
+/**
+ * @brief Abstract base class representing a runnable task.
+ * Defines the interface for tasks that can be executed by the ThreadPool.
+ */
+class Runnable {
+public:
+    virtual ~Runnable() = default;
+
+    /**
+     * @brief Execute the task.
+     */
+    virtual void run() = 0;
+
+    /**
+     * @brief Cancel the task.
+     * Called when the task cannot be executed (e.g., due to queue overflow).
+     */
+    virtual void cancelRun() = 0;
+
+    /**
+     * @brief Get the unique identifier for the task.
+     * @return A string representing the task ID.
+     */
+    virtual std::string id() = 0;
+};
+
+#endif // RUNNABLE_H
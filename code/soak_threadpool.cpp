@@ -0,0 +1,445 @@
+/**
+ * @file soak_threadpool.cpp
+ * @brief Soak test of the ThreadPool: minutes of bursty producers, tiny CPU-bound tasks, mixed
+ * idle timeouts and repeated shutdowns, failing when throughput, tail latency, memory, thread
+ * count or idle CPU regress past a threshold.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <pcosynchro/pcothread.h>
+
+#include "threadpool.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Duration of the run and thresholds, set from the command line.
+ */
+struct SoakConfig {
+    std::chrono::seconds duration{180};     // --duration=<s>, total time of the rounds
+    unsigned seed = 1;                      // --seed=<n>, seed of the random choices
+    double minThroughput = 5000;            // --min-throughput=<tasks/s>, over the burst phases
+    double minThroughputRatio = 0.5;        // --min-throughput-ratio=<r>, last third of the rounds against the first
+    double maxP99Ms = 100;                  // --max-p99-ms=<ms>, queue latency of all the rounds
+    double maxRssGrowthMb = 32;             // --max-rss-growth-mb=<MiB>, from the end of the first round to the end
+    double maxIdleCpu = 0.05;               // --max-idle-cpu=<fraction of a core>, while the pool has nothing to do
+    int threadSlack = 8;                    // --thread-slack=<n>, threads tolerated above the expected peak
+};
+
+/**
+ * @brief Measurements of a round.
+ */
+struct RoundResult {
+    uint64_t tasksRun = 0;          // Tasks run during the burst phase
+    double burstSeconds = 0;        // Duration of the burst phase
+    double idleCpu = 0;             // CPU time burned per second of the idle phase, in cores
+    HistogramSnapshot waitTime;     // Queue latency of the round
+};
+
+/**
+ * @brief Tiny CPU-bound task, counted once as run, cancelled or dropped without either.
+ */
+class SpinTask : public Runnable {
+public:
+    SpinTask(std::atomic<uint64_t> &runs, std::atomic<uint64_t> &cancels, std::atomic<uint64_t> &drops, unsigned work)
+        : runs(runs), cancels(cancels), drops(drops), work(work) {}
+
+    ~SpinTask() override {
+        if (!finished) {
+            drops.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void run() override {
+        uint32_t x = work;
+        for (unsigned i = 0; i < work; ++i) {
+            x = x * 1664525u + 1013904223u;
+        }
+        sink.store(x, std::memory_order_relaxed);
+        finish(runs);
+    }
+
+    void cancelRun() override {
+        finish(cancels);
+    }
+
+    std::string id() override {
+        return "Spin";
+    }
+
+    static inline std::atomic<uint32_t> sink{0}; // Keeps the loop from being optimized out
+
+private:
+    /**
+     * @brief Counts the outcome of the task, and flags a task finished twice.
+     * @param counter The counter of the outcome
+     */
+    void finish(std::atomic<uint64_t> &counter) {
+        if (finished) {
+            std::cerr << "FAIL: task finished twice\n";
+            std::exit(1);
+        }
+        finished = true;
+        counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> &runs;        // Tasks run
+    std::atomic<uint64_t> &cancels;     // Tasks cancelled through cancelRun()
+    std::atomic<uint64_t> &drops;       // Tasks destroyed without being run nor cancelled
+    unsigned work;                      // Iterations of the loop
+    bool finished = false;              // Set once run or cancelled
+};
+
+/**
+ * @brief Reads a field of /proc/self/status.
+ * @param field Name of the field, with its colon
+ * @return Its value, 0 if it cannot be read.
+ */
+long procStatus(const char* field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    size_t length = std::strlen(field);
+    while (std::getline(status, line)) {
+        if (line.compare(0, length, field) == 0) {
+            return std::atol(line.c_str() + length);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the number of threads of the process.
+ * @return The Threads field of /proc/self/status.
+ */
+long processThreads() {
+    return procStatus("Threads:");
+}
+
+/**
+ * @brief Returns the resident memory of the process.
+ * @return The resident set size, in MiB.
+ */
+double residentMb() {
+    return static_cast<double>(procStatus("VmRSS:")) / 1024.0;
+}
+
+/**
+ * @brief Returns the CPU time burned by every thread of the process.
+ * @return The process CPU time, in seconds.
+ */
+double processCpuSeconds() {
+    timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+/**
+ * @brief Parses one --name=value argument into a field of the config.
+ * @param arg The argument
+ * @param config The config to update
+ * @return False if the argument is unknown.
+ */
+bool parseArgument(const std::string& arg, SoakConfig& config) {
+    auto value = [&arg](const char* name) -> const char* {
+        size_t length = std::strlen(name);
+        return arg.compare(0, length, name) == 0 ? arg.c_str() + length : nullptr;
+    };
+    if (const char* v = value("--duration=")) {
+        config.duration = std::chrono::seconds(std::atol(v));
+    } else if (const char* v = value("--seed=")) {
+        config.seed = static_cast<unsigned>(std::atol(v));
+    } else if (const char* v = value("--min-throughput=")) {
+        config.minThroughput = std::atof(v);
+    } else if (const char* v = value("--min-throughput-ratio=")) {
+        config.minThroughputRatio = std::atof(v);
+    } else if (const char* v = value("--max-p99-ms=")) {
+        config.maxP99Ms = std::atof(v);
+    } else if (const char* v = value("--max-rss-growth-mb=")) {
+        config.maxRssGrowthMb = std::atof(v);
+    } else if (const char* v = value("--max-idle-cpu=")) {
+        config.maxIdleCpu = std::atof(v);
+    } else if (const char* v = value("--thread-slack=")) {
+        config.threadSlack = std::atoi(v);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Samples the thread count of the process in the background.
+ */
+class ThreadSampler {
+public:
+    static constexpr std::chrono::milliseconds Period{50}; // Time between two samples
+
+    ThreadSampler() : thread([this]() {
+        while (!stop) {
+            long now = processThreads();
+            long seen = peak.load();
+            while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+            }
+            PcoThread::usleep(static_cast<uint64_t>(Period.count()) * 1000);
+        }
+    }) {}
+
+    ~ThreadSampler() {
+        stop = true;
+        thread.join();
+    }
+
+    /**
+     * @brief Returns the highest thread count since the last call, and starts a new period.
+     * @return The peak of the period.
+     */
+    long takePeak() {
+        return peak.exchange(processThreads());
+    }
+
+private:
+    std::atomic<bool> stop{false};      // Ends the sampler
+    std::atomic<long> peak{0};          // Highest thread count of the current period
+    PcoThread thread;                   // The sampler, started last
+};
+
+/**
+ * @brief Runs one round: a pool with random settings, bursty producers, an idle phase and a shutdown.
+ * @param rng Source of the random choices
+ * @param round Number of the round, for the report
+ * @param baselineThreads Threads of the process without any pool
+ * @param sampler Sampler of the thread count
+ * @param config Thresholds
+ * @param failures Receives the thresholds crossed
+ * @return The measurements of the round.
+ */
+RoundResult runRound(std::mt19937& rng, int round, long baselineThreads, ThreadSampler& sampler,
+                     const SoakConfig& config, std::vector<std::string>& failures) {
+    auto pick = [&rng](int low, int high) {
+        return std::uniform_int_distribution<int>(low, high)(rng);
+    };
+    static const int idleTimeouts[] = {0, 10, 100, 500};
+    int hardware = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    int maxThreads = pick(2, 2 * hardware + 2);
+    int maxWaiting = pick(16, 1024);
+    int idleMs = idleTimeouts[pick(0, 3)];
+    int minThreads = pick(0, 1);
+    int nbProducers = pick(1, 4);
+    QueueBackend backend = pick(0, 1) == 0 ? QueueBackend::Monitor : QueueBackend::LockFree;
+    bool spinning = pick(0, 1) == 1;
+    bool shutdownUnderLoad = pick(0, 2) == 0;
+    auto burst = std::chrono::milliseconds(pick(500, 2000));
+
+    std::atomic<uint64_t> runs{0};
+    std::atomic<uint64_t> cancels{0};
+    std::atomic<uint64_t> drops{0};
+    std::atomic<uint64_t> created{0};
+    RoundResult result;
+    {
+        ThreadPool pool(maxThreads, maxWaiting, std::chrono::milliseconds{idleMs}, backend,
+                        WaitingLimit::Global, minThreads);
+        pool.enableMetrics();
+        if (spinning) {
+            pool.setIdleStrategy(IdleStrategy{2000, 50, true});
+        }
+
+        // Bursts of tiny tasks of random sizes, through every submission path
+        std::atomic<bool> producing{true};
+        std::vector<std::unique_ptr<PcoThread>> producers;
+        for (int p = 0; p < nbProducers; ++p) {
+            unsigned seed = rng();
+            producers.push_back(std::make_unique<PcoThread>([&, seed]() {
+                std::mt19937 local(seed);
+                auto draw = [&local](int low, int high) {
+                    return std::uniform_int_distribution<int>(low, high)(local);
+                };
+                while (producing) {
+                    int size = draw(1, 500);
+                    int path = draw(0, 2);
+                    std::vector<TaskPtr> batch;
+                    for (int i = 0; i < size && producing; ++i) {
+                        auto task = pool.makeTask<SpinTask>(runs, cancels, drops, static_cast<unsigned>(draw(50, 500)));
+                        created.fetch_add(1, std::memory_order_relaxed);
+                        if (path == 0) {
+                            pool.start(std::move(task));
+                        } else if (path == 1) {
+                            pool.trySubmit(std::move(task));
+                        } else {
+                            batch.push_back(std::move(task));
+                        }
+                    }
+                    if (!batch.empty()) {
+                        pool.startBatch(batch.begin(), batch.end());
+                    }
+                    PcoThread::usleep(static_cast<uint64_t>(draw(0, 3000)));
+                }
+            }));
+        }
+
+        auto begin = Clock::now();
+        PcoThread::usleep(static_cast<uint64_t>(burst.count()) * 1000);
+        if (shutdownUnderLoad) {
+            pool.shutdownNow();
+        }
+        producing = false;
+        for (auto &producer : producers) {
+            producer->join();
+        }
+
+        if (!shutdownUnderLoad) {
+            // Let the queue empty, then measure what the pool burns with nothing to do
+            while (runs + cancels + drops < created) {
+                PcoThread::usleep(1000);
+            }
+            result.burstSeconds = std::chrono::duration<double>(Clock::now() - begin).count();
+            result.tasksRun = runs;
+
+            PcoThread::usleep(20000);
+            auto window = std::chrono::milliseconds(std::clamp(2 * idleMs + 50, 250, 1500));
+            double cpuBefore = processCpuSeconds();
+            auto idleBegin = Clock::now();
+            PcoThread::usleep(static_cast<uint64_t>(window.count()) * 1000);
+            double idleSeconds = std::chrono::duration<double>(Clock::now() - idleBegin).count();
+            result.idleCpu = (processCpuSeconds() - cpuBefore) / idleSeconds;
+            if (result.idleCpu > config.maxIdleCpu) {
+                failures.push_back("round " + std::to_string(round) + ": idle CPU " + std::to_string(result.idleCpu));
+            }
+            if (pool.currentNbThreads() > static_cast<size_t>(minThreads)) {
+                failures.push_back("round " + std::to_string(round) + ": " + std::to_string(pool.currentNbThreads()) +
+                                   " threads left after an idle phase of " + std::to_string(window.count()) + " ms");
+            }
+            pool.shutdown(pick(0, 1) == 1);
+        } else {
+            result.burstSeconds = std::chrono::duration<double>(Clock::now() - begin).count();
+            result.tasksRun = runs;
+        }
+
+        if (!pool.awaitTermination(std::chrono::seconds{10})) {
+            failures.push_back("round " + std::to_string(round) + ": shutdown did not terminate");
+        }
+        result.waitTime = pool.snapshot().waitTime;
+    }
+
+    if (runs + cancels + drops != created) {
+        failures.push_back("round " + std::to_string(round) + ": " + std::to_string(created - runs - cancels - drops) +
+                           " tasks lost");
+    }
+    long peak = sampler.takePeak();
+    long expectedPeak = baselineThreads + maxThreads + nbProducers + config.threadSlack;
+    if (peak > expectedPeak) {
+        failures.push_back("round " + std::to_string(round) + ": " + std::to_string(peak) + " threads, expected at most " +
+                           std::to_string(expectedPeak));
+    }
+    long left = processThreads();
+    if (left > baselineThreads + 2) {
+        failures.push_back("round " + std::to_string(round) + ": " + std::to_string(left - baselineThreads) +
+                           " threads leaked");
+    }
+
+    std::cout << "round " << round << ": " << (backend == QueueBackend::Monitor ? "Monitor" : "LockFree")
+              << " threads=" << maxThreads << " waiting=" << maxWaiting << " idle=" << idleMs << "ms"
+              << (shutdownUnderLoad ? " shutdownNow" : "") << " | run=" << runs << " cancelled=" << cancels
+              << " dropped=" << drops << " tasks/s="
+              << static_cast<uint64_t>(static_cast<double>(result.tasksRun) / std::max(result.burstSeconds, 1e-9))
+              << " p99=" << result.waitTime.percentile(0.99).count() / 1000 << "us idleCpu=" << result.idleCpu
+              << " peakThreads=" << peak << " rss=" << residentMb() << "MiB\n";
+    return result;
+}
+
+} // namespace
+
+/**
+ * @brief Runs rounds until the duration elapsed, then checks the thresholds.
+ * @return 0 if every threshold held, 1 otherwise.
+ */
+int main(int argc, char* argv[]) {
+    SoakConfig config;
+    for (int i = 1; i < argc; ++i) {
+        if (!parseArgument(argv[i], config)) {
+            std::cerr << "Unknown argument " << argv[i] << "\n";
+            return 2;
+        }
+    }
+
+    std::mt19937 rng(config.seed);
+    ThreadSampler sampler;
+    long baselineThreads = processThreads();
+    std::vector<std::string> failures;
+    std::vector<RoundResult> rounds;
+    double rssStart = 0;
+    auto end = Clock::now() + config.duration;
+
+    do {
+        rounds.push_back(runRound(rng, static_cast<int>(rounds.size()), baselineThreads, sampler, config, failures));
+        // The first round warms the allocators and the log sink up
+        if (rounds.size() == 1) {
+            rssStart = residentMb();
+        }
+    } while (Clock::now() < end);
+
+    // Throughput of the rounds measured with an idle phase, first and last thirds compared
+    auto throughputOf = [&rounds](size_t from, size_t to) {
+        uint64_t tasks = 0;
+        double seconds = 0;
+        for (size_t i = from; i < to; ++i) {
+            tasks += rounds[i].tasksRun;
+            seconds += rounds[i].burstSeconds;
+        }
+        return seconds > 0 ? static_cast<double>(tasks) / seconds : 0.0;
+    };
+    HistogramSnapshot waitTime;
+    for (const auto &round : rounds) {
+        waitTime.merge(round.waitTime);
+    }
+    double throughput = throughputOf(0, rounds.size());
+    size_t third = rounds.size() / 3;
+    double first = throughputOf(0, third);
+    double last = throughputOf(rounds.size() - third, rounds.size());
+    double p99Ms = static_cast<double>(waitTime.percentile(0.99).count()) / 1e6;
+    double rssGrowth = residentMb() - rssStart;
+
+    std::cout << "\nrounds=" << rounds.size() << " tasks/s=" << static_cast<uint64_t>(throughput)
+              << " p99=" << p99Ms << "ms p999=" << static_cast<double>(waitTime.percentile(0.999).count()) / 1e6
+              << "ms rssGrowth=" << rssGrowth << "MiB\n";
+
+    if (throughput < config.minThroughput) {
+        failures.push_back("throughput " + std::to_string(throughput) + " tasks/s");
+    }
+    if (third > 0 && first > 0 && last < first * config.minThroughputRatio) {
+        failures.push_back("throughput fell from " + std::to_string(first) + " to " + std::to_string(last) + " tasks/s");
+    }
+    if (p99Ms > config.maxP99Ms) {
+        failures.push_back("p99 queue latency " + std::to_string(p99Ms) + " ms");
+    }
+    if (rssGrowth > config.maxRssGrowthMb) {
+        failures.push_back("RSS grew by " + std::to_string(rssGrowth) + " MiB");
+    }
+
+    for (const auto &failure : failures) {
+        std::cout << "FAIL: " << failure << "\n";
+    }
+    if (!failures.empty()) {
+        return 1;
+    }
+    std::cout << "PASS\n";
+    return 0;
+}
@@ -0,0 +1,480 @@
+/**
+ * @file strand.h
+ * @brief Header file defining KeyedStrands and Strand, which run the tasks sharing a key one at a time, in submission order, on a ThreadPool.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef STRAND_H
+#define STRAND_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <pcosynchro/pcomutex.h>
+#include <pcosynchro/pcoconditionvariable.h>
+
+#include "functiontask.h"
+#include "poollog.h"
+#include "runnable.h"
+#include "threadpool.h"
+
+/**
+ * @brief Serial executors, one per key, run on a ThreadPool.
+ * The tasks posted with the same key run one at a time, in the order they were posted, and
+ * the tasks of different keys run in parallel. A key with pending tasks has a single task of
+ * its own in the pool, which runs up to BatchSize of them in a row before queuing itself
+ * again: a key never holds more than one worker, and never holds it for long while other
+ * keys wait. A key without pending tasks has no entry at all.
+ * The task of a key is queued with trySubmit(), so post() never blocks. When the queue is
+ * full, or an overflow of the pool drops the queued task of a key, no task is cancelled: the
+ * key is parked with its tasks, and queued again by the next post() with that key, by the
+ * next worker giving up a key of the strands, or by wait(). Once the pool shuts down, every
+ * pending task of the key is cancelled. The strands must outlive their tasks, the destructor
+ * waits for them.
+ * @tparam Key Type of the keys, copyable and hashable
+ * @tparam Hash Hash function of the keys
+ */
+template<typename Key, typename Hash = std::hash<Key>>
+class KeyedStrands {
+public:
+    static constexpr size_t BatchSize = 16; // Tasks of a key run in a row by a worker before it goes back to the pool
+
+    /**
+     * @brief Constructor
+     * @param pool The pool the tasks are run on
+     * @param nbShards Number of independently locked tables the keys are spread over
+     * @throws std::invalid_argument if nbShards is zero
+     */
+    explicit KeyedStrands(ThreadPool& pool, size_t nbShards = 16) : pool(pool), nbShards(nbShards) {
+        if (nbShards == 0) {
+            throw std::invalid_argument("nbShards must be positive");
+        }
+        shards = std::make_unique<Shard[]>(nbShards);
+    }
+
+    KeyedStrands(const KeyedStrands&) = delete;
+    KeyedStrands& operator=(const KeyedStrands&) = delete;
+
+    /**
+     * @brief Destructor
+     * Waits until every posted task ran or was cancelled.
+     */
+    ~KeyedStrands() {
+        wait();
+    }
+
+    /**
+     * @brief Posts a task, run after the tasks posted before it with the same key.
+     * @param key The key of the task
+     * @param task The task, run or cancelled through its cancelRun()
+     * @throws std::invalid_argument if task is null
+     */
+    void post(const Key& key, TaskPtr task) {
+        if (!task) {
+            throw std::invalid_argument("task cannot be null");
+        }
+        nbPending.fetch_add(1, std::memory_order_relaxed);
+
+        Shard& shard = shardOf(key);
+        shard.mutex.lock();
+        auto [entry, idle] = shard.lanes.try_emplace(key);
+        Lane& lane = entry->second;
+        lane.tasks.push_back(std::move(task));
+        bool resumed = !idle && !lane.queued;
+        if (resumed) {
+            lane.queued = true;
+            nbParked.fetch_sub(1, std::memory_order_relaxed);
+        }
+        shard.mutex.unlock();
+
+        // The first task of an idle key, or of a key parked by a refusal, hands the key to the pool
+        if (idle || resumed) {
+            schedule(shard, key);
+        }
+    }
+
+    /**
+     * @brief Posts a task allocated with new.
+     * @param key The key of the task
+     * @param task The task, run or cancelled through its cancelRun()
+     * @throws std::invalid_argument if task is null
+     */
+    void post(const Key& key, std::unique_ptr<Runnable> task) {
+        post(key, TaskPtr(task.release()));
+    }
+
+    /**
+     * @brief Posts a callable, without having to write a Runnable subclass.
+     * @param key The key of the callable
+     * @param f The callable
+     * @param args Arguments given to the callable, copied or moved into the task
+     * @return A future holding the result of the callable, or a TaskCancelledError if it is cancelled.
+     */
+    template<typename F, typename... Args>
+    auto submit(const Key& key, F&& f, Args&&... args) -> TaskFuture<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+        using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+        using Call = PackagedCall<R, std::decay_t<F>, std::decay_t<Args>...>;
+
+        auto state = std::make_shared<FutureState<R>>();
+        post(key, pool.makeTask<FunctionTask>(Call(state, std::forward<F>(f), std::forward<Args>(args)...)));
+        return TaskFuture<R>(std::move(state));
+    }
+
+    /**
+     * @brief Waits until every task posted so far ran or was cancelled.
+     * The keys parked by a refusal of the pool are queued again meanwhile, waiting with
+     * submitUntil() for the pool to free a slot: no task is cancelled unless the pool shuts down.
+     * Blocks the calling thread: called from a task of the pool, it takes a thread away from the strands.
+     */
+    void wait() {
+        mutex.lock();
+        while (nbPending.load(std::memory_order_acquire) != 0) {
+            if (nbParked.load(std::memory_order_relaxed) > 0) {
+                mutex.unlock();
+                resumeParked(true);
+                mutex.lock();
+                continue;
+            }
+            cond.wait(&mutex);
+        }
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Returns the number of keys with a pending or running task.
+     * @return The number of keys holding a task in the pool or parked by a refusal.
+     */
+    size_t nbActiveKeys() {
+        size_t count = 0;
+        for (size_t i = 0; i < nbShards; ++i) {
+            shards[i].mutex.lock();
+            count += shards[i].lanes.size();
+            shards[i].mutex.unlock();
+        }
+        return count;
+    }
+
+private:
+    /**
+     * @brief Pending tasks of a key, the running one excluded.
+     */
+    struct Lane {
+        std::deque<TaskPtr> tasks;  // Tasks in posting order
+        bool queued = true;         // A task of the key is in the pool, false while parked by a refusal or a drop
+    };
+
+    /**
+     * @brief Keys whose hash falls in the same shard, with their pending tasks.
+     */
+    struct alignas(64) Shard {
+        PcoMutex mutex;                                 // Protects lanes
+        std::unordered_map<Key, Lane, Hash> lanes;      // Keys with a task in the pool, erased once idle
+    };
+
+    /**
+     * @brief Task handed to the pool for a key, which runs the pending tasks of the key.
+     * Cancelling it parks the key, or cancels its tasks once the pool shut down, and
+     * destroying it without running it (pool shut down) cancels them all. Both only leave a
+     * mark while the pool does not refuse it, the submitter handling the refusal itself then.
+     */
+    class LaneTask : public Runnable {
+    public:
+        LaneTask(KeyedStrands& strands, Shard& shard, const Key& key) : strands(strands), shard(shard), key(key) {}
+
+        ~LaneTask() override {
+            if (!finished && submitting() != this) {
+                strands.cancelLane(shard, key);
+            }
+        }
+
+        void run() override {
+            finished = true;
+            strands.drain(shard, key);
+        }
+
+        void cancelRun() override {
+            finished = true;
+            if (submitting() == this) {
+                return;
+            }
+            // Dropped by an overflow of the pool, or abandoned by its shutdown
+            if (strands.pool.isShutdown()) {
+                strands.cancelLane(shard, key);
+            } else {
+                strands.park(shard, key);
+            }
+        }
+
+        std::string id() override {
+            return "Strand";
+        }
+
+    private:
+        KeyedStrands& strands;  // Strands owning the key
+        Shard& shard;           // Shard of the key
+        Key key;                // Key whose tasks are run
+        bool finished = false;  // Set once the tasks were run or cancelled through this task
+    };
+
+    /**
+     * @brief Returns the shard of a key.
+     * @param key The key
+     * @return The shard its hash falls in.
+     */
+    Shard& shardOf(const Key& key) {
+        return shards[hash(key) % nbShards];
+    }
+
+    /**
+     * @brief Returns the task being submitted by the calling thread.
+     * @return A reference to the slot, null outside of schedule().
+     */
+    static Runnable*& submitting() {
+        thread_local Runnable* task = nullptr;
+        return task;
+    }
+
+    /**
+     * @brief Submits the task of a key, the refusals being left to the caller.
+     * @param shard Shard of the key
+     * @param key The key
+     * @param deadline Time after which the pool refuses the task if its queue is still full
+     * @return The outcome of the submission.
+     */
+    SubmitStatus submitLane(Shard& shard, const Key& key, std::chrono::steady_clock::time_point deadline) {
+        TaskPtr task = pool.makeTask<LaneTask>(*this, shard, key);
+        Runnable* outer = submitting();
+        submitting() = task.get();
+        SubmitStatus result = pool.submitUntil(std::move(task), deadline);
+        submitting() = outer;
+        return result;
+    }
+
+    /**
+     * @brief Hands a key with pending tasks to the pool.
+     * If the queue stays full, the key is parked with its tasks. If the pool shuts down, every
+     * pending task of the key is cancelled.
+     * @param shard Shard of the key
+     * @param key The key
+     * @param block True to wait for a free slot as long as the pool runs, false to never block
+     */
+    void schedule(Shard& shard, const Key& key, bool block = false) {
+        auto deadline = block ? std::chrono::steady_clock::time_point::max() : std::chrono::steady_clock::now();
+        SubmitStatus result = submitLane(shard, key, deadline);
+        if (result == SubmitStatus::ShuttingDown) {
+            cancelLane(shard, key);
+        } else if (result == SubmitStatus::QueueFull) {
+            park(shard, key);
+        }
+    }
+
+    /**
+     * @brief Queues again the keys parked by a refusal of the pool.
+     * @param block True to wait for a free slot for each of them, false to park again the
+     *        keys the pool still refuses
+     */
+    void resumeParked(bool block) {
+        if (nbParked.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        for (size_t i = 0; i < nbShards; ++i) {
+            Shard& shard = shards[i];
+            std::vector<Key> parked;
+            shard.mutex.lock();
+            for (auto &[key, lane] : shard.lanes) {
+                if (!lane.queued) {
+                    lane.queued = true;
+                    nbParked.fetch_sub(1, std::memory_order_relaxed);
+                    parked.push_back(key);
+                }
+            }
+            shard.mutex.unlock();
+
+            for (const Key& key : parked) {
+                schedule(shard, key, block);
+            }
+        }
+    }
+
+    /**
+     * @brief Runs up to BatchSize pending tasks of a key, then erases the key if it has none
+     * left, or hands it to the pool again. The worker keeps the key while the queue is full,
+     * and queues the parked keys once it gives it up.
+     * @param shard Shard of the key
+     * @param key The key
+     */
+    void drain(Shard& shard, const Key& key) {
+        shard.mutex.lock();
+        Lane& lane = shard.lanes.find(key)->second;
+        TaskPtr task = std::move(lane.tasks.front());
+        lane.tasks.pop_front();
+        shard.mutex.unlock();
+
+        for (size_t nbRun = 1;; ++nbRun) {
+            try {
+                task->run();
+            } catch (const std::exception& e) {
+                poolLog<LogLevel::Error>("Strand task execution failed: ", e.what());
+            }
+            task.reset();
+
+            // The key is given up before the task is counted: the last count may let the owner destroy the strands
+            shard.mutex.lock();
+            auto entry = shard.lanes.find(key);
+            if (entry->second.tasks.empty()) {
+                shard.lanes.erase(entry);
+                shard.mutex.unlock();
+                resumeParked(false);
+                finishTasks(1);
+                return;
+            }
+            if (nbRun % BatchSize == 0) {
+                shard.mutex.unlock();
+                SubmitStatus result = submitLane(shard, key, std::chrono::steady_clock::now());
+                if (result != SubmitStatus::QueueFull) {
+                    if (result == SubmitStatus::ShuttingDown) {
+                        cancelLane(shard, key);
+                    }
+                    resumeParked(false);
+                    finishTasks(1);
+                    return;
+                }
+                // Rather than parking the key, the worker goes on with its tasks
+                shard.mutex.lock();
+                entry = shard.lanes.find(key);
+            }
+            task = std::move(entry->second.tasks.front());
+            entry->second.tasks.pop_front();
+            shard.mutex.unlock();
+            finishTasks(1);
+        }
+    }
+
+    /**
+     * @brief Parks a key refused or dropped by the pool, with all its pending tasks, and
+     * wakes up wait() to queue it again.
+     * @param shard Shard of the key
+     * @param key The key
+     */
+    void park(Shard& shard, const Key& key) {
+        shard.mutex.lock();
+        shard.lanes.find(key)->second.queued = false;
+        nbParked.fetch_add(1, std::memory_order_relaxed);
+        shard.mutex.unlock();
+
+        // The parked tasks keep nbPending above zero, the strands are still alive
+        mutex.lock();
+        cond.notifyAll();
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Cancels the pending tasks of a key and erases it.
+     * @param shard Shard of the key
+     * @param key The key
+     */
+    void cancelLane(Shard& shard, const Key& key) {
+        std::deque<TaskPtr> cancelled;
+        shard.mutex.lock();
+        auto entry = shard.lanes.find(key);
+        cancelled = std::move(entry->second.tasks);
+        shard.lanes.erase(entry);
+        shard.mutex.unlock();
+
+        size_t count = cancelled.size();
+        for (auto &task : cancelled) {
+            task->cancelRun();
+        }
+        cancelled.clear();
+        finishTasks(count);
+    }
+
+    /**
+     * @brief Counts tasks as run or cancelled, and wakes up wait() with the last one.
+     * Nothing of the strands may be touched afterwards by the caller.
+     * @param count Number of finished tasks
+     */
+    void finishTasks(size_t count) {
+        if (count > 0 && nbPending.fetch_sub(count, std::memory_order_acq_rel) == count) {
+            mutex.lock();
+            cond.notifyAll();
+            mutex.unlock();
+        }
+    }
+
+    ThreadPool& pool;                       // Pool the tasks are run on
+    size_t nbShards;                        // Number of shards
+    std::unique_ptr<Shard[]> shards;        // Keys with pending tasks, spread by hash
+    Hash hash;                              // Hash function of the keys
+    std::atomic<size_t> nbPending{0};       // Posted tasks neither run nor cancelled yet
+    std::atomic<size_t> nbParked{0};        // Keys parked by a refusal of the pool
+    PcoMutex mutex;                         // Used with cond to wait for nbPending to reach zero
+    PcoConditionVariable cond;              // Signaled when nbPending reaches zero or a key is parked
+};
+
+/**
+ * @brief Serial executor run on a ThreadPool: its tasks run one at a time, in the order
+ * they were posted, on any thread of the pool. A KeyedStrands with a single key.
+ */
+class Strand {
+public:
+    /**
+     * @brief Constructor
+     * @param pool The pool the tasks are run on
+     */
+    explicit Strand(ThreadPool& pool) : strands(pool, 1) {}
+
+    /**
+     * @brief Posts a task, run after the tasks posted before it.
+     * @param task The task, run or cancelled through its cancelRun()
+     * @throws std::invalid_argument if task is null
+     */
+    void post(std::unique_ptr<Runnable> task) {
+        strands.post(0, std::move(task));
+    }
+
+    /**
+     * @brief Posts a task built with ThreadPool::makeTask().
+     * @param task The task, run or cancelled through its cancelRun()
+     * @throws std::invalid_argument if task is null
+     */
+    void post(TaskPtr task) {
+        strands.post(0, std::move(task));
+    }
+
+    /**
+     * @brief Posts a callable, without having to write a Runnable subclass.
+     * @param f The callable
+     * @param args Arguments given to the callable, copied or moved into the task
+     * @return A future holding the result of the callable, or a TaskCancelledError if it is cancelled.
+     */
+    template<typename F, typename... Args>
+    auto submit(F&& f, Args&&... args) {
+        return strands.submit(0, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief Waits until every task posted so far ran or was cancelled.
+     */
+    void wait() {
+        strands.wait();
+    }
+
+private:
+    KeyedStrands<int> strands; // The single key 0
+};
+
+#endif // STRAND_H
@@ -0,0 +1,409 @@
+/**
+ * @file taskgraph.h
+ * @brief Header file defining TaskGraph, which runs Runnables on a ThreadPool in the order given by their dependencies.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <pcosynchro/pcomutex.h>
+#include <pcosynchro/pcoconditionvariable.h>
+
+#include "runnable.h"
+#include "threadpool.h"
+
+/**
+ * @brief Directed acyclic graph of tasks run on a ThreadPool.
+ * Each node counts down its unfinished predecessors with an atomic counter: the predecessor
+ * that brings it to zero starts it on the pool right away, without any barrier between the
+ * levels of the graph. When a node is cancelled (cancel(), overflow of the pool, shutdown)
+ * or its run() throws, every node depending on it is cancelled through its cancelRun().
+ * The graph can be run again once a run is over. It must outlive its runs, the destructor
+ * waits for the current one.
+ */
+class TaskGraph {
+public:
+    using NodeId = size_t;
+
+    /**
+     * @brief Constructor
+     * @param pool The pool the tasks are run on
+     */
+    explicit TaskGraph(ThreadPool& pool) : pool(pool) {}
+
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    /**
+     * @brief Destructor
+     * Waits for the current run, without rethrowing its exception.
+     */
+    ~TaskGraph() {
+        waitRun();
+    }
+
+    /**
+     * @brief Adds a task to the graph.
+     * @param task The task, run or cancelled once per run of the graph
+     * @return The identifier of its node.
+     * @throws std::invalid_argument if task is null
+     * @throws std::logic_error if the graph is running
+     */
+    NodeId add(std::unique_ptr<Runnable> task) {
+        if (!task) {
+            throw std::invalid_argument("task cannot be null");
+        }
+        checkIdle();
+        nodes.emplace_back();
+        nodes.back().task = std::move(task);
+        return nodes.size() - 1;
+    }
+
+    /**
+     * @brief Adds a callable to the graph, without having to write a Runnable subclass.
+     * @param f The callable, called without arguments, whose cancellation does nothing
+     * @return The identifier of its node.
+     * @throws std::logic_error if the graph is running
+     */
+    template<typename F>
+    NodeId addFunction(F&& f) {
+        return add(std::make_unique<CallableTask>(std::function<void()>(std::forward<F>(f))));
+    }
+
+    /**
+     * @brief Adds an edge: after only starts once before finished.
+     * @param before The node to run first
+     * @param after The node depending on it
+     * @throws std::invalid_argument if a node does not exist or both are the same
+     * @throws std::logic_error if the graph is running
+     */
+    void precede(NodeId before, NodeId after) {
+        if (before >= nodes.size() || after >= nodes.size()) {
+            throw std::invalid_argument("unknown node");
+        }
+        if (before == after) {
+            throw std::invalid_argument("a node cannot depend on itself");
+        }
+        checkIdle();
+        nodes[before].successors.push_back(after);
+        ++nodes[after].nbPredecessors;
+    }
+
+    /**
+     * @brief Starts a run of the graph: the nodes without predecessors are started on the pool.
+     * Returns without waiting, see wait().
+     * @throws std::logic_error if the graph is already running or has a cycle
+     */
+    void run() {
+        checkIdle();
+        if (!isAcyclic()) {
+            throw std::logic_error("TaskGraph has a cycle");
+        }
+        if (nodes.empty()) {
+            return;
+        }
+
+        for (auto &node : nodes) {
+            node.pending.store(node.nbPredecessors, std::memory_order_relaxed);
+            node.cancelled.store(false, std::memory_order_relaxed);
+        }
+        cancelRequested = false;
+        nbCancelled = 0;
+        remaining = nodes.size();
+        mutex.lock();
+        running = true;
+        error = nullptr;
+        mutex.unlock();
+
+        for (NodeId id = 0; id < nodes.size(); ++id) {
+            if (nodes[id].nbPredecessors == 0) {
+                schedule(id);
+            }
+        }
+    }
+
+    /**
+     * @brief Waits until every node of the current run ran or was cancelled.
+     * Blocks the calling thread: called from a task of the pool, it takes a thread away from the graph.
+     * @throws The first exception thrown by the run() of a node during the run.
+     */
+    void wait() {
+        if (std::exception_ptr failure = waitRun()) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    /**
+     * @brief Cancels the nodes of the current run that did not start yet.
+     * Running nodes finish, the others are cancelled through their cancelRun().
+     */
+    void cancel() {
+        cancelRequested = true;
+    }
+
+    /**
+     * @brief Returns the number of nodes.
+     * @return The size of the graph.
+     */
+    size_t size() const {
+        return nodes.size();
+    }
+
+    /**
+     * @brief Returns the number of nodes cancelled during the last run.
+     * @return The number of cancelRun() calls made by the graph.
+     */
+    size_t cancelledCount() const {
+        return nbCancelled;
+    }
+
+private:
+    /**
+     * @brief A node of the graph.
+     */
+    struct Node {
+        std::unique_ptr<Runnable> task;     // The task of the node
+        std::vector<NodeId> successors;     // Nodes depending on this one
+        size_t nbPredecessors = 0;          // Number of nodes this one depends on
+        std::atomic<size_t> pending{0};     // Predecessors not finished yet in the current run
+        std::atomic<bool> cancelled{false}; // Set once the node is cancelled in the current run
+    };
+
+    /**
+     * @brief Task handed to the pool for a node.
+     * Cancelling it, or destroying it without running it (pool shut down), cancels the node.
+     */
+    class NodeTask : public Runnable {
+    public:
+        NodeTask(TaskGraph& graph, NodeId id) : graph(graph), node(id) {}
+
+        ~NodeTask() override {
+            if (!finished) {
+                graph.cancelNode(node);
+            }
+        }
+
+        void run() override {
+            finished = true;
+            graph.execute(node);
+        }
+
+        void cancelRun() override {
+            finished = true;
+            graph.cancelNode(node);
+        }
+
+        std::string id() override {
+            return "TaskGraph_" + std::to_string(node);
+        }
+
+    private:
+        TaskGraph& graph;       // Graph owning the node
+        NodeId node;            // Node to run
+        bool finished = false;  // Set once the node was run or cancelled through this task
+    };
+
+    /**
+     * @brief Runnable calling a callable, used by addFunction().
+     */
+    class CallableTask : public Runnable {
+    public:
+        explicit CallableTask(std::function<void()> f) : f(std::move(f)) {}
+
+        void run() override {
+            f();
+        }
+
+        void cancelRun() override {}
+
+        std::string id() override {
+            return "TaskGraphFunction";
+        }
+
+    private:
+        std::function<void()> f; // The callable
+    };
+
+    /**
+     * @brief Throws if the graph is running.
+     * @throws std::logic_error if a run is in progress
+     */
+    void checkIdle() {
+        mutex.lock();
+        bool busy = running;
+        mutex.unlock();
+        if (busy) {
+            throw std::logic_error("TaskGraph is running");
+        }
+    }
+
+    /**
+     * @brief Checks that the graph has no cycle, with Kahn's algorithm.
+     * @return True if every node can be reached from the nodes without predecessors.
+     */
+    bool isAcyclic() const {
+        std::vector<size_t> degree(nodes.size());
+        std::vector<NodeId> ready;
+        for (NodeId id = 0; id < nodes.size(); ++id) {
+            degree[id] = nodes[id].nbPredecessors;
+            if (degree[id] == 0) {
+                ready.push_back(id);
+            }
+        }
+        size_t nbVisited = 0;
+        while (!ready.empty()) {
+            NodeId id = ready.back();
+            ready.pop_back();
+            ++nbVisited;
+            for (NodeId successor : nodes[id].successors) {
+                if (--degree[successor] == 0) {
+                    ready.push_back(successor);
+                }
+            }
+        }
+        return nbVisited == nodes.size();
+    }
+
+    /**
+     * @brief Starts a node whose predecessors all finished.
+     * If the pool refuses it, the task is cancelled or destroyed, which cancels the node.
+     * @param id The node
+     */
+    void schedule(NodeId id) {
+        pool.start(pool.makeTask<NodeTask>(*this, id));
+    }
+
+    /**
+     * @brief Runs a node, then starts the successors it was the last predecessor of.
+     * @param id The node
+     */
+    void execute(NodeId id) {
+        if (cancelRequested) {
+            cancelNode(id);
+            return;
+        }
+
+        Node& node = nodes[id];
+        try {
+            node.task->run();
+        } catch (...) {
+            mutex.lock();
+            if (!error) {
+                error = std::current_exception();
+            }
+            mutex.unlock();
+            cancelSuccessors(id);
+            finishNode();
+            return;
+        }
+
+        for (NodeId successor : node.successors) {
+            if (nodes[successor].pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                schedule(successor);
+            }
+        }
+        finishNode();
+    }
+
+    /**
+     * @brief Cancels a node and every node depending on it.
+     * @param id The node
+     */
+    void cancelNode(NodeId id) {
+        if (nodes[id].cancelled.exchange(true)) {
+            return;
+        }
+        nodes[id].task->cancelRun();
+        ++nbCancelled;
+        cancelSuccessors(id);
+        finishNode();
+    }
+
+    /**
+     * @brief Cancels every node reachable from a node, but not the node itself.
+     * Iterative, so that long chains do not overflow the stack. A node is cancelled once,
+     * even when several of its predecessors are.
+     * @param id The node whose successors are cancelled
+     */
+    void cancelSuccessors(NodeId id) {
+        std::vector<NodeId> stack(nodes[id].successors.begin(), nodes[id].successors.end());
+        size_t nbFinished = 0;
+        while (!stack.empty()) {
+            NodeId successor = stack.back();
+            stack.pop_back();
+            if (nodes[successor].cancelled.exchange(true)) {
+                continue;
+            }
+            nodes[successor].task->cancelRun();
+            ++nbCancelled;
+            ++nbFinished;
+            stack.insert(stack.end(), nodes[successor].successors.begin(), nodes[successor].successors.end());
+        }
+        // Counted at once, the last finishNode() may let the owner destroy the graph
+        if (nbFinished > 0) {
+            finishNodes(nbFinished);
+        }
+    }
+
+    /**
+     * @brief Counts a node as run or cancelled, and ends the run with the last one.
+     * Nothing of the graph may be touched afterwards by the caller.
+     */
+    void finishNode() {
+        finishNodes(1);
+    }
+
+    /**
+     * @brief Counts several nodes as run or cancelled.
+     * @param count Number of finished nodes
+     */
+    void finishNodes(size_t count) {
+        if (remaining.fetch_sub(count, std::memory_order_acq_rel) == count) {
+            mutex.lock();
+            running = false;
+            cond.notifyAll();
+            mutex.unlock();
+        }
+    }
+
+    /**
+     * @brief Waits for the end of the current run, if any.
+     * @return The first exception thrown by a node during the last run, null if none.
+     */
+    std::exception_ptr waitRun() {
+        mutex.lock();
+        while (running) {
+            cond.wait(&mutex);
+        }
+        std::exception_ptr failure = error;
+        mutex.unlock();
+        return failure;
+    }
+
+    ThreadPool& pool;                       // Pool the nodes are run on
+    std::deque<Node> nodes;                 // Nodes of the graph, a deque as they cannot be moved
+    std::atomic<size_t> remaining{0};       // Nodes of the current run neither run nor cancelled yet
+    std::atomic<size_t> nbCancelled{0};     // Nodes cancelled during the current run
+    std::atomic<bool> cancelRequested{false}; // Set by cancel()
+    PcoMutex mutex;                         // Protects running and error
+    PcoConditionVariable cond;              // Signaled at the end of a run
+    bool running = false;                   // True from run() until every node finished
+    std::exception_ptr error;               // First exception thrown by a node in the current run
+};
+
+#endif // TASKGRAPH_H
@@ -0,0 +1,242 @@
+/**
+ * @file taskslab.h
+ * @brief Header file defining TaskSlab, the fixed-size block allocator used for the pool's task objects.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef TASKSLAB_H
+#define TASKSLAB_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <pcosynchro/pcomutex.h>
+
+#include "runnable.h"
+
+/**
+ * @brief Allocator of fixed-size blocks for task objects.
+ * Blocks are carved out of chunks of ChunkBlocks blocks and recycled through free lists, so
+ * submitting a task does not go through the global allocator. Each worker thread of the owning
+ * pool has its own cache, used without any lock: a task freed by the worker that ran it goes
+ * back to that worker's cache. Caches exchange batches of blocks with a shared depot protected
+ * by a mutex when they run empty or grow too big. Threads outside the pool use the depot directly.
+ * Blocks are only given back to the system when the slab is destroyed.
+ */
+class TaskSlab {
+public:
+    static constexpr size_t NoCache = SIZE_MAX;     // Returned by the cache lookup for threads without a cache
+    static constexpr size_t ChunkBlocks = 256;      // Number of blocks allocated at once when the depot is empty
+    static constexpr size_t CacheLimit = 64;        // Size over which a cache gives a batch back to the depot
+    static constexpr size_t BatchSize = 32;         // Number of blocks moved between a cache and the depot
+
+    /**
+     * @brief Returns the cache of the calling thread.
+     * @param context The context given to the constructor
+     * @return The index of the cache, or NoCache.
+     */
+    using CacheLookup = size_t (*)(const void* context);
+
+    /**
+     * @brief Constructor
+     * @param blockSize Size of the blocks, rounded up to keep every block aligned on std::max_align_t
+     * @param nbCaches Number of per-thread caches
+     * @param cacheOf Function giving the cache of the calling thread, only ever called by its owner
+     * @param context Passed to cacheOf
+     */
+    TaskSlab(size_t blockSize, size_t nbCaches, CacheLookup cacheOf, const void* context)
+        : blockSize(roundUp(blockSize)),
+          nbCaches(nbCaches),
+          caches(std::make_unique<Cache[]>(nbCaches)),
+          cacheOf(cacheOf),
+          context(context) {}
+
+    TaskSlab(const TaskSlab&) = delete;
+    TaskSlab& operator=(const TaskSlab&) = delete;
+
+    /**
+     * @brief Returns the size of the blocks.
+     * @return The block size in bytes.
+     */
+    size_t getBlockSize() const {
+        return blockSize;
+    }
+
+    /**
+     * @brief Allocates a block of getBlockSize() bytes.
+     * @return The block, aligned on std::max_align_t.
+     * @throws std::bad_alloc if a new chunk cannot be allocated
+     */
+    void* allocate() {
+        size_t index = cacheOf(context);
+        if (index >= nbCaches) {
+            mutex.lock();
+            if (!depot) {
+                try {
+                    grow();
+                } catch (...) {
+                    mutex.unlock();
+                    throw;
+                }
+            }
+            Block* block = depot;
+            depot = block->next;
+            mutex.unlock();
+            return block;
+        }
+
+        Cache& cache = caches[index];
+        if (!cache.head) {
+            refill(cache);
+        }
+        Block* block = cache.head;
+        cache.head = block->next;
+        --cache.count;
+        return block;
+    }
+
+    /**
+     * @brief Gives a block back to the slab.
+     * @param pointer A block returned by allocate()
+     */
+    void deallocate(void* pointer) {
+        Block* block = static_cast<Block*>(pointer);
+        size_t index = cacheOf(context);
+        if (index >= nbCaches) {
+            mutex.lock();
+            block->next = depot;
+            depot = block;
+            mutex.unlock();
+            return;
+        }
+
+        Cache& cache = caches[index];
+        block->next = cache.head;
+        cache.head = block;
+        if (++cache.count > CacheLimit) {
+            flush(cache);
+        }
+    }
+
+private:
+    struct Block {
+        Block* next; // Next free block
+    };
+
+    /**
+     * @brief Free blocks of one thread, on its own cache line.
+     */
+    struct alignas(64) Cache {
+        Block* head = nullptr;  // First free block
+        size_t count = 0;       // Number of free blocks
+    };
+
+    /**
+     * @brief Rounds a block size up to a multiple of the alignment of std::max_align_t.
+     * @param size The requested size
+     * @return The rounded size, big enough to hold a Block.
+     */
+    static size_t roundUp(size_t size) {
+        const size_t alignment = alignof(std::max_align_t);
+        size = std::max(size, sizeof(Block));
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    /**
+     * @brief Allocates a new chunk and pushes its blocks in the depot (with the mutex).
+     */
+    void grow() {
+        // operator new[] returns memory aligned for std::max_align_t
+        chunks.emplace_back(std::make_unique<unsigned char[]>(blockSize * ChunkBlocks));
+        unsigned char* bytes = chunks.back().get();
+        for (size_t i = ChunkBlocks; i-- > 0;) {
+            Block* block = reinterpret_cast<Block*>(bytes + i * blockSize);
+            block->next = depot;
+            depot = block;
+        }
+    }
+
+    /**
+     * @brief Moves up to BatchSize blocks from the depot to an empty cache.
+     * @param cache The cache of the calling thread
+     */
+    void refill(Cache& cache) {
+        mutex.lock();
+        if (!depot) {
+            try {
+                grow();
+            } catch (...) {
+                mutex.unlock();
+                throw;
+            }
+        }
+        while (depot && cache.count < BatchSize) {
+            Block* block = depot;
+            depot = block->next;
+            block->next = cache.head;
+            cache.head = block;
+            ++cache.count;
+        }
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Moves BatchSize blocks from a cache to the depot.
+     * @param cache The cache of the calling thread
+     */
+    void flush(Cache& cache) {
+        Block* first = cache.head;
+        Block* last = first;
+        for (size_t i = 1; i < BatchSize; ++i) {
+            last = last->next;
+        }
+        cache.head = last->next;
+        cache.count -= BatchSize;
+
+        mutex.lock();
+        last->next = depot;
+        depot = first;
+        mutex.unlock();
+    }
+
+    const size_t blockSize;                 // Size of every block, multiple of alignof(std::max_align_t)
+    const size_t nbCaches;                  // Number of entries in caches
+    std::unique_ptr<Cache[]> caches;        // Per-thread caches, each one only used by its thread
+    CacheLookup cacheOf;                    // Gives the cache of the calling thread
+    const void* context;                    // Passed to cacheOf
+    PcoMutex mutex;                         // Protects depot and chunks
+    Block* depot = nullptr;                 // Free blocks shared by all the threads
+    std::vector<std::unique_ptr<unsigned char[]>> chunks; // Memory of all the blocks
+};
+
+/**
+ * @brief Deleter of the tasks held by the pool.
+ * Tasks allocated in a TaskSlab are destroyed in place and their block is given back to the
+ * slab, the other ones are deleted.
+ */
+struct TaskDeleter {
+    TaskSlab* slab = nullptr; // Slab owning the task, null for tasks allocated with new
+
+    void operator()(Runnable* runnable) const {
+        if (slab) {
+            // The block starts at the most derived object, not necessarily at the Runnable
+            void* block = dynamic_cast<void*>(runnable);
+            runnable->~Runnable();
+            slab->deallocate(block);
+        } else {
+            delete runnable;
+        }
+    }
+};
+
+/**
+ * @brief Owning pointer on a task, allocated in a TaskSlab or with new.
+ */
+using TaskPtr = std::unique_ptr<Runnable, TaskDeleter>;
+
+#endif // TASKSLAB_H
@@ -0,0 +1,334 @@
+/**
+ * @file tasktrace.h
+ * @brief Header file defining TaskTracer, the recorder of the pool's timeline, written as Chrome trace JSON.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef TASKTRACE_H
+#define TASKTRACE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "threadInfo.h"
+
+/**
+ * @brief Kind of a trace event.
+ */
+enum class TraceEventKind : uint8_t {
+    Submit,         // A task was queued, the argument is its number
+    Dequeue,        // A thread took a task out of a queue, the argument is its number
+    RunBegin,       // A thread starts running a task, the argument is its number
+    RunEnd,         // The task returned or threw, the argument is its number
+    Reject,         // A task found no room, its cancelRun() was called, the argument is its number
+    Cancel,         // A task was abandoned by a shutdown, the argument is its number
+    WaitBegin,      // A producer starts waiting in start() for a thread to take its task
+    WaitEnd,        // The producer is resumed
+    ThreadSpawn,    // A worker thread was created, the argument is its number
+    ThreadExpiry    // A worker thread expired, the argument is the number of remaining threads
+};
+
+/**
+ * @brief Event of the timeline, recorded by one thread.
+ */
+struct TraceEvent {
+    uint64_t time;          // Nanoseconds since the creation of the tracer
+    uint64_t arg;           // Depends on the kind
+    TraceEventKind kind;    // What happened
+};
+
+/**
+ * @brief Ring of trace events with a single producer, the thread owning it, and a single consumer.
+ */
+class TraceRing {
+public:
+    static constexpr size_t Capacity = 8192; // Events buffered per thread, 192 KiB
+
+    /**
+     * @brief Constructor
+     * @param tid Number of the thread in the trace
+     * @param name Name of the thread in the trace
+     */
+    TraceRing(uint64_t tid, std::string name) : tid(tid), name(std::move(name)) {}
+
+    /**
+     * @brief Appends an event. Producer side.
+     * @param event The event
+     * @return False if the ring is full, the event is dropped.
+     */
+    bool push(const TraceEvent& event) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        events[h % Capacity] = event;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Hands the published events to a function, oldest first. Consumer side.
+     * @param f Called with each event, whose slot is freed once it returns
+     */
+    template<typename F>
+    void drain(F&& f) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        for (size_t i = t; i != h; ++i) {
+            f(events[i % Capacity]);
+            tail.store(i + 1, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief Checks if every published event was drained. Consumer side.
+     * @return True if the ring is empty.
+     */
+    bool empty() const {
+        return tail.load(std::memory_order_relaxed) == head.load(std::memory_order_acquire);
+    }
+
+    const uint64_t tid;                     // Number of the thread in the trace
+    const std::string name;                 // Name of the thread in the trace
+    std::atomic<bool> orphaned{false};      // Set when the owning thread exits, the ring is dropped once drained
+    std::atomic<bool> detached{false};      // Set when the tracer is destroyed, the thread forgets the ring
+
+private:
+    std::array<TraceEvent, Capacity> events;     // The buffered events
+    alignas(64) std::atomic<size_t> head{0};     // Next event to write, written by the owning thread
+    alignas(64) std::atomic<size_t> tail{0};     // Next event to read, written by the consumer
+};
+
+/**
+ * @brief Recorder of the timeline of a pool.
+ * Each thread records its events in a ring of its own, created on its first event, without
+ * any lock: when its ring is full, the event is dropped and counted. writeChromeTrace()
+ * drains the rings as Chrome trace JSON, which Perfetto and chrome://tracing load as is.
+ */
+class TaskTracer {
+public:
+    /**
+     * @brief Constructor
+     * @param owner The pool, whose threads are named after their ThreadInfo in the trace
+     */
+    explicit TaskTracer(const void* owner) : owner(owner), serial(nextSerial()), origin(std::chrono::steady_clock::now()) {}
+
+    TaskTracer(const TaskTracer&) = delete;
+    TaskTracer& operator=(const TaskTracer&) = delete;
+
+    /**
+     * @brief Destructor
+     * Lets the threads that recorded events forget their ring.
+     */
+    ~TaskTracer() {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (auto &ring : rings) {
+            ring->detached.store(true, std::memory_order_release);
+        }
+    }
+
+    /**
+     * @brief Records an event in the ring of the calling thread.
+     * @param kind What happened
+     * @param arg Depends on the kind
+     */
+    void record(TraceEventKind kind, uint64_t arg) {
+        auto time = std::chrono::steady_clock::now() - origin;
+        TraceEvent event{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count()),
+                         arg, kind};
+        if (!localRing().push(event)) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Returns the number of events dropped because the ring of their thread was full.
+     * @return The number of lost events since the creation of the tracer.
+     */
+    uint64_t droppedCount() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Writes the events recorded since the last call as a Chrome trace JSON document,
+     * and drops the drained rings of exited threads.
+     * Tasks are slices on the thread that ran them, their time in the queue an async slice
+     * from their submission to their dequeue, and the other events instants.
+     * @param out Destination of the document
+     */
+    void writeChromeTrace(std::ostream& out) {
+        std::lock_guard<std::mutex> drainLock(drainMutex);
+        std::vector<std::shared_ptr<TraceRing>> current;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            current = rings;
+        }
+
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ThreadPool\"}}";
+        bool hasOrphans = false;
+        for (auto &ring : current) {
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->tid
+                << ",\"args\":{\"name\":\"" << ring->name << "\"}}";
+            ring->drain([&out, &ring](const TraceEvent& event) {
+                writeEvent(out, ring->tid, event);
+            });
+            hasOrphans = hasOrphans || ring->orphaned.load(std::memory_order_acquire);
+        }
+        out << "\n]}\n";
+
+        if (hasOrphans) {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (size_t i = 0; i < rings.size();) {
+                // Events published before the flag was set are written on the next call
+                if (rings[i]->orphaned.load(std::memory_order_acquire) && rings[i]->empty()) {
+                    rings[i] = std::move(rings.back());
+                    rings.pop_back();
+                } else {
+                    ++i;
+                }
+            }
+        }
+    }
+
+private:
+    /**
+     * @brief Rings of a thread, one per tracer it recorded events in.
+     */
+    struct LocalRings {
+        ~LocalRings() {
+            for (auto &entry : entries) {
+                entry.second->orphaned.store(true, std::memory_order_release);
+            }
+        }
+
+        std::vector<std::pair<uint64_t, std::shared_ptr<TraceRing>>> entries; // Serial of the tracer and ring of the thread in it
+    };
+
+    /**
+     * @brief Hands out the serial numbers of the tracers, never reused unlike their addresses.
+     * @return A new serial number.
+     */
+    static uint64_t nextSerial() {
+        static std::atomic<uint64_t> counter{0};
+        return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    /**
+     * @brief Returns the ring of the calling thread, created on its first event.
+     * @return The ring.
+     */
+    TraceRing& localRing() {
+        thread_local LocalRings local;
+        auto &entries = local.entries;
+        for (size_t i = 0; i < entries.size();) {
+            if (entries[i].first == serial) {
+                return *entries[i].second;
+            }
+            // Forget the rings of the destroyed tracers
+            if (entries[i].second->detached.load(std::memory_order_acquire)) {
+                entries[i] = std::move(entries.back());
+                entries.pop_back();
+            } else {
+                ++i;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        uint64_t tid = ++nbRings;
+        ThreadInfo* info = ThreadInfo::current();
+        std::string name = info && info->getPool() == owner ? info->getName() : "External-" + std::to_string(tid);
+        auto ring = std::make_shared<TraceRing>(tid, std::move(name));
+        rings.push_back(ring);
+        entries.emplace_back(serial, ring);
+        return *ring;
+    }
+
+    /**
+     * @brief Writes an event as Chrome trace JSON, preceded by a separator.
+     * @param out Destination of the event
+     * @param tid Number of the thread that recorded it
+     * @param event The event
+     */
+    static void writeEvent(std::ostream& out, uint64_t tid, const TraceEvent& event) {
+        switch (event.kind) {
+        case TraceEventKind::Submit:
+            writeHead(out, "queued", "b", tid, event);
+            out << ",\"cat\":\"task\",\"id\":" << event.arg << "}";
+            break;
+        case TraceEventKind::Dequeue:
+            writeHead(out, "queued", "e", tid, event);
+            out << ",\"cat\":\"task\",\"id\":" << event.arg << "}";
+            break;
+        case TraceEventKind::RunBegin:
+            writeHead(out, "task", "B", tid, event);
+            out << ",\"args\":{\"id\":" << event.arg << "}}";
+            break;
+        case TraceEventKind::RunEnd:
+            writeHead(out, "task", "E", tid, event);
+            out << "}";
+            break;
+        case TraceEventKind::Reject:
+        case TraceEventKind::Cancel:
+            // The task leaves the queue without running
+            writeHead(out, "queued", "e", tid, event);
+            out << ",\"cat\":\"task\",\"id\":" << event.arg << "}";
+            writeHead(out, event.kind == TraceEventKind::Reject ? "reject" : "cancel", "i", tid, event);
+            out << ",\"s\":\"t\",\"args\":{\"id\":" << event.arg << "}}";
+            break;
+        case TraceEventKind::WaitBegin:
+            writeHead(out, "wait for thread", "B", tid, event);
+            out << "}";
+            break;
+        case TraceEventKind::WaitEnd:
+            writeHead(out, "wait for thread", "E", tid, event);
+            out << "}";
+            break;
+        case TraceEventKind::ThreadSpawn:
+            writeHead(out, "thread spawn", "i", tid, event);
+            out << ",\"s\":\"p\",\"args\":{\"thread\":" << event.arg << "}}";
+            break;
+        case TraceEventKind::ThreadExpiry:
+            writeHead(out, "thread expiry", "i", tid, event);
+            out << ",\"s\":\"p\",\"args\":{\"threads\":" << event.arg << "}}";
+            break;
+        }
+    }
+
+    /**
+     * @brief Writes the fields shared by every event, leaving the object open.
+     * @param out Destination of the event
+     * @param name Name of the event
+     * @param phase Chrome trace phase of the event
+     * @param tid Number of the thread that recorded it
+     * @param event The event
+     */
+    static void writeHead(std::ostream& out, const char* name, const char* phase, uint64_t tid, const TraceEvent& event) {
+        // Timestamps are in microseconds, written with their nanoseconds without going through a float
+        char fraction[4] = {static_cast<char>('0' + event.time / 100 % 10), static_cast<char>('0' + event.time / 10 % 10),
+                            static_cast<char>('0' + event.time % 10), '\0'};
+        out << ",\n{\"name\":\"" << name << "\",\"ph\":\"" << phase << "\",\"pid\":1,\"tid\":" << tid
+            << ",\"ts\":" << event.time / 1000 << "." << fraction;
+    }
+
+    const void* owner;                              // The pool the tracer belongs to
+    const uint64_t serial;                          // Identifies the tracer in the threads' LocalRings
+    const std::chrono::steady_clock::time_point origin; // Time zero of the trace
+    std::mutex ringsMutex;                          // Protects rings and nbRings
+    std::vector<std::shared_ptr<TraceRing>> rings;  // Rings of the threads that recorded events, alive or orphaned
+    uint64_t nbRings = 0;                           // Rings created so far, gives their tid
+    std::mutex drainMutex;                          // Makes the writer the single consumer of the rings
+    std::atomic<uint64_t> dropped{0};               // Events lost to a full ring
+};
+
+#endif // TASKTRACE_H
@@ -7,16 +7,25 @@
  */
 
 #include "threadInfo.h"
-#include "threadpool.h"
+#include "cputopology.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
 
 /**
  * @brief Constructor for ThreadInfo
- * @param id A unique string identifier for the thread
+ * @param id Number of the thread, unique within its pool
  * @param pool A pointer to the thread pool managing this thread
- * @param ms Idle timeout for the thread
+ * @param loop The task execution loop of the pool
+ * @param localTasks The local task deque of this thread, owned by the pool
+ * @param localSlot Index of localTasks in the pool
  */
-ThreadInfo::ThreadInfo(std::string id, ThreadPool* p, std::chrono::milliseconds ms)
-    : id(std::move(id)), pool(p), idleTimeout(ms), isRunning(false) {}
+ThreadInfo::ThreadInfo(size_t id, void* p, WorkerLoop loop, LocalTaskDeque* localTasks, size_t localSlot)
+    : id(id), pool(p), loop(loop), localTasks(localTasks), localSlot(localSlot), isRunning(false),
+      state(State::Busy) {}
+
+thread_local ThreadInfo* ThreadInfo::currentThread = nullptr;
 
 /**
  * @brief Destructor for ThreadInfo
@@ -39,6 +48,22 @@ void ThreadInfo::start() {
     });
 }
 
+/**
+ * @brief Returns the number of the thread.
+ * @return The number given by the pool.
+ */
+size_t ThreadInfo::getId() const {
+    return id;
+}
+
+/**
+ * @brief Returns the name of the thread.
+ * @return "Thread-" followed by its number.
+ */
+std::string ThreadInfo::getName() const {
+    return "Thread-" + std::to_string(id);
+}
+
 /**
  * @brief Checks if the thread is currently running.
  * @return True if the thread is running, false otherwise.
@@ -48,28 +73,203 @@ bool ThreadInfo::isThreadRunning() const {
 }
 
 /**
- * @brief The main worker task for the thread.
- * Continuously fetches and executes tasks from the thread pool.
+ * @brief Returns the current life cycle state of the thread.
+ * @return The state last recorded for this thread.
  */
-void ThreadInfo::workerTask() {
-    auto lastWorkTime = std::chrono::steady_clock::now(); // Last time a task was executed
+ThreadInfo::State ThreadInfo::getState() const {
+    return state;
+}
+
+/**
+ * @brief Records a new life cycle state.
+ * @param newState The state the thread is entering.
+ */
+void ThreadInfo::setState(State newState) {
+    state = newState;
+}
+
+/**
+ * @brief Returns the thread pool managing this thread.
+ * @return A pointer to the parent thread pool.
+ */
+void* ThreadInfo::getPool() const {
+    return pool;
+}
+
+/**
+ * @brief Returns the local task deque of this thread.
+ * @return A pointer to the deque, null if the thread has none.
+ */
+LocalTaskDeque* ThreadInfo::getLocalTasks() const {
+    return localTasks;
+}
 
-    while (isRunning) {
-        // Fetch and execute a task from the thread pool
-        didWork = pool->taskRunner();
+/**
+ * @brief Returns the index of the local task deque in the pool.
+ * @return The slot index.
+ */
+size_t ThreadInfo::getLocalSlot() const {
+    return localSlot;
+}
 
-        auto now = std::chrono::steady_clock::now();
+/**
+ * @brief Sets the CPUs the thread will be pinned to.
+ * @param cpus The CPUs the thread may run on, empty to leave it unpinned
+ */
+void ThreadInfo::setAffinity(std::vector<int> cpus) {
+    affinity = std::move(cpus);
+}
 
-        // Exit if the thread has been idle for too long
-        if (std::chrono::duration_cast<std::chrono::milliseconds>(now - lastWorkTime) >= idleTimeout && !didWork) {
-            isRunning = false;
-            break;
-        }
+/**
+ * @brief Returns the number of spin iterations the thread does before yielding.
+ * @return The current spin budget.
+ */
+unsigned ThreadInfo::getSpinBudget() const {
+    return spinBudget;
+}
 
-        // Update the last work time if a task was executed
-        if (didWork)
-            lastWorkTime = std::chrono::steady_clock::now();
+/**
+ * @brief Sets the number of spin iterations the thread does before yielding.
+ * @param budget The new spin budget
+ */
+void ThreadInfo::setSpinBudget(unsigned budget) {
+    spinBudget = budget;
+}
 
-        didWork = false; // Reset the work flag
+/**
+ * @brief Returns the time the thread last parked.
+ * @return The time recorded by setIdleSince().
+ */
+std::chrono::steady_clock::time_point ThreadInfo::getIdleSince() const {
+    return idleSince;
+}
+
+/**
+ * @brief Records the time the thread parks.
+ * @param since The time the thread became idle
+ */
+void ThreadInfo::setIdleSince(std::chrono::steady_clock::time_point since) {
+    idleSince = since;
+}
+
+/**
+ * @brief Records the task the thread is running.
+ * @param taskId Number of the task, 0 once it returned
+ * @param task The task, null once it returned
+ */
+void ThreadInfo::setCurrentTask(uint64_t taskId, Runnable* task) {
+    currentTaskId = taskId;
+    currentTask = task;
+}
+
+/**
+ * @brief Returns the number of the task the thread is running.
+ * @return The number of the task, 0 between two tasks.
+ */
+uint64_t ThreadInfo::getCurrentTaskId() const {
+    return currentTaskId;
+}
+
+/**
+ * @brief Returns the task the thread is running.
+ * @return The task, null between two tasks.
+ */
+Runnable* ThreadInfo::getCurrentTask() const {
+    return currentTask;
+}
+
+/**
+ * @brief Records the start of a task.
+ */
+void ThreadInfo::beginTask() {
+    taskSequence.store(taskSequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Records the end of a task.
+ */
+void ThreadInfo::endTask() {
+    taskSequence.store(taskSequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Returns the sequence number of the thread's tasks.
+ * @return A number that is odd while a task runs.
+ */
+uint64_t ThreadInfo::getTaskSequence() const {
+    return taskSequence.load(std::memory_order_relaxed);
+}
+
+/**
+ * @brief Returns the CPU time the thread consumed.
+ * @return The CPU time in nanoseconds, or NoCpuTime.
+ */
+uint64_t ThreadInfo::getCpuTime() const {
+    if (!hasCpuClock.load(std::memory_order_acquire)) {
+        return NoCpuTime;
+    }
+    timespec time{};
+    if (clock_gettime(cpuClock, &time) != 0) {
+        return NoCpuTime;
     }
+    return static_cast<uint64_t>(time.tv_sec) * 1000000000u + static_cast<uint64_t>(time.tv_nsec);
+}
+
+/**
+ * @brief Records the start of a blocking section.
+ * @return True for the outermost section.
+ */
+bool ThreadInfo::enterBlocking() {
+    unsigned depth = blockingDepth.load(std::memory_order_relaxed);
+    blockingDepth.store(depth + 1, std::memory_order_relaxed);
+    return depth == 0;
+}
+
+/**
+ * @brief Records the end of a blocking section.
+ */
+void ThreadInfo::leaveBlocking() {
+    blockingDepth.store(blockingDepth.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Checks if the thread is in a blocking section.
+ * @return True inside a blocking section.
+ */
+bool ThreadInfo::isBlocking() const {
+    return blockingDepth.load(std::memory_order_relaxed) > 0;
+}
+
+/**
+ * @brief Returns the ThreadInfo of the calling thread.
+ * @return A pointer to the ThreadInfo, null if the caller is not a worker thread.
+ */
+ThreadInfo* ThreadInfo::current() {
+    return currentThread;
+}
+
+/**
+ * @brief The main worker task for the thread.
+ * The pool's loop returns once the thread has to exit, either because it stayed idle for
+ * longer than the pool's idle timeout or because the pool is shutting down.
+ */
+void ThreadInfo::workerTask() {
+    currentThread = this;
+    if (!affinity.empty()) {
+        CpuTopology::pinCurrentThread(affinity);
+    }
+#ifdef __linux__
+    if (pthread_getcpuclockid(pthread_self(), &cpuClock) == 0) {
+        hasCpuClock.store(true, std::memory_order_release);
+    }
+#endif
+
+    if (loop) {
+        loop(pool, this);
+    }
+
+    hasCpuClock.store(false, std::memory_order_release);
+    state = State::Terminated;
+    isRunning = false;
+    currentThread = nullptr;
 }
@@ -10,27 +10,60 @@
 #define THREADINFO_H
 
 #include <pcosynchro/pcothread.h>
-#include <string>
 #include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <string>
 #include <memory>
 #include <atomic>
+#include <vector>
+
+#include "runnable.h"
+#include "workstealingdeque.h"
+#include "poolmetrics.h"
 
-// Forward declaration of the ThreadPool class to avoid circular dependency
-class ThreadPool;
+/**
+ * @brief Local task deque of a worker thread.
+ */
+using LocalTaskDeque = WorkStealingDeque<QueuedTask>;
 
 /**
  * @brief ThreadInfo class
  * Represents an individual thread in the thread pool, capable of fetching and executing tasks.
+ * Aligned on a cache line, so that the state of a worker never shares a line with the one
+ * allocated next to it.
  */
-class ThreadInfo {
+class alignas(64) ThreadInfo {
 public:
+    /**
+     * @brief Life cycle state of a worker thread.
+     * Idle and Busy are maintained by the thread pool, Terminated is set when the worker loop exits.
+     */
+    enum class State {
+        Idle,       // Parked in the pool, waiting for a task
+        Busy,       // Fetching or executing a task
+        Terminated  // Worker loop has exited
+    };
+
+    /**
+     * @brief Task execution loop of a pool, run by the thread until it has to exit.
+     * A plain function pointer, so that ThreadInfo works with every BasicThreadPool
+     * instantiation: it is called once per thread, the loop itself calls the pool directly.
+     */
+    using WorkerLoop = void (*)(void* pool, ThreadInfo* self);
+
+    static constexpr uint64_t NoCpuTime = UINT64_MAX; // Returned by getCpuTime() when the CPU time is unknown
+
     /**
      * @brief Constructor
-     * @param id A unique identifier for the thread
+     * @param id Number of the thread, unique within its pool
      * @param pool A pointer to the thread pool managing this thread
-     * @param idleTimeout The duration after which an idle thread terminates
+     * @param loop The task execution loop of the pool
+     * @param localTasks The local task deque of this thread, owned by the pool (may be null)
+     * @param localSlot Index of localTasks in the pool
      */
-    ThreadInfo(std::string id, ThreadPool* pool, std::chrono::milliseconds idleTimeout);
+    ThreadInfo(size_t id, void* pool, WorkerLoop loop = nullptr, LocalTaskDeque* localTasks = nullptr,
+               size_t localSlot = 0);
 
     /**
      * @brief Destructor
@@ -43,26 +76,182 @@ public:
      */
     void start();
 
+    /**
+     * @brief Returns the number of the thread.
+     * @return The number given by the pool, unique within it.
+     */
+    size_t getId() const;
+
+    /**
+     * @brief Returns the name of the thread, built on each call.
+     * @return "Thread-" followed by its number.
+     */
+    std::string getName() const;
+
     /**
      * @brief Checks if the thread is currently running.
      * @return True if the thread is running, false otherwise.
      */
     bool isThreadRunning() const;
 
+    /**
+     * @brief Returns the current life cycle state of the thread.
+     * @return The state last recorded for this thread.
+     */
+    State getState() const;
+
+    /**
+     * @brief Records a new life cycle state (called by the thread pool under its monitor).
+     * @param newState The state the thread is entering.
+     */
+    void setState(State newState);
+
+    /**
+     * @brief Returns the thread pool managing this thread.
+     * @return A pointer to the parent thread pool, to be compared with the pool's this.
+     */
+    void* getPool() const;
+
+    /**
+     * @brief Returns the local task deque of this thread.
+     * Tasks submitted from inside a Runnable run by this thread are pushed there.
+     * @return A pointer to the deque, null if the thread has none.
+     */
+    LocalTaskDeque* getLocalTasks() const;
+
+    /**
+     * @brief Returns the index of the local task deque in the pool.
+     * @return The slot index.
+     */
+    size_t getLocalSlot() const;
+
+    /**
+     * @brief Sets the CPUs the thread will be pinned to, must be called before start().
+     * @param cpus The CPUs the thread may run on, empty to leave it unpinned
+     */
+    void setAffinity(std::vector<int> cpus);
+
+    /**
+     * @brief Returns the number of spin iterations the thread does before yielding.
+     * Only used by the thread itself, adjusted by the pool's IdleStrategy.
+     * @return The current spin budget, 0 until the pool first sets it.
+     */
+    unsigned getSpinBudget() const;
+
+    /**
+     * @brief Sets the number of spin iterations the thread does before yielding.
+     * @param budget The new spin budget
+     */
+    void setSpinBudget(unsigned budget);
+
+    /**
+     * @brief Returns the time the thread last parked (called by the thread pool under its monitor).
+     * @return The time recorded by setIdleSince().
+     */
+    std::chrono::steady_clock::time_point getIdleSince() const;
+
+    /**
+     * @brief Records the time the thread parks (called by the thread pool under its monitor).
+     * @param since The time the thread became idle
+     */
+    void setIdleSince(std::chrono::steady_clock::time_point since);
+
+    /**
+     * @brief Records the task the thread is running (called by the thread itself).
+     * @param id Number of the task, 0 once it returned
+     * @param task The task, null once it returned
+     */
+    void setCurrentTask(uint64_t id, Runnable* task);
+
+    /**
+     * @brief Returns the number of the task the thread is running (called by the thread itself).
+     * @return The number given by the pool at submission, 0 between two tasks.
+     */
+    uint64_t getCurrentTaskId() const;
+
+    /**
+     * @brief Returns the task the thread is running (called by the thread itself).
+     * @return The task, null between two tasks.
+     */
+    Runnable* getCurrentTask() const;
+
+    /**
+     * @brief Records the start of a task (called by the thread itself).
+     */
+    void beginTask();
+
+    /**
+     * @brief Records the end of a task (called by the thread itself).
+     */
+    void endTask();
+
+    /**
+     * @brief Returns the sequence number of the thread's tasks, only counted while the pool's
+     * elastic sizing is enabled.
+     * @return A number bumped at the start and at the end of each task: odd while one runs.
+     */
+    uint64_t getTaskSequence() const;
+
+    /**
+     * @brief Returns the CPU time the thread consumed, from any thread.
+     * A thread running a task without consuming CPU time is blocked, typically on I/O.
+     * @return The CPU time in nanoseconds, NoCpuTime before the thread started, after it
+     *         exited, or if the platform cannot tell.
+     */
+    uint64_t getCpuTime() const;
+
+    /**
+     * @brief Records the start of a blocking section (called by the thread itself).
+     * @return True for the outermost section, false for a nested one.
+     */
+    bool enterBlocking();
+
+    /**
+     * @brief Records the end of a blocking section (called by the thread itself).
+     */
+    void leaveBlocking();
+
+    /**
+     * @brief Checks if the thread is in a blocking section, from any thread.
+     * @return True between the outermost enterBlocking() and its leaveBlocking().
+     */
+    bool isBlocking() const;
+
+    /**
+     * @brief Returns the ThreadInfo of the calling thread.
+     * @return A pointer to the ThreadInfo, null if the caller is not a worker thread.
+     */
+    static ThreadInfo* current();
+
 private:
     /**
-     * @brief The main task execution loop for the thread.
-     * Continuously fetches and executes tasks from the thread pool.
+     * @brief Body of the thread.
+     * Runs the pool's loop, which fetches and executes tasks until the pool tells it to exit.
      */
     void workerTask();
 
 private:
-    std::string id;                          // Unique identifier for the thread
-    ThreadPool* pool;                        // Pointer to the parent thread pool
-    bool didWork;                            // Indicates if the thread performed a task
+    size_t id;                               // Number of the thread within its pool
+    void* pool;                              // Pointer to the parent thread pool
+    WorkerLoop loop;                         // Task execution loop of the pool
+    LocalTaskDeque* localTasks;              // Local task deque, owned by the pool
+    size_t localSlot;                        // Index of localTasks in the pool
+    std::vector<int> affinity;               // CPUs the thread is pinned to, empty if unpinned
     std::unique_ptr<PcoThread> thread;       // Pointer to the thread object
-    std::chrono::milliseconds idleTimeout;   // Duration before the thread terminates if idle
-    std::atomic<bool> isRunning;             // Atomic flag indicating if the thread is running
+
+    // Written while the thread runs, on a line of their own: the fields above are only read
+    alignas(64) std::atomic<bool> isRunning; // Atomic flag indicating if the thread is running
+    std::atomic<State> state;                // Current life cycle state of the thread
+    unsigned spinBudget = 0;                 // Spin iterations before yielding, only used by the thread itself
+    std::chrono::steady_clock::time_point idleSince{}; // Time the thread last parked, under the pool's monitor
+    uint64_t currentTaskId = 0;              // Number of the running task, only used by the thread itself
+    Runnable* currentTask = nullptr;         // The running task, only used by the thread itself
+    std::atomic<uint64_t> taskSequence{0};   // Bumped by beginTask() and endTask()
+    std::atomic<unsigned> blockingDepth{0};  // Nesting depth of the blocking sections
+    std::atomic<bool> hasCpuClock{false};    // Set while cpuClock refers to the running thread
+    clockid_t cpuClock{};                    // CPU-time clock of the thread, written before hasCpuClock
+
+    static thread_local ThreadInfo* currentThread; // ThreadInfo of the calling worker thread
 };
 
 #endif // THREADINFO_H
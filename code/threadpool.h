@@ -11,63 +11,334 @@
 
 #include <algorithm>
 #include <iostream>
-#include <queue>
+#include <deque>
 #include <vector>
 #include <memory>
 #include <chrono>
 #include <string>
 #include <cassert>
 #include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <coroutine>
 
 #include <pcosynchro/pcohoaremonitor.h>
+#include <pcosynchro/pcothread.h>
 
+#include "runnable.h"   // Include the Runnable interface
+#include "functiontask.h" // Callables submitted through submit()
 #include "threadInfo.h" // Include the ThreadInfo class
+#include "taskslab.h"   // Allocator of the task objects
+#include "mpmcqueue.h"  // Lock-free ring buffer used by QueueBackend::LockFree
+#include "workstealingdeque.h" // Local task deques of the worker threads
+#include "prioritylanes.h" // Per-priority waiting queues
+#include "poolmetrics.h" // Counters and histograms returned by snapshot()
+#include "cputopology.h" // NUMA nodes used by the Placement policies
+#include "poollog.h"    // Asynchronous logging of the pool's diagnostics
+#include "coroutinetask.h" // Coroutines resumed on the pool through schedule()
+#include "timerwheel.h" // Delayed and periodic tasks of schedule() and scheduleAtFixedRate()
+#include "tasktrace.h"  // Timeline of the pool written by writeTrace()
 
 /**
- * @brief Abstract base class representing a runnable task.
- * Defines the interface for tasks that can be executed by the ThreadPool.
+ * @brief Storage used for the tasks waiting for a thread.
  */
-class Runnable {
+enum class QueueBackend {
+    Monitor,  // PriorityLanes protected by the pool's monitor, start() may block while threads are busy
+    LockFree  // Bounded MPMC ring buffers (one per priority), the monitor is only used to park/unpark threads
+};
+
+/**
+ * @brief Outcome of ThreadPool::trySubmit() and ThreadPool::submitFor().
+ */
+enum class SubmitStatus {
+    Accepted,     // The task was handed over to a thread or queued
+    QueueFull,    // No room for the task (before the deadline for submitFor()), cancelRun() was called
+    ShuttingDown  // The pool no longer accepts tasks
+};
+
+/**
+ * @brief Placement of the worker threads on the CPUs of the machine.
+ */
+enum class Placement {
+    None,        // Threads are not pinned and float over all the CPUs
+    PinCores,    // Each thread slot is pinned to one CPU, slots are interleaved across the NUMA nodes
+    SpreadNodes, // Thread slots are pinned round-robin to the CPUs of one NUMA node each
+    PerNode      // Like SpreadNodes, with one queue per node fed by startOnNode()
+};
+
+/**
+ * @brief How a worker thread out of work waits before parking on the pool's monitor.
+ * The thread first spins with pause instructions, then yields the CPU, and only then parks.
+ * A producer finding a spinning thread hands the task over to it without signaling anyone,
+ * which saves the futex wake-up and the context switch for short, frequent tasks.
+ */
+struct IdleStrategy {
+    static constexpr unsigned MinSpins = 16; // Lowest spin budget of an adaptive thread
+
+    unsigned spinLimit = 0;   // Maximum spin iterations before yielding, 0 to disable spinning
+    unsigned yieldLimit = 0;  // Calls to std::this_thread::yield() between spinning and parking
+    bool adaptive = true;     // Doubles a thread's spin budget when spinning found work, halves it otherwise
+};
+
+/**
+ * @brief Settings of the elastic sizing, which adapts the number of threads to the measured
+ * queue latency instead of creating one whenever no thread is idle.
+ * The watchdog samples the pool every samplePeriod. The limit on the number of threads grows
+ * by a quarter after growAfter samples in a row whose mean queue latency is over targetWait,
+ * and shrinks by one thread after shrinkAfter samples in a row under a quarter of targetWait
+ * with an empty queue and the workers' CPU utilization under shrinkUtilization: the gap between
+ * the two thresholds and the two durations keep bursts from creating and killing threads in
+ * turn. A worker stuck in a single task over a whole sample while consuming less than
+ * blockedUtilization of a CPU is blocked, typically on I/O, and does not count against the
+ * limit: a compensating thread may be created in its place. maxThreadCount stays a hard bound.
+ */
+struct ElasticSizing {
+    bool enabled = false;                           // Off: threads are created whenever none is idle
+    std::chrono::microseconds targetWait{1000};     // Mean queue latency above which the pool grows
+    std::chrono::milliseconds samplePeriod{20};     // Time between two samples of the watchdog
+    unsigned growAfter = 2;                         // Samples in a row over targetWait before growing
+    unsigned shrinkAfter = 50;                      // Quiet samples in a row before shrinking
+    double shrinkUtilization = 0.5;                 // Mean CPU utilization of the workers under which a sample is quiet
+    double blockedUtilization = 0.1;                // CPU utilization under which a worker stuck in a task is blocked
+};
+
+/**
+ * @brief What start() does with a task when the waiting queue is full and no thread can take it.
+ * The lock-free ring cannot give up its oldest task: with QueueBackend::LockFree, DropOldest
+ * rejects the submitted task like RejectNew.
+ */
+enum class OverflowPolicy {
+    DropOldest,         // The oldest task of the lowest lane is cancelled to make room for the new one, start() returns false
+    RejectNew,          // The submitted task is cancelled, the queued ones are kept
+    CallerRuns,         // The submitting thread runs the task inline, which slows the producer down without queuing
+    BlockWithTimeout    // The submitting thread waits for a free slot like submitFor(), the task is cancelled past the timeout
+};
+
+/**
+ * @brief Awaitable returned by ThreadPool::schedule(): the coroutine resumes on a thread of the pool.
+ * The handle is queued in a small task built in the pool's TaskSlab, through trySubmit(): from
+ * a thread of the pool it lands on the local deque, and a full queue never blocks the caller.
+ * If the pool refuses the task, the coroutine goes on inline: on QueueFull on the calling
+ * thread, as a form of backpressure; on shutdown co_await throws TaskCancelledError. A queued
+ * task cancelled by the pool also resumes the coroutine with TaskCancelledError, on the
+ * cancelling thread.
+ * @tparam Pool The BasicThreadPool instantiation
+ */
+template<typename Pool>
+class ScheduleAwaiter {
 public:
-    virtual ~Runnable() = default;
+    ScheduleAwaiter(Pool& pool, TaskPriority priority) : pool(pool), priority(priority) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    /**
+     * @brief Queues the coroutine on the pool.
+     * @param handle The suspended coroutine
+     * @return False to resume it right away because the pool refused it.
+     */
+    bool await_suspend(std::coroutine_handle<> handle) {
+        TaskPtr task = pool.template makeTask<ResumeTask>(handle, this);
+        Runnable* submitted = task.get();
+        submitting() = submitted;
+        SubmitStatus result = pool.trySubmit(std::move(task), priority);
+        submitting() = nullptr;
+        if (result == SubmitStatus::Accepted) {
+            // The coroutine may already be running elsewhere: *this must not be touched anymore
+            return true;
+        }
+        status = result;
+        return false;
+    }
 
     /**
-     * @brief Execute the task.
+     * @brief Checks how the coroutine was resumed.
+     * @throws TaskCancelledError if the pool shut down or cancelled the queued task
      */
-    virtual void run() = 0;
+    void await_resume() const {
+        if (status == SubmitStatus::ShuttingDown || cancelled) {
+            throw TaskCancelledError();
+        }
+    }
 
+private:
     /**
-     * @brief Cancel the task.
-     * Called when the task cannot be executed (e.g., due to queue overflow).
+     * @brief Task resuming the coroutine, or resuming it cancelled.
+     * Its cancelRun() or destructor only leave a mark while trySubmit() refuses it, the awaiter
+     * resuming the coroutine itself then.
      */
-    virtual void cancelRun() = 0;
+    class ResumeTask : public Runnable {
+    public:
+        ResumeTask(std::coroutine_handle<> handle, ScheduleAwaiter* awaiter) : handle(handle), awaiter(awaiter) {}
+
+        ~ResumeTask() override {
+            if (!finished) {
+                cancelRun();
+            }
+        }
+
+        void run() override {
+            finished = true;
+            handle.resume();
+        }
+
+        void cancelRun() override {
+            finished = true;
+            if (submitting() == this) {
+                return;
+            }
+            awaiter->cancelled = true;
+            handle.resume();
+        }
+
+        std::string id() override {
+            return "Coroutine";
+        }
+
+    private:
+        std::coroutine_handle<> handle;  // The suspended coroutine
+        ScheduleAwaiter* awaiter;        // Awaiter in the coroutine's frame
+        bool finished = false;           // Set once the coroutine was resumed or left to the awaiter
+    };
 
     /**
-     * @brief Get the unique identifier for the task.
-     * @return A string representing the task ID.
+     * @brief Returns the task being submitted by the calling thread.
+     * @return A reference to the slot, null outside of await_suspend().
      */
-    virtual std::string id() = 0;
+    static Runnable*& submitting() {
+        thread_local Runnable* task = nullptr;
+        return task;
+    }
+
+    Pool& pool;                                     // Pool the coroutine moves to
+    TaskPriority priority;                          // Lane of the waiting queue
+    SubmitStatus status = SubmitStatus::Accepted;   // Outcome of a refused submission
+    bool cancelled = false;                         // Set when the pool cancelled the queued task
+};
+
+/**
+ * @brief Compile-time policies of a BasicThreadPool, the behavior of ThreadPool.
+ * A policy is a struct with the same members, usually deriving from this one to only change
+ * some of them. A fixed choice removes the runtime checks of the other choices from the hot
+ * path: their branches are discarded with if constexpr.
+ */
+struct DefaultPoolPolicy {
+    static constexpr bool RuntimeBackend = true;                            // The backend is chosen by the constructor's argument
+    static constexpr QueueBackend Backend = QueueBackend::Monitor;          // The fixed backend, or the default argument
+    static constexpr bool RuntimeOverflow = true;                           // setOverflowPolicy() can change Overflow
+    static constexpr OverflowPolicy Overflow = OverflowPolicy::DropOldest;  // The fixed overflow policy, or the initial one
+    static constexpr std::chrono::milliseconds OverflowTimeout{0};          // Wait of OverflowPolicy::BlockWithTimeout
+    static constexpr bool Spinning = true;                                  // setIdleStrategy() can make idle threads spin
+    static constexpr bool Metrics = true;                                   // enableMetrics() can collect metrics
+    static constexpr bool Elastic = true;                                   // setElasticSizing() can adapt the number of threads
+    static constexpr bool Tracing = true;                                   // enableTracing() can record the timeline
+};
+
+/**
+ * @brief Policies of a pool with few threads running short tasks: lock-free queue, spinning, no metrics, elastic sizing nor tracing.
+ */
+struct LowLatencyPoolPolicy : DefaultPoolPolicy {
+    static constexpr bool RuntimeBackend = false;
+    static constexpr QueueBackend Backend = QueueBackend::LockFree;
+    static constexpr bool Metrics = false;
+    static constexpr bool Elastic = false;
+    static constexpr bool Tracing = false;
+};
+
+/**
+ * @brief Policies of a large pool running long tasks: no spinning, and queued tasks are never dropped.
+ */
+struct BatchPoolPolicy : DefaultPoolPolicy {
+    static constexpr bool RuntimeBackend = false;
+    static constexpr QueueBackend Backend = QueueBackend::Monitor;
+    static constexpr bool RuntimeOverflow = false;
+    static constexpr OverflowPolicy Overflow = OverflowPolicy::RejectNew;
+    static constexpr bool Spinning = false;
 };
 
 /**
  * @brief The ThreadPool class
  * Manages a fixed number of worker threads to execute submitted tasks concurrently.
+ * ThreadPool is the instantiation with DefaultPoolPolicy, the others fix some of its runtime
+ * choices at compile time.
+ * @tparam Policy The compile-time policies, see DefaultPoolPolicy
  */
-class ThreadPool : public PcoHoareMonitor {
+template<typename Policy = DefaultPoolPolicy>
+class BasicThreadPool : public PcoHoareMonitor {
 public:
+    /**
+     * @brief Marks a blocking section of a task, such as a disk or network call, for as long
+     * as it lives.
+     * While one is active, the pool may run one more thread than maxThreadCount, so that the
+     * tasks queued behind a blocked worker still run and the producers waiting in start() are
+     * served. The extra thread retires once idle after the section ends. Only the outermost
+     * section of a thread counts; outside of the pool's threads it does nothing.
+     */
+    class BlockingScope {
+    public:
+        /**
+         * @brief Constructor
+         * Enters the blocking section, and starts a thread for the queued tasks if none is idle.
+         * @param pool The pool running the calling task
+         */
+        explicit BlockingScope(BasicThreadPool& pool) : pool(pool) {
+            ThreadInfo* current = ThreadInfo::current();
+            if (current && current->getPool() == &pool) {
+                self = current;
+                outermost = self->enterBlocking();
+                if (outermost) {
+                    pool.beginBlocking();
+                }
+            }
+        }
+
+        BlockingScope(const BlockingScope&) = delete;
+        BlockingScope& operator=(const BlockingScope&) = delete;
+
+        /**
+         * @brief Destructor
+         * Leaves the blocking section.
+         */
+        ~BlockingScope() {
+            if (self) {
+                self->leaveBlocking();
+                if (outermost) {
+                    pool.endBlocking();
+                }
+            }
+        }
+
+    private:
+        BasicThreadPool& pool;      // The pool of the calling thread
+        ThreadInfo* self = nullptr; // The calling thread, null if it is not one of the pool's
+        bool outermost = false;     // Set if the section is not nested in another one
+    };
+
     /**
      * @brief Constructor
      * @param maxThreadCount Maximum number of worker threads in the pool
      * @param maxNbWaiting Maximum number of tasks allowed in the queue
      * @param idleTimeout Duration before idle threads terminate
-     * @throws std::invalid_argument if parameters are invalid
+     * @param backend Storage used for the waiting tasks
+     * @param waitingLimit Whether maxNbWaiting bounds all the priorities together or each one
+     * @param minThreadCount Number of core threads, which never expire through idleTimeout
+     * @param placement Placement of the worker threads on the CPUs and NUMA nodes
+     * @throws std::invalid_argument if parameters are invalid, or if backend is not the one fixed by the policy
      */
-    ThreadPool(int maxThreadCount, int maxNbWaiting, std::chrono::milliseconds idleTimeout)
+    BasicThreadPool(int maxThreadCount, int maxNbWaiting, std::chrono::milliseconds idleTimeout,
+                    QueueBackend backend = Policy::Backend, WaitingLimit waitingLimit = WaitingLimit::Global,
+                    int minThreadCount = 0, Placement placement = Placement::None)
         : maxThreadCount(maxThreadCount),
+          minThreadCount(minThreadCount),
           maxNbWaiting(maxNbWaiting),
-          idleThreads(0),
           idleTimeout(idleTimeout),
-          isShuttingDown(false) {
+          backend(backend),
+          taskSlab(sizeof(FunctionTask), static_cast<size_t>(std::max(maxThreadCount, 1)), &BasicThreadPool::slabCacheOf, this),
+          waitingTasks(this->maxNbWaiting, waitingLimit),
+          placement(placement),
+          topology(placement == Placement::None ? CpuTopology(std::vector<std::vector<int>>(1)) : CpuTopology::detect()) {
         if (maxThreadCount <= 0) {
             throw std::invalid_argument("maxThreadCount must be greater than 0");
         }
@@ -77,59 +348,240 @@ public:
         if (idleTimeout.count() < 0) {
             throw std::invalid_argument("idleTimeout must be non-negative");
         }
+        if (minThreadCount < 0 || minThreadCount > maxThreadCount) {
+            throw std::invalid_argument("minThreadCount must be between 0 and maxThreadCount");
+        }
+        if (!Policy::RuntimeBackend && backend != Policy::Backend) {
+            throw std::invalid_argument("backend is fixed by the pool's policy");
+        }
+        if (isLockFree()) {
+            // At least one slot is needed to hand a task over to a thread
+            lockFreeTasks = std::make_unique<LockFreeLanes<QueuedTask>>(
+                std::max<size_t>(this->maxNbWaiting, 1), waitingLimit);
+        }
+        localTasks = std::make_unique<LocalTaskDeque[]>(this->maxThreadCount);
+        metricsShards = std::make_unique<MetricsShard[]>(this->maxThreadCount + 1);
+        localTasksUsed.assign(this->maxThreadCount, false);
+        assignSlots();
     }
 
     /**
      * @brief Destructor
-     * Gracefully shuts down the thread pool and releases resources.
+     * Cancels the waiting tasks unless shutdown() was called before, in which case the drain
+     * is let to finish, then waits for the running tasks and joins the threads.
      */
-    ~ThreadPool() {
-        shutdown();
+    ~BasicThreadPool() {
+        if (!isShuttingDown) {
+            shutdownNow();
+        }
+        waitTermination();
+
+        // Every thread retired, joining them does not wait for any task
+        retiredThreads.clear();
+
+        // Tasks pushed while the threads were exiting
+        for (auto &item : takeQueuedTasks()) {
+            cancel(item);
+        }
     }
 
     /**
-     * @brief Fetches and executes a task from the queue.
-     * @return True if a task was executed, false otherwise.
+     * @brief Stops accepting tasks, without waiting for the threads.
+     * With drain, the queued tasks are still run: the parked threads are woken up so that
+     * every thread serves the queues until they are empty, then exits. Tasks run by the
+     * pool's threads may still push subtasks on their deque while draining. Without drain,
+     * this is shutdownNow().
+     * @param drain True to run the queued tasks, false to cancel them
      */
-    bool taskRunner() {
-        monitorIn();
+    void shutdown(bool drain = true) {
+        if (!drain) {
+            shutdownNow();
+            return;
+        }
+        beginShutdown(true);
+    }
 
-        if (isShuttingDown) {
+    /**
+     * @brief Stops accepting tasks and cancels the queued ones, without waiting for the threads.
+     * The tasks are taken out of every queue under a single monitor entry, then their
+     * cancelRun() is called outside of it. Running tasks are let to finish. Stops a drain
+     * started by shutdown().
+     * @return The number of tasks cancelled. A task popped by a thread at the same time is
+     *         cancelled by that thread and not counted.
+     */
+    size_t shutdownNow() {
+        beginShutdown(false);
+
+        std::vector<QueuedTask> cancelled = takeQueuedTasks();
+        for (auto &item : cancelled) {
+            cancel(item);
+        }
+        return cancelled.size();
+    }
+
+    /**
+     * @brief Waits for every thread to exit after shutdown() or shutdownNow().
+     * The threads exit in parallel, the timeout bounds the whole wait. Must not be called
+     * from a task of the pool, which would wait for itself.
+     * @param timeout Maximum time to wait
+     * @return True if the pool is shut down and no thread is left, false if the timeout passed.
+     */
+    template<typename Rep, typename Period>
+    bool awaitTermination(std::chrono::duration<Rep, Period> timeout) {
+        auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+        std::unique_lock<std::mutex> lock(terminationMutex);
+        return terminationCond.wait_until(lock, deadline, [this]() { return isTerminated(); });
+    }
+
+    /**
+     * @brief Fetches and executes a task.
+     * The worker's own deque is served first, then the deques of the other workers are
+     * stolen from and only then the shared queue is used. If everything is empty the
+     * calling worker spins as set by setIdleStrategy(), then parks on a condition of its own
+     * until a task is handed to it, the idle watchdog expires it or the pool shuts down.
+     * @param worker The worker thread calling this function
+     * @return True if the worker should keep running, false if it has to exit.
+     */
+    bool taskRunner(ThreadInfo* worker) {
+        // A thread started for a blocking section that ended leaves between two tasks
+        if (!worker->getLocalTasks() && hasExtraThread()) {
+            enterMonitor();
+            if (hasExtraThread()) {
+                retireThread(worker);
+                monitorOut();
+                return false;
+            }
             monitorOut();
-            return false;
         }
 
-        // If there is at least one waiting task, pop and run it outside the monitor
-        if (!waitingTasks.empty()) {
-            auto task = std::move(waitingTasks.front());
-            waitingTasks.pop();
-            monitorOut(); // Release the monitor while running a task
+        if (!isShuttingDown || isDraining) {
+            QueuedTask task;
+            if (takeLocalTask(worker, task)) {
+                runTask(std::move(task));
+                return true;
+            }
+        }
+
+        // Spin and yield for a while before parking, see IdleStrategy. Whatever showed up is
+        // taken below, through the same path as without spinning.
+        if (!isShuttingDown) {
+            spinForWork(worker);
+        }
+
+        if (isLockFree()) {
+            return lockFreeTaskRunner(worker);
+        }
+
+        enterMonitor();
 
-            try {
-                if (task) task->run();
+        while (waitingTasks.empty() && !isShuttingDown) {
+            // Work was pushed on a local deque, go and steal it
+            if (hasLocalTasks()) {
+                monitorOut();
                 return true;
-            } catch (const std::exception& e) {
-                logger() << "[ERROR] Task execution failed: " << e.what() << "\n";
-                return false;
             }
-        } else {
-            // No tasks -> the thread becomes idle
-            ++idleThreads;
+
+            // Let a producer blocked in start() know that the queue has been drained
             if (nbTasksWaitingForThreads > 0) {
                 signal(waitForThread);
+                continue;
+            }
+
+            // A zero timeout means that idle threads above the core size terminate right away,
+            // unless the elastic sizing, which replaces idleTimeout, is on
+            if (idleTimeout.count() == 0 && !elasticOn() && nbThreads > minThreadCount) {
+                retireThread(worker);
+                countExpiredThread();
+                monitorOut();
+                return false;
             }
+            if (hasExtraThread()) {
+                retireThread(worker);
+                monitorOut();
+                return false;
+            }
+
+            // No tasks -> the thread becomes idle until start(), the watchdog or shutdown() wakes it
+            ParkedThread parked{{}, worker};
+            park(parked);
+
+            // Local deques are filled without the monitor: check them once we are visible as idle
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (hasLocalTasks()) {
+                unparkSelf();
+                monitorOut();
+                return true;
+            }
+            // Signaling the watchdog hands it the monitor, it may pick us before we wait
+            if (idleThreads == 1 || minThreadCount > 0) {
+                signal(condWatchdog);
+            }
+            if (!parked.woken) {
+                wait(parked.cond);
+            }
+            worker->setState(ThreadInfo::State::Busy);
+
+            // Whoever signaled us already removed us from the idle bookkeeping
+            if (parked.expire) {
+                retireThread(worker);
+                countExpiredThread();
+                monitorOut();
+                return false;
+            }
+        }
+
+        // While draining, threads only exit once every queue is empty
+        if (isShuttingDown && (!isDraining || waitingTasks.empty())) {
+            if (isDraining && hasLocalTasks()) {
+                monitorOut();
+                return true;
+            }
+            retireThread(worker);
             monitorOut();
+            return false;
         }
-        return false;
+
+        // Pop the task and run it outside the monitor
+        auto task = waitingTasks.pop();
+        signalSlotWaiter();
+        monitorOut();
+
+        runTask(std::move(task));
+        return true;
     }
 
     /**
      * @brief Starts a runnable task.
+     * When called from a Runnable run by one of this pool's threads, the task is pushed on
+     * that thread's local deque, which is not bounded by maxNbWaiting and never blocks. Local
+     * deques are served before the waiting queue whatever the priority.
      * @param runnable The task to be executed.
+     * @param priority Lane of the waiting queue the task goes to
      * @return True if the task was successfully started, false otherwise.
      */
-    bool start(std::unique_ptr<Runnable> runnable) {
-        monitorIn();
+    bool start(std::unique_ptr<Runnable> runnable, TaskPriority priority = TaskPriority::Normal) {
+        return start(TaskPtr(runnable.release()), priority);
+    }
+
+    /**
+     * @brief Starts a task whose deleter is a TaskDeleter, typically built with makeTask().
+     * The task is destroyed through its deleter once it ran or was cancelled.
+     * @param runnable The task to be executed.
+     * @param priority Lane of the waiting queue the task goes to
+     * @return True if the task was successfully started, false otherwise.
+     */
+    bool start(TaskPtr runnable, TaskPriority priority = TaskPriority::Normal) {
+        ThreadInfo* self = ThreadInfo::current();
+        if (self && self->getPool() == this && self->getLocalTasks()) {
+            return startLocal(self, std::move(runnable));
+        }
+
+        if (isLockFree()) {
+            return lockFreeStart(std::move(runnable), priority);
+        }
+
+        enterMonitor();
 
         // If shutting down, refuse new tasks
         if (isShuttingDown || maxThreadCount < 0) {
@@ -137,29 +589,37 @@ public:
             return false;
         }
 
-        // Add this new task to the queue
-        waitingTasks.push(std::move(runnable));
+        // Room is checked before the task is queued: at most maxNbWaiting tasks wait for a thread
+        const bool hasRoom = waitingTasks.hasRoom(priority);
 
-        // If we have idle threads, wake one up
+        // Add this new task to the lane of its priority
+        waitingTasks.push(queued(std::move(runnable)), priority);
+
+        // A spinning thread will pick the task up without being signaled
+        if (claimSpinner()) {
+            monitorOut();
+            return true;
+        }
+
+        // If we have idle threads, hand the task to the most recently parked one
         if (idleThreads > 0) {
-            signal(condTaskAvailable);
+            wakeNewestIdle();
         }
         // Otherwise, if we still can create new threads, do it
-        else if (currentNbThreads() < maxThreadCount) {
+        else if (currentNbThreads() < threadCap()) {
             createThread();
         }
         // Else if we haven't exceeded the queue limit, wait to see if a thread becomes available
-        else if (waitingTasks.size() - 1 < maxNbWaiting) {
+        else if (hasRoom) {
             ++nbTasksWaitingForThreads;
+            trace(TraceEventKind::WaitBegin);
             wait(waitForThread);
+            trace(TraceEventKind::WaitEnd);
             --nbTasksWaitingForThreads;
         }
-        // Otherwise, we've exceeded our limit and remove the task
+        // Otherwise, we've exceeded our limit: the overflow policy decides
         else {
-            waitingTasks.front()->cancelRun();
-            waitingTasks.pop();
-            monitorOut();
-            return false;
+            return overflow(priority);
         }
 
         monitorOut();
@@ -167,64 +627,2084 @@ public:
     }
 
     /**
-     * @brief Returns the number of currently running threads.
-     * @return The count of running threads.
+     * @brief Submits a callable, without having to write a Runnable subclass.
+     * The callable and its arguments are stored in a FunctionTask and go through start().
+     * A task cancelled on overflow or dropped at shutdown makes the future throw
+     * TaskCancelledError, an exception thrown by the callable is rethrown by the future.
+     * @param f The callable
+     * @param args The arguments it is called with, copied or moved into the task
+     * @return A future on the value returned by the callable.
      */
-    size_t currentNbThreads() {
-        return std::count_if(threadPool.begin(), threadPool.end(),
-                             [](const auto &threadInfo) {
-                                 return threadInfo->isThreadRunning();
-                             });
+    template<typename F, typename... Args>
+    auto submit(F&& f, Args&&... args) -> TaskFuture<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> {
+        using R = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+        using Call = PackagedCall<R, std::decay_t<F>, std::decay_t<Args>...>;
+
+        auto state = std::make_shared<FutureState<R>>();
+        start(makeTask<FunctionTask>(Call(state, std::forward<F>(f), std::forward<Args>(args)...)));
+        return TaskFuture<R>(std::move(state));
     }
 
-private:
-    size_t maxThreadCount;                      // Maximum number of worker threads
-    size_t maxNbWaiting;                        // Maximum number of waiting tasks in the queue
-    size_t idleThreads;                         // Current number of idle threads
-    std::chrono::milliseconds idleTimeout;      // Duration before idle threads terminate
-    size_t nbTasksWaitingForThreads = 0;        // Number of tasks waiting for threads
-    std::queue<std::unique_ptr<Runnable>> waitingTasks; // Queue of waiting tasks
-    std::vector<std::unique_ptr<ThreadInfo>> threadPool; // Pool of worker threads
-    Condition condTaskAvailable;                // Condition for available tasks
-    Condition waitForThread;                    // Condition for waiting threads
-    bool isShuttingDown;                        // Indicates if the pool is shutting down
+    /**
+     * @brief Builds a task in the pool's slab allocator, to be given to start().
+     * Saves the global allocator a round trip per task: the block is recycled by the worker
+     * that destroys the task. Types bigger than a FunctionTask are allocated with new instead.
+     * Every task made here must be started or destroyed before the pool is.
+     * @tparam T Type of the task, derived from Runnable
+     * @param args Arguments of the constructor of T
+     * @return The task, owned by a TaskPtr.
+     */
+    template<typename T, typename... Args>
+    TaskPtr makeTask(Args&&... args) {
+        static_assert(std::is_base_of_v<Runnable, T>, "Tasks must derive from Runnable");
+        if (sizeof(T) > taskSlab.getBlockSize() || alignof(T) > alignof(std::max_align_t)) {
+            return TaskPtr(new T(std::forward<Args>(args)...));
+        }
+
+        void* block = taskSlab.allocate();
+        try {
+            return TaskPtr(new (block) T(std::forward<Args>(args)...), TaskDeleter{&taskSlab});
+        } catch (...) {
+            taskSlab.deallocate(block);
+            throw;
+        }
+    }
 
     /**
-     * @brief Creates a new worker thread in the pool.
+     * @brief Submits a task without ever blocking.
+     * Unlike start(), the task is queued without waiting for a thread to become available.
+     * @param runnable The task to be executed.
+     * @param priority Lane of the waiting queue the task goes to
+     * @return The outcome of the submission. On QueueFull, cancelRun() was called on the task.
      */
-    void createThread() {
-        static int threadCounter = 0;
-        auto threadId = "Thread-" + std::to_string(++threadCounter);
+    SubmitStatus trySubmit(std::unique_ptr<Runnable> runnable, TaskPriority priority = TaskPriority::Normal) {
+        return submitUntil(TaskPtr(runnable.release()), std::chrono::steady_clock::now(), priority);
+    }
 
-        // Create a new thread and start its execution loop
-        threadPool.emplace_back(std::make_unique<ThreadInfo>(
-            threadId,
-            this, // 'this' is the pointer to the current ThreadPool
-            idleTimeout
-        ));
-        threadPool.back()->start();
+    /**
+     * @brief trySubmit() for a task built with makeTask().
+     * @param runnable The task to be executed.
+     * @param priority Lane of the waiting queue the task goes to
+     * @return The outcome of the submission. On QueueFull, cancelRun() was called on the task.
+     */
+    SubmitStatus trySubmit(TaskPtr runnable, TaskPriority priority = TaskPriority::Normal) {
+        return submitUntil(std::move(runnable), std::chrono::steady_clock::now(), priority);
     }
 
     /**
-     * @brief Gracefully shuts down the thread pool.
+     * @brief Moves the calling coroutine to a thread of the pool: co_await pool.schedule().
+     * Only a small task holding the coroutine handle is queued, in the pool's TaskSlab, and
+     * the caller never blocks, see ScheduleAwaiter.
+     * @param priority Lane of the waiting queue the coroutine goes to
+     * @return The awaitable.
      */
-    void shutdown() {
-        isShuttingDown = true;
+    ScheduleAwaiter<BasicThreadPool> schedule(TaskPriority priority = TaskPriority::Normal) {
+        return ScheduleAwaiter<BasicThreadPool>(*this, priority);
+    }
 
-        // Wake up all threads so they can exit
-        for (auto &thread : threadPool) {
-            signal(condTaskAvailable);
-            signal(waitForThread);
+    /**
+     * @brief Starts a task once a delay elapsed, without holding a thread meanwhile.
+     * The task waits in the pool's timer wheel; once it is due, the timer thread queues it
+     * together with the other due tasks, under a single monitor entry. A due task finding no
+     * room in the queue is rejected through its cancelRun(), like with startBatch().
+     * Pending tasks are cancelled through their cancelRun() by the shutdown.
+     * @param runnable The task to be executed.
+     * @param delay Time to wait before the task is queued, rounded up to a millisecond
+     * @return The handle of the timer, to cancel it. Not valid if the pool is shutting down,
+     *         the task's cancelRun() is then called.
+     * @throws std::invalid_argument if runnable is null or delay is negative
+     */
+    ScheduledTask schedule(std::unique_ptr<Runnable> runnable, std::chrono::milliseconds delay) {
+        return schedule(TaskPtr(runnable.release()), delay);
+    }
+
+    /**
+     * @brief schedule() for a task built with makeTask().
+     * @param runnable The task to be executed.
+     * @param delay Time to wait before the task is queued, rounded up to a millisecond
+     * @return The handle of the timer, to cancel it. Not valid if the pool is shutting down,
+     *         the task's cancelRun() is then called.
+     * @throws std::invalid_argument if runnable is null or delay is negative
+     */
+    ScheduledTask schedule(TaskPtr runnable, std::chrono::milliseconds delay) {
+        if (!runnable) {
+            throw std::invalid_argument("runnable cannot be null");
+        }
+        if (delay.count() < 0) {
+            throw std::invalid_argument("delay must be non-negative");
         }
+        if (isShuttingDown) {
+            runnable->cancelRun();
+            return ScheduledTask();
+        }
+        return timers.add(std::move(runnable), delay);
+    }
 
-        // Clear all threads and join them
-        threadPool.clear();
+    /**
+     * @brief Runs a task periodically, first after one period.
+     * Each period, the timer thread queues a run of the task like schedule() does. The next
+     * deadline is armed once the run returns, at the next multiple of the period from the
+     * first deadline: runs never overlap, and a run late by more than a period skips the
+     * periods it missed. The task's cancelRun() is called once the timer is cancelled or the
+     * pool shuts down, after the last run.
+     * @param runnable The task to be executed, run() may be called many times
+     * @param period Time between two deadlines, rounded up to a millisecond
+     * @return The handle of the timer, to cancel it. Not valid if the pool is shutting down,
+     *         the task's cancelRun() is then called.
+     * @throws std::invalid_argument if runnable is null or period is not positive
+     */
+    ScheduledTask scheduleAtFixedRate(std::unique_ptr<Runnable> runnable, std::chrono::milliseconds period) {
+        if (!runnable) {
+            throw std::invalid_argument("runnable cannot be null");
+        }
+        if (period.count() <= 0) {
+            throw std::invalid_argument("period must be greater than 0");
+        }
+        if (isShuttingDown) {
+            runnable->cancelRun();
+            return ScheduledTask();
+        }
+        return timers.addPeriodic(std::move(runnable), period);
+    }
 
-        // Clear out any remaining tasks
-        while (!waitingTasks.empty()) {
-            waitingTasks.pop();
+    /**
+     * @brief Returns the number of delayed and periodic tasks waiting for their deadline.
+     * @return The count of pending timers, periodic tasks being run not included.
+     */
+    size_t nbScheduledTasks() const {
+        return timers.size();
+    }
+
+    /**
+     * @brief Submits a task, waiting at most timeout for room in the queue.
+     * @param runnable The task to be executed.
+     * @param timeout Maximum time to wait for a free slot
+     * @param priority Lane of the waiting queue the task goes to
+     * @return The outcome of the submission. On QueueFull, the deadline passed and cancelRun()
+     *         was called on the task.
+     */
+    template<typename Rep, typename Period>
+    SubmitStatus submitFor(std::unique_ptr<Runnable> runnable, std::chrono::duration<Rep, Period> timeout,
+                           TaskPriority priority = TaskPriority::Normal) {
+        return submitUntil(TaskPtr(runnable.release()), std::chrono::steady_clock::now() +
+                           std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout), priority);
+    }
+
+    /**
+     * @brief Submits a task built with makeTask(), waiting up to a deadline for room in the
+     * queue. The waiting producer is woken up by the thread that frees a slot, or by the shutdown.
+     * @param runnable The task to be executed.
+     * @param deadline Time after which the producer stops waiting for a free slot,
+     *        std::chrono::steady_clock::time_point::max() to wait as long as the pool runs
+     * @param priority Lane of the waiting queue the task goes to
+     * @return The outcome of the submission. On QueueFull, the deadline passed and cancelRun()
+     *         was called on the task.
+     */
+    SubmitStatus submitUntil(TaskPtr runnable, std::chrono::steady_clock::time_point deadline,
+                             TaskPriority priority = TaskPriority::Normal) {
+        ThreadInfo* self = ThreadInfo::current();
+        if (self && self->getPool() == this && self->getLocalTasks()) {
+            return startLocal(self, std::move(runnable)) ? SubmitStatus::Accepted : SubmitStatus::ShuttingDown;
         }
+        if (isShuttingDown) {
+            return SubmitStatus::ShuttingDown;
+        }
+        return submitQueuedUntil(queued(std::move(runnable)), deadline, priority);
     }
-};
+
+    /**
+     * @brief Checks if the pool stopped accepting tasks.
+     * @return True once shutdown() or shutdownNow() was called.
+     */
+    bool isShutdown() const {
+        return isShuttingDown;
+    }
+
+    /**
+     * @brief Starts a batch of runnable tasks under a single monitor entry.
+     * Only as many threads as the batch needs are woken up or created. Tasks that do not
+     * fit in the queue are rejected through their own cancelRun(). With the Monitor backend
+     * the caller blocks once, like start(), if some tasks had to be queued.
+     * @param begin Iterator on the first std::unique_ptr<Runnable> or TaskPtr, moved from
+     * @param end Iterator past the last task
+     * @return For each task, true if it was accepted, false otherwise.
+     */
+    template<typename Iterator>
+    std::vector<bool> startBatch(Iterator begin, Iterator end) {
+        std::vector<TaskPtr> runnables;
+        for (auto it = begin; it != end; ++it) {
+            runnables.push_back(toTaskPtr(std::move(*it)));
+        }
+        return startBatch(std::move(runnables));
+    }
+
+    /**
+     * @brief Starts a batch of runnable tasks under a single monitor entry.
+     * @param runnables The tasks to be executed
+     * @return For each task, true if it was accepted, false otherwise.
+     */
+    std::vector<bool> startBatch(std::vector<std::unique_ptr<Runnable>> runnables) {
+        return startBatch(runnables.begin(), runnables.end());
+    }
+
+    /**
+     * @brief Starts a batch of tasks built with makeTask() under a single monitor entry.
+     * The tasks that find no room go through the overflow policy, one by one and outside of
+     * the monitor. The queued tasks are never dropped for a batch: OverflowPolicy::DropOldest
+     * rejects the tasks left out like OverflowPolicy::RejectNew.
+     * @param runnables The tasks to be executed
+     * @return For each task, true if it was accepted, queued or run by the caller, false otherwise.
+     */
+    std::vector<bool> startBatch(std::vector<TaskPtr> runnables) {
+        const size_t nbTasks = runnables.size();
+        std::vector<bool> accepted(nbTasks, false);
+        if (nbTasks == 0 || (isShuttingDown && !isDraining)) {
+            return accepted;
+        }
+
+        ThreadInfo* self = ThreadInfo::current();
+        if (self && self->getPool() == this && self->getLocalTasks()) {
+            for (auto &runnable : runnables) {
+                self->getLocalTasks()->pushBottom(queued(std::move(runnable)));
+            }
+            accepted.assign(nbTasks, true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (idleThreads > 0 || nbThreads < threadCap()) {
+                enterMonitor();
+                wakeOrCreateThreads(nbTasks);
+                monitorOut();
+            }
+            return accepted;
+        }
+        if (isShuttingDown) {
+            return accepted;
+        }
+
+        // The tasks left out go through the overflow policy once the others were handed over
+        std::vector<std::pair<size_t, QueuedTask>> refused;
+        if (isLockFree()) {
+            size_t nbPushed = 0;
+            for (size_t i = 0; i < nbTasks; ++i) {
+                QueuedTask item = queued(std::move(runnables[i]));
+                if (lockFreeTasks->tryPush(item, TaskPriority::Normal)) {
+                    accepted[i] = true;
+                    ++nbPushed;
+                } else {
+                    refused.emplace_back(i, std::move(item));
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (nbPushed > 0 && (idleThreads > 0 || nbThreads < threadCap())) {
+                enterMonitor();
+                wakeOrCreateThreads(nbPushed);
+                monitorOut();
+            }
+            for (auto &[index, item] : refused) {
+                accepted[index] = overflowRefused(std::move(item), TaskPriority::Normal);
+            }
+            return accepted;
+        }
+
+        enterMonitor();
+        if (isShuttingDown) {
+            monitorOut();
+            return accepted;
+        }
+
+        // Split the batch between idle threads, new threads and free queue slots
+        size_t nbServed = idleThreads + (threadCap() > nbThreads ? threadCap() - nbThreads : 0);
+        size_t nbFree = waitingTasks.freeSlots(TaskPriority::Normal);
+        size_t nbAccepted = std::min(nbTasks, nbServed + nbFree);
+
+        for (size_t i = 0; i < nbTasks; ++i) {
+            QueuedTask item = queued(std::move(runnables[i]));
+            if (i < nbAccepted) {
+                waitingTasks.push(std::move(item), TaskPriority::Normal);
+                accepted[i] = true;
+            } else {
+                refused.emplace_back(i, std::move(item));
+            }
+        }
+
+        // Wait like start() if some of the tasks could not be handed over to a thread
+        if (wakeOrCreateThreads(nbAccepted) < nbAccepted) {
+            ++nbTasksWaitingForThreads;
+            trace(TraceEventKind::WaitBegin);
+            wait(waitForThread);
+            trace(TraceEventKind::WaitEnd);
+            --nbTasksWaitingForThreads;
+        }
+
+        // Outside of the monitor: a cancelRun() or a task run by the caller may submit again
+        monitorOut();
+        for (auto &[index, item] : refused) {
+            accepted[index] = overflowRefused(std::move(item), TaskPriority::Normal);
+        }
+        return accepted;
+    }
+
+    /**
+     * @brief Returns the number of the task the calling thread is running.
+     * The pool numbers every task at submission, without calling Runnable::id().
+     * @return The number, unique within the pool running the task, or 0 outside of a task
+     *         run by a pool's thread.
+     */
+    static uint64_t currentTaskId() {
+        ThreadInfo* self = ThreadInfo::current();
+        return self ? self->getCurrentTaskId() : 0;
+    }
+
+    /**
+     * @brief Returns the name of the task the calling thread is running, for logging or tracing.
+     * Built on each call from Runnable::id() and the task's number.
+     * @return The id() of the task followed by '#' and its number, empty outside of a task
+     *         run by a pool's thread.
+     */
+    static std::string currentTaskName() {
+        ThreadInfo* self = ThreadInfo::current();
+        if (!self || !self->getCurrentTask()) {
+            return std::string();
+        }
+        return self->getCurrentTask()->id() + "#" + std::to_string(self->getCurrentTaskId());
+    }
+
+    /**
+     * @brief Returns the number of currently running threads.
+     * @return The count of running threads.
+     */
+    size_t currentNbThreads() {
+        return nbThreads;
+    }
+
+    /**
+     * @brief Returns the maximum number of threads given to the constructor.
+     * @return The maximum number of worker threads.
+     */
+    size_t maxNbThreads() const {
+        return maxThreadCount;
+    }
+
+    /**
+     * @brief Starts a task on the queue of a NUMA node, typically the one holding its data.
+     * The threads of that node serve its queue right after their own deque; the threads of
+     * the other nodes only take the task once they ran out of work. Without Placement::PerNode
+     * the hint is ignored and the task goes through start().
+     * @param runnable The task to be executed.
+     * @param node Index of the node, below nbNodes()
+     * @return True if the task was queued, false if the pool is shutting down or the node's
+     *         queue holds maxNbWaiting tasks (cancelRun() was called).
+     * @throws std::invalid_argument if node is not a node of the machine
+     */
+    bool startOnNode(std::unique_ptr<Runnable> runnable, size_t node) {
+        return startOnNode(TaskPtr(runnable.release()), node);
+    }
+
+    /**
+     * @brief startOnNode() for a task built with makeTask().
+     * @param runnable The task to be executed.
+     * @param node Index of the node, below nbNodes()
+     * @return True if the task was queued, false otherwise.
+     * @throws std::invalid_argument if node is not a node of the machine
+     */
+    bool startOnNode(TaskPtr runnable, size_t node) {
+        if (node >= nbNodes()) {
+            throw std::invalid_argument("node must be below nbNodes()");
+        }
+        if (placement != Placement::PerNode) {
+            return start(std::move(runnable));
+        }
+        if (isShuttingDown) {
+            return false;
+        }
+
+        // The bound is checked without a lock, it may be exceeded by concurrent producers
+        QueuedTask item = queued(std::move(runnable));
+        if (nodeTasks[node].sizeApprox() >= std::max<size_t>(maxNbWaiting, 1)) {
+            reject(item);
+            return false;
+        }
+        nodeTasks[node].pushBottom(std::move(item));
+
+        // Pairs with the fence of a parking thread: either it sees the task or we see it idle
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (claimSpinner() || (idleThreads == 0 && nbThreads >= threadCap())) {
+            return true;
+        }
+        enterMonitor();
+        wakeOrCreateThreads(1);
+        monitorOut();
+        return true;
+    }
+
+    /**
+     * @brief Returns the number of NUMA nodes seen by the pool.
+     * @return The number of nodes, 1 with Placement::None.
+     */
+    size_t nbNodes() const {
+        return topology.nbNodes();
+    }
+
+    /**
+     * @brief Creates the missing core threads without waiting for tasks.
+     * Core threads are otherwise created lazily by start(), like the other threads.
+     * Once created, they park when idle and are never expired by idleTimeout.
+     * @return The number of threads created.
+     */
+    size_t prestart() {
+        enterMonitor();
+        size_t nbCreated = 0;
+        while (nbThreads < minThreadCount && !isShuttingDown) {
+            createThread();
+            ++nbCreated;
+        }
+        monitorOut();
+        return nbCreated;
+    }
+
+    /**
+     * @brief Turns the collection of metrics on or off.
+     * While disabled, the only cost left is one relaxed load per task and per monitor entry.
+     * @param enabled True to collect the metrics
+     */
+    void enableMetrics(bool enabled = true) {
+        static_assert(Policy::Metrics, "The metrics are disabled by the pool's policy");
+        metricsEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Turns the recording of the timeline on or off.
+     * Each thread records the submissions, dequeues, runs, rejections and cancellations of
+     * the tasks, its waits for a thread in start() and the creations and expiries of threads
+     * in a buffer of its own, without any lock. While disabled, the only cost left is one
+     * relaxed load per event.
+     * @param enabled True to record the timeline
+     */
+    void enableTracing(bool enabled = true) {
+        static_assert(Policy::Tracing, "The tracing is disabled by the pool's policy");
+        tracingEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Writes the events recorded since the last call as Chrome trace JSON, which
+     * Perfetto (ui.perfetto.dev) and chrome://tracing load as is.
+     * @param out Destination of the trace
+     */
+    void writeTrace(std::ostream& out) {
+        static_assert(Policy::Tracing, "The tracing is disabled by the pool's policy");
+        tracer.writeChromeTrace(out);
+    }
+
+    /**
+     * @brief Returns the number of events lost because the buffer of their thread was full.
+     * Writing the trace empties the buffers.
+     * @return The number of dropped events since the creation of the pool.
+     */
+    uint64_t nbDroppedTraceEvents() const {
+        return tracer.droppedCount();
+    }
+
+    /**
+     * @brief Sets what start() does with a task when the waiting queue is full and no thread
+     * can take it. Taken into account at the next overflow.
+     * @param policy The overflow policy, Policy::Overflow by default
+     * @param timeout Longest wait for a free slot with OverflowPolicy::BlockWithTimeout
+     * @throws std::invalid_argument if timeout is negative
+     */
+    void setOverflowPolicy(OverflowPolicy policy, std::chrono::milliseconds timeout = std::chrono::milliseconds{0}) {
+        static_assert(Policy::RuntimeOverflow, "The overflow policy is fixed by the pool's policy");
+        if (timeout.count() < 0) {
+            throw std::invalid_argument("timeout must be non-negative");
+        }
+        overflowTimeout.store(timeout.count(), std::memory_order_relaxed);
+        overflowPolicy.store(policy, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Sets how the threads wait for a task before parking.
+     * Spinning trades CPU time for latency: only worth it for short and frequent tasks, on a
+     * machine with more cores than busy threads. Taken into account at the next wait.
+     * @param strategy The spin and yield budgets, spinning is disabled by default
+     */
+    void setIdleStrategy(IdleStrategy strategy) {
+        static_assert(Policy::Spinning, "Spinning is disabled by the pool's policy");
+        spinLimit.store(strategy.spinLimit, std::memory_order_relaxed);
+        yieldLimit.store(strategy.yieldLimit, std::memory_order_relaxed);
+        adaptiveSpin.store(strategy.adaptive, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Turns the elastic sizing on or off, see ElasticSizing.
+     * The limit starts at the current number of threads, at least minThreadCount and 1.
+     * While it is on, idleTimeout does not apply: the threads over the limit are terminated
+     * once idle, one per sample. Turned off, threads are created up to maxThreadCount again.
+     * @param sizing The settings
+     * @throws std::invalid_argument if samplePeriod or growAfter or shrinkAfter is not positive
+     */
+    void setElasticSizing(ElasticSizing sizing) {
+        static_assert(Policy::Elastic, "The elastic sizing is disabled by the pool's policy");
+        if (sizing.samplePeriod.count() <= 0 || sizing.growAfter == 0 || sizing.shrinkAfter == 0) {
+            throw std::invalid_argument("samplePeriod, growAfter and shrinkAfter must be greater than 0");
+        }
+        enterMonitor();
+        sizingSettings = sizing;
+        sizingLimit = std::max<size_t>({minThreadCount, nbThreads, 1});
+        nbBlocked = 0;
+        highSamples = 0;
+        quietSamples = 0;
+        lastSample = std::chrono::steady_clock::now();
+        sampleStart = lastSample;
+        for (size_t i = 0; i <= maxThreadCount; ++i) {
+            metricsShards[i].sizingWaitNs.store(0, std::memory_order_relaxed);
+            metricsShards[i].sizingTasks.store(0, std::memory_order_relaxed);
+        }
+        workerSamples.assign(maxThreadCount, WorkerSample());
+        elasticEnabled = sizing.enabled;
+        if (sizing.enabled) {
+            startWatchdog();
+        } else {
+            // Tasks left waiting by the limit get their threads now
+            wakeOrCreateThreads(queueDepth());
+        }
+        signal(condWatchdog);
+        monitorOut();
+        {
+            std::lock_guard<std::mutex> lock(watchdogMutex);
+            watchdogRescan = true;
+        }
+        watchdogCond.notify_all();
+    }
+
+    /**
+     * @brief Returns the limit on the number of threads set by the elastic sizing.
+     * @return The limit, compensating threads not included, or maxThreadCount while it is off.
+     */
+    size_t targetNbThreads() const {
+        return elasticOn() ? sizingLimit.load(std::memory_order_relaxed) : maxThreadCount;
+    }
+
+    /**
+     * @brief Returns the number of workers the elastic sizing found blocked at its last sample.
+     * @return The number of compensated workers, 0 while it is off.
+     */
+    size_t nbBlockedThreads() const {
+        return elasticOn() ? nbBlocked.load(std::memory_order_relaxed) : 0;
+    }
+
+    /**
+     * @brief Merges the metrics of every thread.
+     * The counters of the threads are read one after the other, so the result is not an
+     * atomic picture of the pool while tasks are running.
+     * @return The metrics collected while they were enabled, and the current gauges.
+     */
+    PoolMetrics snapshot() {
+        PoolMetrics metrics;
+        for (size_t i = 0; i <= maxThreadCount; ++i) {
+            const MetricsShard& shard = metricsShards[i];
+            metrics.tasksSubmitted += shard.tasksSubmitted.load(std::memory_order_relaxed);
+            metrics.tasksRejected += shard.tasksRejected.load(std::memory_order_relaxed);
+            metrics.tasksCancelled += shard.tasksCancelled.load(std::memory_order_relaxed);
+            metrics.tasksRun += shard.tasksRun.load(std::memory_order_relaxed);
+            metrics.tasksFailed += shard.tasksFailed.load(std::memory_order_relaxed);
+            metrics.spinSuccesses += shard.spinSuccesses.load(std::memory_order_relaxed);
+            metrics.spinFailures += shard.spinFailures.load(std::memory_order_relaxed);
+            metrics.tasksRejectedNew += shard.tasksRejectedNew.load(std::memory_order_relaxed);
+            metrics.tasksDroppedOldest += shard.tasksDroppedOldest.load(std::memory_order_relaxed);
+            metrics.tasksRunByCaller += shard.tasksRunByCaller.load(std::memory_order_relaxed);
+            metrics.tasksTimedOut += shard.tasksTimedOut.load(std::memory_order_relaxed);
+            shard.waitTime.addTo(metrics.waitTime);
+            shard.runTime.addTo(metrics.runTime);
+            shard.monitorWait.addTo(metrics.monitorWait);
+        }
+        metrics.threadsCreated = threadsCreated.load(std::memory_order_relaxed);
+        metrics.threadsExpired = threadsExpired.load(std::memory_order_relaxed);
+        metrics.nbThreads = nbThreads;
+        metrics.nbIdleThreads = idleThreads;
+
+        for (size_t i = 0; i < maxThreadCount; ++i) {
+            metrics.queueDepth += localTasks[i].sizeApprox();
+        }
+        if (nodeTasks) {
+            for (size_t node = 0; node < nbNodes(); ++node) {
+                metrics.queueDepth += nodeTasks[node].sizeApprox();
+            }
+        }
+        if (isLockFree()) {
+            metrics.queueDepth += lockFreeTasks->sizeApprox();
+        } else {
+            monitorIn();
+            metrics.queueDepth += waitingTasks.size();
+            monitorOut();
+        }
+        return metrics;
+    }
+
+private:
+    size_t maxThreadCount;                      // Maximum number of worker threads
+    size_t minThreadCount;                      // Number of core threads, exempt from idleTimeout
+    size_t maxNbWaiting;                        // Maximum number of waiting tasks in the queue
+    std::chrono::milliseconds idleTimeout;      // Duration before idle threads terminate
+    QueueBackend backend;                       // Storage used for the waiting tasks
+    TaskSlab taskSlab;                          // Allocator of the tasks, declared before the queues holding them
+    std::unique_ptr<LockFreeLanes<QueuedTask>> lockFreeTasks; // Waiting tasks with QueueBackend::LockFree
+    std::unique_ptr<LocalTaskDeque[]> localTasks; // One local deque per thread slot, stolen from by idle threads
+    std::vector<bool> localTasksUsed;           // Slots of localTasks owned by a live thread, under the monitor
+    size_t nbTasksWaitingForThreads = 0;        // Number of tasks waiting for threads
+    PriorityLanes<QueuedTask> waitingTasks;        // Waiting tasks with QueueBackend::Monitor, one lane per priority
+    std::vector<std::unique_ptr<ThreadInfo>> threadPool; // Pool of live worker threads
+    std::vector<std::unique_ptr<ThreadInfo>> retiredThreads; // Exited threads waiting to be joined
+    Condition waitForThread;                    // Condition for waiting threads
+    Condition condWatchdog;                     // Condition for the watchdog, signaled when it has a new deadline
+    std::mutex terminationMutex;                // Orders the checks of awaitTermination() with notifyTermination()
+    std::condition_variable terminationCond;    // Notified when the last thread retires after the shutdown
+    std::unique_ptr<MetricsShard[]> metricsShards; // One shard per thread slot, the last one for the other threads
+    std::atomic<uint64_t> threadsCreated{0};    // Worker threads created while the metrics were enabled
+    std::atomic<uint64_t> threadsExpired{0};    // Worker threads expired while the metrics were enabled
+    std::atomic<size_t> nextThreadId{0};        // Number of the last thread created by this pool
+
+    // Placement of the threads: each local deque slot has a node, and the CPUs its thread is pinned to
+    Placement placement;                        // Placement policy given to the constructor
+    CpuTopology topology;                       // NUMA nodes of the machine, a single empty one with Placement::None
+    std::vector<size_t> slotNode;               // Node of each slot
+    std::vector<std::vector<int>> slotCpus;     // CPUs of each slot, empty when not pinned
+    std::vector<std::vector<size_t>> stealOrder; // Slots stolen from by each slot, same node first
+    std::unique_ptr<LocalTaskDeque[]> nodeTasks; // One queue per node with Placement::PerNode
+
+    /**
+     * @brief A producer of submitFor() waiting for a free queue slot.
+     * Lives on the producer's stack while it is registered in slotWaiters.
+     */
+    struct SlotWaiter {
+        Condition cond;                                   // Signaled when a slot frees up or the deadline passes
+        std::chrono::steady_clock::time_point deadline;  // Time at which the producer gives up
+    };
+
+    /**
+     * @brief An idle worker parked in the monitor.
+     * Lives on the worker's stack while it is registered in parkedThreads, each worker waits on
+     * its own condition so that the pool picks which one it wakes up.
+     */
+    struct ParkedThread {
+        Condition cond;                                   // Signaled to hand the thread a task, expire it or shut it down
+        ThreadInfo* worker;                               // The parked thread, its park time in ThreadInfo::getIdleSince()
+        bool expire = false;                              // Set when the thread is woken up to terminate
+        bool woken = false;                               // Set when the thread is taken out of parkedThreads
+    };
+
+    // Watchdog: a Hoare condition cannot be waited on with a timeout, so a single thread per
+    // pool expires the idle thread parked for the longest time and the producers of submitFor()
+    // whose deadline passed.
+    std::deque<ParkedThread*> parkedThreads;    // Idle threads, oldest first: tasks go to the back, expiries take the front
+    std::deque<SlotWaiter*> slotWaiters;        // Producers waiting for a free slot, in arrival order
+    std::unique_ptr<PcoThread> watchdog;        // Thread handling the idle timeout and submitFor() deadlines
+    std::mutex watchdogMutex;                   // Protects watchdogStop and watchdogRescan, used for the timed sleep only
+    std::condition_variable watchdogCond;       // Interrupts the watchdog's timed sleep
+    bool watchdogStop = false;                  // Set by beginShutdown() to end the watchdog's timed sleep
+    bool watchdogRescan = false;                // Set when a deadline earlier than the current sleep was added
+    /**
+     * @brief What the elastic sizing saw of a worker at its last sample.
+     */
+    struct WorkerSample {
+        const ThreadInfo* thread = nullptr; // The worker of the slot then, null before its first sample
+        uint64_t sequence = 0;              // Its task sequence
+        uint64_t cpu = ThreadInfo::NoCpuTime; // Its CPU time
+    };
+
+    // Elastic sizing, run by the watchdog under the monitor
+    ElasticSizing sizingSettings;               // Settings given to setElasticSizing()
+    std::vector<WorkerSample> workerSamples;    // Last sample of each slot
+    std::chrono::steady_clock::time_point lastSample; // Time of the last sample, the next one is due samplePeriod after
+    std::chrono::steady_clock::time_point sampleStart; // Start of the period measured by the next sample
+    unsigned highSamples = 0;                   // Samples in a row over targetWait
+    unsigned quietSamples = 0;                  // Quiet samples in a row
+    TaskTracer tracer{this};                    // Timeline recorded while the tracing is enabled
+
+    TimerQueue timers{[this](std::vector<TaskPtr>&& tasks) {
+        dispatchTimers(std::move(tasks));
+    }};                                         // Tasks of schedule() and scheduleAtFixedRate(), stopped by beginShutdown()
+
+    // Atomics read or written without the monitor, away from the fields above and grouped by
+    // writer on their own cache lines: a producer bumping a counter does not invalidate the
+    // line the workers poll, and the reverse. The flags are read by every submission and
+    // written a handful of times, so they share a line that stays in every core's cache.
+    alignas(64) std::atomic<bool> isShuttingDown{false}; // Indicates if the pool is shutting down
+    std::atomic<bool> isDraining{false};        // Set by shutdown(true): threads run the queued tasks before exiting
+    std::atomic<bool> metricsEnabled{false};    // Set by enableMetrics()
+    std::atomic<bool> tracingEnabled{false};    // Set by enableTracing()
+    std::atomic<OverflowPolicy> overflowPolicy{Policy::Overflow}; // Set by setOverflowPolicy()
+    std::atomic<int64_t> overflowTimeout{Policy::OverflowTimeout.count()}; // Timeout of OverflowPolicy::BlockWithTimeout, in milliseconds
+    std::atomic<unsigned> spinLimit{0};         // IdleStrategy::spinLimit
+    std::atomic<unsigned> yieldLimit{0};        // IdleStrategy::yieldLimit
+    std::atomic<bool> adaptiveSpin{true};       // IdleStrategy::adaptive
+    std::atomic<bool> elasticEnabled{false};    // ElasticSizing::enabled
+    std::atomic<size_t> sizingLimit{0};         // Limit of the elastic sizing, written by the watchdog
+    std::atomic<size_t> nbBlocked{0};           // Blocked workers found by the last sample, written by the watchdog
+    alignas(64) std::atomic<size_t> idleThreads{0}; // Current number of idle threads, written by the workers under the monitor
+    alignas(64) std::atomic<size_t> nbSpinning{0};  // Spinning threads not claimed by a producer yet, written by both sides
+    alignas(64) std::atomic<size_t> nbThreads{0};   // Threads created and not retired yet, written under the monitor
+    alignas(64) std::atomic<size_t> nbSlotWaiters{0}; // Size of slotWaiters, written by the producers of submitFor()
+    alignas(64) std::atomic<size_t> nbBlockingScopes{0}; // Workers in a BlockingScope, written by them
+
+    /**
+     * @brief Computes the node, the CPUs and the steal order of each thread slot.
+     */
+    void assignSlots() {
+        slotNode.assign(maxThreadCount, 0);
+        slotCpus.assign(maxThreadCount, {});
+        if (placement == Placement::PinCores) {
+            std::vector<int> cpus = topology.interleavedCpus();
+            for (size_t slot = 0; slot < maxThreadCount; ++slot) {
+                int cpu = cpus[slot % cpus.size()];
+                slotCpus[slot] = {cpu};
+                slotNode[slot] = topology.nodeOf(cpu);
+            }
+        } else if (placement != Placement::None) {
+            for (size_t slot = 0; slot < maxThreadCount; ++slot) {
+                slotNode[slot] = slot % topology.nbNodes();
+                slotCpus[slot] = topology.cpusOf(slotNode[slot]);
+            }
+        }
+        if (placement == Placement::PerNode) {
+            nodeTasks = std::make_unique<LocalTaskDeque[]>(topology.nbNodes());
+        }
+
+        // Victims of each slot: the slots of its node first, both groups starting right after it
+        // so that thieves spread over the victims
+        stealOrder.assign(maxThreadCount, {});
+        for (size_t slot = 0; slot < maxThreadCount; ++slot) {
+            for (int sameNode = 1; sameNode >= 0; --sameNode) {
+                for (size_t i = 1; i < maxThreadCount; ++i) {
+                    size_t victim = (slot + i) % maxThreadCount;
+                    if ((slotNode[victim] == slotNode[slot]) == static_cast<bool>(sameNode)) {
+                        stealOrder[slot].push_back(victim);
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Gives the slab cache of the calling thread: the one of its local deque slot.
+     * @param pool The pool owning the slab
+     * @return The slot of the caller if it is one of the pool's threads, TaskSlab::NoCache otherwise.
+     */
+    static size_t slabCacheOf(const void* pool) {
+        ThreadInfo* self = ThreadInfo::current();
+        if (self && self->getPool() == pool && self->getLocalTasks()) {
+            return self->getLocalSlot();
+        }
+        return TaskSlab::NoCache;
+    }
+
+    /**
+     * @brief Converts a task to the pointer type stored by the pool.
+     * @param runnable The task
+     * @return The same task, owned by a TaskPtr.
+     */
+    static TaskPtr toTaskPtr(std::unique_ptr<Runnable> runnable) {
+        return TaskPtr(runnable.release());
+    }
+
+    static TaskPtr toTaskPtr(TaskPtr runnable) {
+        return runnable;
+    }
+
+    /**
+     * @brief Returns the metrics shard of the calling thread.
+     * @return The shard of its slot if it is one of the pool's threads, the shared one otherwise.
+     */
+    MetricsShard& currentShard() {
+        size_t slot = slabCacheOf(this);
+        return metricsShards[slot == TaskSlab::NoCache ? maxThreadCount : slot];
+    }
+
+    /**
+     * @brief Checks if the waiting tasks go through the lock-free ring, a constant unless
+     * the policy leaves the backend to the constructor.
+     * @return True with QueueBackend::LockFree.
+     */
+    bool isLockFree() const {
+        if constexpr (Policy::RuntimeBackend) {
+            return backend == QueueBackend::LockFree;
+        } else {
+            return Policy::Backend == QueueBackend::LockFree;
+        }
+    }
+
+    /**
+     * @brief Checks if the elastic sizing is on, always false if the policy disables it.
+     * @return True after setElasticSizing() with enabled.
+     */
+    bool elasticOn() const {
+        if constexpr (Policy::Elastic) {
+            return elasticEnabled.load(std::memory_order_relaxed);
+        } else {
+            return false;
+        }
+    }
+
+    /**
+     * @brief Returns the overflow policy, a constant unless the policy lets setOverflowPolicy()
+     * change it.
+     * @return The policy applied at the next overflow.
+     */
+    OverflowPolicy overflowMode() const {
+        if constexpr (Policy::RuntimeOverflow) {
+            return overflowPolicy.load(std::memory_order_relaxed);
+        } else {
+            return Policy::Overflow;
+        }
+    }
+
+    /**
+     * @brief Returns the wait of OverflowPolicy::BlockWithTimeout, a constant unless the
+     * policy lets setOverflowPolicy() change it.
+     * @return The longest wait for a free slot.
+     */
+    std::chrono::milliseconds overflowWait() const {
+        if constexpr (Policy::RuntimeOverflow) {
+            return std::chrono::milliseconds(overflowTimeout.load(std::memory_order_relaxed));
+        } else {
+            return Policy::OverflowTimeout;
+        }
+    }
+
+    /**
+     * @brief Returns the number of threads up to which new threads may be created.
+     * @return maxThreadCount, or with the elastic sizing its limit plus the blocked workers,
+     *         plus the active blocking sections.
+     */
+    size_t threadCap() const {
+        size_t blocking = nbBlockingScopes.load(std::memory_order_relaxed);
+        if (!elasticOn()) {
+            return maxThreadCount + blocking;
+        }
+        return std::min(maxThreadCount, sizingLimit.load(std::memory_order_relaxed) +
+                                        nbBlocked.load(std::memory_order_relaxed)) + blocking;
+    }
+
+    /**
+     * @brief Checks if the pool runs more threads than the blocking sections allow for.
+     * @return True if an extra thread started for a blocking section that ended may retire.
+     */
+    bool hasExtraThread() const {
+        return nbThreads > maxThreadCount + nbBlockingScopes.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Start of the outermost BlockingScope of a worker: one more thread may run, and
+     * it is created right away if tasks are waiting and no thread is idle.
+     */
+    void beginBlocking() {
+        nbBlockingScopes.fetch_add(1);
+        enterMonitor();
+        if (!isShuttingDown && (queueDepth() > 0 || nbTasksWaitingForThreads > 0)) {
+            wakeOrCreateThreads(1);
+        }
+        monitorOut();
+    }
+
+    /**
+     * @brief End of the outermost BlockingScope of a worker. The extra thread retires the
+     * next time it runs out of work.
+     */
+    void endBlocking() {
+        nbBlockingScopes.fetch_sub(1);
+    }
+
+    /**
+     * @brief Checks if the metrics are collected, always false if the policy disables them.
+     * @return True after enableMetrics().
+     */
+    bool metricsOn() const {
+        if constexpr (Policy::Metrics) {
+            return metricsEnabled.load(std::memory_order_relaxed);
+        } else {
+            return false;
+        }
+    }
+
+    /**
+     * @brief Task execution loop of the worker threads, given to their ThreadInfo.
+     * taskRunner() blocks while the pool has nothing to do, so the loop only turns once per
+     * executed task.
+     * @param pool The pool, as a BasicThreadPool of this policy
+     * @param self The calling thread
+     */
+    static void workerLoop(void* pool, ThreadInfo* self) {
+        auto* owner = static_cast<BasicThreadPool*>(pool);
+        while (self->isThreadRunning() && owner->taskRunner(self)) {
+        }
+    }
+
+    /**
+     * @brief Numbers a submitted task, counts it and stamps it with its queuing time if the
+     * metrics are enabled.
+     * @param runnable The task about to be queued
+     * @return The task, ready to be queued.
+     */
+    QueuedTask queued(TaskPtr runnable) {
+        QueuedTask item{std::move(runnable), {}, nextTaskId()};
+        if (metricsOn()) {
+            item.enqueuedAt = std::chrono::steady_clock::now();
+            currentShard().tasksSubmitted.fetch_add(1, std::memory_order_relaxed);
+        } else if (elasticOn()) {
+            item.enqueuedAt = std::chrono::steady_clock::now();
+        }
+        trace(TraceEventKind::Submit, item.id);
+        return item;
+    }
+
+    /**
+     * @brief Queues the tasks of the timers that became due, called by the timer thread.
+     * Like startBatch() under a single monitor entry, but without ever waiting: the tasks
+     * that find no thread nor free slot are rejected, once the monitor is released.
+     * @param tasks The due tasks, in deadline order
+     */
+    void dispatchTimers(std::vector<TaskPtr>&& tasks) {
+        std::vector<QueuedTask> rejected;
+        size_t nbQueued = 0;
+
+        if (isLockFree()) {
+            for (auto &task : tasks) {
+                QueuedTask item = queued(std::move(task));
+                if (!isShuttingDown && lockFreeTasks->tryPush(item, TaskPriority::Normal)) {
+                    ++nbQueued;
+                } else {
+                    rejected.push_back(std::move(item));
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (nbQueued > 0 && (idleThreads > 0 || nbThreads < threadCap())) {
+                enterMonitor();
+                wakeOrCreateThreads(nbQueued);
+                monitorOut();
+            }
+        } else {
+            enterMonitor();
+            size_t nbRoom = 0;
+            if (!isShuttingDown) {
+                nbRoom = idleThreads + (threadCap() > nbThreads ? threadCap() - nbThreads : 0) +
+                         waitingTasks.freeSlots(TaskPriority::Normal);
+            }
+            for (auto &task : tasks) {
+                QueuedTask item = queued(std::move(task));
+                if (nbQueued < nbRoom) {
+                    waitingTasks.push(std::move(item), TaskPriority::Normal);
+                    ++nbQueued;
+                } else {
+                    rejected.push_back(std::move(item));
+                }
+            }
+            wakeOrCreateThreads(nbQueued);
+            monitorOut();
+        }
+
+        for (auto &item : rejected) {
+            reject(item);
+        }
+    }
+
+    /**
+     * @brief Applies the overflow policy in start(), to the task just queued (under the
+     * monitor, which is released). The task rejected or run inline is handled outside of it.
+     * @param priority Lane of the task that overflowed the queue
+     * @return True if the submitted task was queued or run, false otherwise.
+     */
+    bool overflow(TaskPriority priority) {
+        OverflowPolicy policy = overflowMode();
+        QueuedTask item = policy == OverflowPolicy::DropOldest ? waitingTasks.popOverflow(priority)
+                                                               : waitingTasks.popNewest(priority);
+        monitorOut();
+
+        switch (policy) {
+        case OverflowPolicy::DropOldest:
+            countOverflow(&MetricsShard::tasksDroppedOldest);
+            reject(item);
+            return false;
+        case OverflowPolicy::RejectNew:
+            countOverflow(&MetricsShard::tasksRejectedNew);
+            reject(item);
+            return false;
+        default:
+            return overflowFromCaller(std::move(item), priority, policy);
+        }
+    }
+
+    /**
+     * @brief Applies the overflow policy to a task refused by the lock-free ring, or left out
+     * of a batch, outside of the monitor. No queued task is dropped in their place:
+     * OverflowPolicy::DropOldest rejects the refused task like OverflowPolicy::RejectNew.
+     * @param item The refused task
+     * @param priority Lane of the task
+     * @return True if the task was queued or run, false otherwise.
+     */
+    bool overflowRefused(QueuedTask item, TaskPriority priority) {
+        OverflowPolicy policy = overflowMode();
+        if (policy == OverflowPolicy::DropOldest || policy == OverflowPolicy::RejectNew) {
+            countOverflow(&MetricsShard::tasksRejectedNew);
+            reject(item);
+            return false;
+        }
+        return overflowFromCaller(std::move(item), priority, policy);
+    }
+
+    /**
+     * @brief OverflowPolicy::CallerRuns and OverflowPolicy::BlockWithTimeout, outside of the monitor.
+     * @param item The task that found no room
+     * @param priority Lane of the task
+     * @param policy One of the two policies
+     * @return True if the task was run or queued, false if it was rejected or the pool shut down.
+     */
+    bool overflowFromCaller(QueuedTask item, TaskPriority priority, OverflowPolicy policy) {
+        if (policy == OverflowPolicy::CallerRuns) {
+            countOverflow(&MetricsShard::tasksRunByCaller);
+            runTask(std::move(item));
+            return true;
+        }
+        auto deadline = std::chrono::steady_clock::now() + overflowWait();
+        SubmitStatus status = submitQueuedUntil(std::move(item), deadline, priority, true);
+        if (status == SubmitStatus::QueueFull) {
+            countOverflow(&MetricsShard::tasksTimedOut);
+        }
+        return status == SubmitStatus::Accepted;
+    }
+
+    /**
+     * @brief Counts an overflow in the counter of its policy, if the metrics are enabled.
+     * @param counter The counter of the policy in the MetricsShard
+     */
+    void countOverflow(std::atomic<uint64_t> MetricsShard::*counter) {
+        if (metricsOn()) {
+            (currentShard().*counter).fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Hands out a task number, from a counter of the calling thread's shard: only the
+     * threads outside of the pool share one. The shard index fills the low part of the
+     * number, so that the numbers of the shards never collide.
+     * @return A number unique within the pool, never 0.
+     */
+    uint64_t nextTaskId() {
+        size_t slot = slabCacheOf(this);
+        size_t shard = slot == TaskSlab::NoCache ? maxThreadCount : slot;
+        uint64_t count = metricsShards[shard].nextTaskId.fetch_add(1, std::memory_order_relaxed);
+        return count * (maxThreadCount + 1) + shard + 1;
+    }
+
+    /**
+     * @brief Rejects a task that found no room: calls its cancelRun() and counts it.
+     * @param item The rejected task
+     */
+    void reject(const QueuedTask& item) {
+        if (metricsOn()) {
+            currentShard().tasksRejected.fetch_add(1, std::memory_order_relaxed);
+        }
+        trace(TraceEventKind::Reject, item.id);
+        item.task->cancelRun();
+    }
+
+    /**
+     * @brief Cancels a task abandoned by a shutdown: calls its cancelRun() and counts it.
+     * @param item The abandoned task
+     */
+    void cancel(const QueuedTask& item) {
+        if (metricsOn()) {
+            currentShard().tasksCancelled.fetch_add(1, std::memory_order_relaxed);
+        }
+        trace(TraceEventKind::Cancel, item.id);
+        item.task->cancelRun();
+    }
+
+    /**
+     * @brief Counts a thread terminated by idleTimeout or the elastic sizing, once it left
+     * nbThreads (under the monitor).
+     */
+    void countExpiredThread() {
+        if (metricsOn()) {
+            threadsExpired.fetch_add(1, std::memory_order_relaxed);
+        }
+        trace(TraceEventKind::ThreadExpiry, nbThreads);
+    }
+
+    /**
+     * @brief Checks if the timeline is recorded, always false if the policy disables it.
+     * @return True after enableTracing().
+     */
+    bool tracingOn() const {
+        if constexpr (Policy::Tracing) {
+            return tracingEnabled.load(std::memory_order_relaxed);
+        } else {
+            return false;
+        }
+    }
+
+    /**
+     * @brief Records an event of the timeline if the tracing is enabled.
+     * @param kind What happened
+     * @param arg Depends on the kind, see TraceEventKind
+     */
+    void trace(TraceEventKind kind, uint64_t arg = 0) {
+        if (tracingOn()) {
+            tracer.record(kind, arg);
+        }
+    }
+
+    /**
+     * @brief Enters the monitor, measuring the time it takes if the metrics are enabled.
+     */
+    void enterMonitor() {
+        if (!metricsOn()) {
+            monitorIn();
+            return;
+        }
+        auto begin = std::chrono::steady_clock::now();
+        monitorIn();
+        currentShard().monitorWait.record(std::chrono::steady_clock::now() - begin);
+    }
+
+    /**
+     * @brief Creates a new worker thread in the pool.
+     */
+    void createThread() {
+        size_t threadId = nextThreadId.fetch_add(1, std::memory_order_relaxed) + 1;
+
+        // The watchdog is only needed once a thread can become idle
+        if (idleTimeout.count() > 0) {
+            startWatchdog();
+        }
+
+        // Join the threads that retired since the last creation. They left the monitor
+        // for good when they retired, so this cannot wait on us.
+        retiredThreads.clear();
+
+        // Give the thread a free local deque
+        size_t slot = 0;
+        while (slot < maxThreadCount && localTasksUsed[slot]) {
+            ++slot;
+        }
+        LocalTaskDeque* deque = nullptr;
+        if (slot < maxThreadCount) {
+            localTasksUsed[slot] = true;
+            deque = &localTasks[slot];
+        }
+
+        // Create a new thread and start its execution loop
+        threadPool.emplace_back(std::make_unique<ThreadInfo>(
+            threadId,
+            this, // 'this' is the pointer to the current ThreadPool
+            &BasicThreadPool::workerLoop,
+            deque,
+            slot
+        ));
+        if (deque) {
+            threadPool.back()->setAffinity(slotCpus[slot]);
+        }
+        threadPool.back()->start();
+        ++nbThreads;
+        if (metricsOn()) {
+            threadsCreated.fetch_add(1, std::memory_order_relaxed);
+        }
+        trace(TraceEventKind::ThreadSpawn, threadId);
+    }
+
+    /**
+     * @brief Removes the calling thread from the pool before it exits (under the monitor).
+     * @param worker The exiting thread
+     */
+    void retireThread(ThreadInfo* worker) {
+        --nbThreads;
+        releaseThread(worker);
+    }
+
+    /**
+     * @brief Frees the resources of a thread that already left nbThreads (under the monitor).
+     * Its local deque is empty at this point (only the owner pushes to it) and can be reused.
+     * Its ThreadInfo is moved to retiredThreads, to be joined by the watchdog or by the next
+     * createThread(), so that threadPool only ever holds live threads.
+     * @param worker The exiting thread
+     */
+    void releaseThread(ThreadInfo* worker) {
+        if (worker->getLocalTasks()) {
+            localTasksUsed[worker->getLocalSlot()] = false;
+        }
+
+        auto it = std::find_if(threadPool.begin(), threadPool.end(),
+                               [worker](const auto &threadInfo) {
+                                   return threadInfo.get() == worker;
+                               });
+        if (it != threadPool.end()) {
+            retiredThreads.push_back(std::move(*it));
+            *it = std::move(threadPool.back());
+            threadPool.pop_back();
+        }
+
+        if (isTerminated()) {
+            notifyTermination();
+        }
+    }
+
+    /**
+     * @brief Creates the watchdog thread if it does not run yet (under the monitor).
+     */
+    void startWatchdog() {
+        if (!watchdog) {
+            watchdog = std::make_unique<PcoThread>([this]() {
+                watchdogLoop();
+            });
+        }
+    }
+
+    /**
+     * @brief Queues a numbered task, waiting up to a deadline for a free slot.
+     * @param item The task, already counted by queued()
+     * @param deadline Time after which the producer stops waiting for a free slot
+     * @param priority Lane of the waiting queue the task goes to
+     * @param rejectOnShutdown True to cancel the task on ShuttingDown too, for the tasks start()
+     *                         had already accepted
+     * @return The outcome of the submission. On QueueFull, cancelRun() was called on the task.
+     */
+    SubmitStatus submitQueuedUntil(QueuedTask item, std::chrono::steady_clock::time_point deadline,
+                                   TaskPriority priority, bool rejectOnShutdown = false) {
+        // Lock-free fast path, the monitor is only needed to wait for a slot
+        if (isLockFree() && lockFreeTasks->tryPush(item, priority)) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!claimSpinner() && (idleThreads > 0 || nbThreads < threadCap())) {
+                enterMonitor();
+                wakeOrCreateThreads(1);
+                monitorOut();
+            }
+            return SubmitStatus::Accepted;
+        }
+        if (isLockFree() && std::chrono::steady_clock::now() >= deadline) {
+            reject(item);
+            return SubmitStatus::QueueFull;
+        }
+
+        SlotWaiter waiter;
+        waiter.deadline = deadline;
+
+        enterMonitor();
+        for (;;) {
+            if (isShuttingDown) {
+                monitorOut();
+                if (rejectOnShutdown) {
+                    reject(item);
+                }
+                return SubmitStatus::ShuttingDown;
+            }
+
+            if (isLockFree()) {
+                // Register first, so that a consumer popping from now on signals us
+                slotWaiters.push_back(&waiter);
+                ++nbSlotWaiters;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (lockFreeTasks->tryPush(item, priority)) {
+                    slotWaiters.pop_back();
+                    --nbSlotWaiters;
+                    wakeOrCreateThreads(1);
+                    monitorOut();
+                    return SubmitStatus::Accepted;
+                }
+            } else if (idleThreads > 0 || nbThreads < threadCap() || waitingTasks.hasRoom(priority)) {
+                waitingTasks.push(std::move(item), priority);
+                wakeOrCreateThreads(1);
+                monitorOut();
+                return SubmitStatus::Accepted;
+            } else {
+                slotWaiters.push_back(&waiter);
+                ++nbSlotWaiters;
+            }
+
+            if (std::chrono::steady_clock::now() >= deadline) {
+                slotWaiters.pop_back();
+                --nbSlotWaiters;
+                monitorOut();
+                reject(item);
+                return SubmitStatus::QueueFull;
+            }
+
+            // Make sure the watchdog knows about our deadline, then wait. Whoever signals us
+            // removes us from slotWaiters.
+            startWatchdog();
+            signal(condWatchdog);
+            {
+                std::lock_guard<std::mutex> lock(watchdogMutex);
+                watchdogRescan = true;
+            }
+            watchdogCond.notify_all();
+            wait(waiter.cond);
+        }
+    }
+
+    /**
+     * @brief Wakes up the oldest producer waiting for a free slot, if any (under the monitor).
+     */
+    void signalSlotWaiter() {
+        if (!slotWaiters.empty()) {
+            SlotWaiter* waiter = slotWaiters.front();
+            slotWaiters.pop_front();
+            --nbSlotWaiters;
+            signal(waiter->cond);
+        }
+    }
+
+    /**
+     * @brief Registers the calling worker as idle (under the monitor).
+     * @param parked The record of the worker, on its stack until it is woken up
+     */
+    void park(ParkedThread& parked) {
+        parked.worker->setState(ThreadInfo::State::Idle);
+        parked.worker->setIdleSince(std::chrono::steady_clock::now());
+        parkedThreads.push_back(&parked);
+        ++idleThreads;
+    }
+
+    /**
+     * @brief Takes back the registration of park() when work showed up before waiting (under the monitor).
+     * The monitor was held since park(), so the caller is still the newest parked thread.
+     */
+    void unparkSelf() {
+        parkedThreads.back()->worker->setState(ThreadInfo::State::Busy);
+        parkedThreads.pop_back();
+        --idleThreads;
+    }
+
+    /**
+     * @brief Wakes up the most recently parked thread, to run a task or exit (under the monitor).
+     * Handing work to the newest idle thread leaves the oldest ones to expire.
+     */
+    void wakeNewestIdle() {
+        ParkedThread* parked = parkedThreads.back();
+        parkedThreads.pop_back();
+        --idleThreads;
+        parked->woken = true;
+        signal(parked->cond);
+    }
+
+    /**
+     * @brief Wakes up the thread parked for the longest time and tells it to terminate (under the monitor).
+     */
+    void expireOldestIdle() {
+        ParkedThread* parked = parkedThreads.front();
+        parkedThreads.pop_front();
+        --idleThreads;
+        parked->expire = true;
+        parked->woken = true;
+        signal(parked->cond);
+    }
+
+    /**
+     * @brief Wakes up or creates the threads needed by newly queued tasks (under the monitor).
+     * Spinning threads are claimed first, then parked threads are woken up, then new threads
+     * are created up to maxThreadCount.
+     * @param nbTasks Number of tasks that were just queued
+     * @return The number of tasks a thread was claimed, woken up or created for.
+     */
+    size_t wakeOrCreateThreads(size_t nbTasks) {
+        size_t nbServed = 0;
+        while (nbServed < nbTasks && claimSpinner()) {
+            ++nbServed;
+        }
+        while (nbServed < nbTasks && idleThreads > 0) {
+            wakeNewestIdle();
+            ++nbServed;
+        }
+        while (nbServed < nbTasks && nbThreads < threadCap() && !isShuttingDown) {
+            createThread();
+            ++nbServed;
+        }
+        return nbServed;
+    }
+
+    /**
+     * @brief Takes one spinning thread out of nbSpinning.
+     * Called by a producer that just queued a task, to hand it over to that thread, and by a
+     * spinning thread that stops spinning. Either way the spinning thread looks at the queues
+     * again before parking, so the task cannot be missed.
+     * @return True if a spinning thread was claimed, false if none is spinning.
+     */
+    bool claimSpinner() {
+        if constexpr (!Policy::Spinning) {
+            return false;
+        }
+        size_t spinning = nbSpinning.load();
+        while (spinning > 0) {
+            if (nbSpinning.compare_exchange_weak(spinning, spinning - 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Hints the CPU that the calling thread is busy waiting.
+     */
+    static void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    /**
+     * @brief Peeks at the queues without the monitor.
+     * @return True if a task seems to be queued or the pool is shutting down, false otherwise.
+     */
+    bool hasVisibleWork() const {
+        if (isShuttingDown || hasLocalTasks()) {
+            return true;
+        }
+        return isLockFree() ? !lockFreeTasks->empty() : waitingTasks.sizeApprox() > 0;
+    }
+
+    /**
+     * @brief Spins, then yields, until a task shows up or the budgets of the IdleStrategy run out.
+     * The thread is counted in nbSpinning meanwhile, so that producers do not signal anyone.
+     * The queues are only peeked at: the task is taken by taskRunner() afterwards, and a thread
+     * that gives up goes through the usual parking checks. The spin budget of the thread is
+     * doubled when it found work and halved when it did not, within [MinSpins, spinLimit].
+     * @param worker The calling thread
+     */
+    void spinForWork(ThreadInfo* worker) {
+        if constexpr (!Policy::Spinning) {
+            return;
+        }
+        const unsigned limit = spinLimit.load(std::memory_order_relaxed);
+        const unsigned yields = yieldLimit.load(std::memory_order_relaxed);
+        if ((limit == 0 && yields == 0) || hasVisibleWork()) {
+            return;
+        }
+
+        const bool adaptive = adaptiveSpin.load(std::memory_order_relaxed);
+        unsigned budget = worker->getSpinBudget();
+        if (!adaptive || budget == 0 || budget > limit) {
+            budget = limit;
+        }
+
+        // Pairs with the fence of a producer: either it claims us or we see its task
+        ++nbSpinning;
+        bool found = false;
+        for (unsigned i = 0; i < budget && !found; ++i) {
+            cpuRelax();
+            found = hasVisibleWork();
+        }
+        for (unsigned i = 0; i < yields && !found; ++i) {
+            std::this_thread::yield();
+            found = hasVisibleWork();
+        }
+        // Fails if a producer claimed us meanwhile, that is fine as we took our share of the count
+        claimSpinner();
+
+        if (adaptive) {
+            if (found) {
+                budget = budget > limit / 2 ? limit : std::max(budget * 2, 1u);
+            } else {
+                budget = std::max(std::min(limit, IdleStrategy::MinSpins), budget / 2);
+            }
+            worker->setSpinBudget(budget);
+        }
+        if (metricsOn()) {
+            (found ? currentShard().spinSuccesses : currentShard().spinFailures).fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Runs a task, logging the exceptions it throws.
+     * When the metrics are enabled, its queue latency and run time are recorded in the shard
+     * of the calling thread.
+     * @param item The task to run
+     */
+    void runTask(QueuedTask item) {
+        if (!item.task) {
+            return;
+        }
+
+        const bool measured = metricsOn();
+        std::chrono::steady_clock::time_point begin;
+        if (measured) {
+            begin = std::chrono::steady_clock::now();
+            if (item.enqueuedAt != std::chrono::steady_clock::time_point()) {
+                currentShard().waitTime.record(begin - item.enqueuedAt);
+            }
+        }
+
+        // The elastic sizing follows the queue latency and the tasks each worker is stuck in
+        trace(TraceEventKind::Dequeue, item.id);
+
+        ThreadInfo* self = ThreadInfo::current();
+        ThreadInfo* sized = elasticOn() ? self : nullptr;
+        if (sized) {
+            if (item.enqueuedAt != std::chrono::steady_clock::time_point()) {
+                auto wait = std::chrono::steady_clock::now() - item.enqueuedAt;
+                MetricsShard& shard = currentShard();
+                shard.sizingWaitNs.fetch_add(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count()), std::memory_order_relaxed);
+                shard.sizingTasks.fetch_add(1, std::memory_order_relaxed);
+            }
+            sized->beginTask();
+        }
+
+        // A task may run another one inline, such as a caller-run task, whose identity is restored after it
+        uint64_t outerId = self ? self->getCurrentTaskId() : 0;
+        Runnable* outerTask = self ? self->getCurrentTask() : nullptr;
+        if (self) {
+            self->setCurrentTask(item.id, item.task.get());
+        }
+        trace(TraceEventKind::RunBegin, item.id);
+        bool failed = false;
+        try {
+            item.task->run();
+        } catch (const std::exception& e) {
+            failed = true;
+            poolLog<LogLevel::Error>("Task execution failed: ", e.what());
+        }
+        trace(TraceEventKind::RunEnd, item.id);
+        if (self) {
+            self->setCurrentTask(outerId, outerTask);
+        }
+        if (sized) {
+            sized->endTask();
+        }
+
+        if (measured) {
+            MetricsShard& shard = currentShard();
+            shard.runTime.record(std::chrono::steady_clock::now() - begin);
+            shard.tasksRun.fetch_add(1, std::memory_order_relaxed);
+            if (failed) {
+                shard.tasksFailed.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * @brief Pops a task from the worker's own deque, or steals one from another thread.
+     * @param worker The calling thread
+     * @param task Receives the task
+     * @return True if a task was found, false if every local deque is empty.
+     */
+    bool takeLocalTask(ThreadInfo* worker, QueuedTask& task) {
+        LocalTaskDeque* own = worker->getLocalTasks();
+        if (!own) {
+            for (size_t i = 0; i < maxThreadCount; ++i) {
+                if (localTasks[i].stealTop(task)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        if (own->popBottom(task)) {
+            return true;
+        }
+        size_t slot = worker->getLocalSlot();
+        if (nodeTasks && nodeTasks[slotNode[slot]].stealTop(task)) {
+            return true;
+        }
+
+        // Steal from the threads of our node before crossing to the other nodes
+        for (size_t victim : stealOrder[slot]) {
+            if (localTasks[victim].stealTop(task)) {
+                return true;
+            }
+        }
+        if (nodeTasks) {
+            for (size_t node = 0; node < nbNodes(); ++node) {
+                if (node != slotNode[slot] && nodeTasks[node].stealTop(task)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Checks if any local deque or node queue holds a task.
+     * @return True if a task can be stolen, false otherwise.
+     */
+    bool hasLocalTasks() const {
+        for (size_t i = 0; i < maxThreadCount; ++i) {
+            if (!localTasks[i].empty()) {
+                return true;
+            }
+        }
+        if (nodeTasks) {
+            for (size_t node = 0; node < nbNodes(); ++node) {
+                if (!nodeTasks[node].empty()) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief start() for a task submitted by one of the pool's threads.
+     * The task goes on the submitting thread's deque. The monitor is only entered to wake
+     * a parked thread that will steal it, or to create one.
+     * @param self The submitting thread
+     * @param runnable The task to be executed.
+     * @return True if the task was queued, false if the pool is shutting down without draining.
+     */
+    bool startLocal(ThreadInfo* self, TaskPtr runnable) {
+        if (isShuttingDown && !isDraining) {
+            return false;
+        }
+
+        self->getLocalTasks()->pushBottom(queued(std::move(runnable)));
+
+        // Pairs with the fence of a parking thread: either it sees the task or we see it idle
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (claimSpinner() || (idleThreads == 0 && nbThreads >= threadCap())) {
+            return true;
+        }
+
+        enterMonitor();
+        wakeOrCreateThreads(1);
+        monitorOut();
+        return true;
+    }
+
+    /**
+     * @brief Lock-free version of start().
+     * The task is pushed in the ring buffer without taking the monitor. The monitor is only
+     * entered to wake a parked thread or to create a new one.
+     * @param runnable The task to be executed.
+     * @param priority Lane the task goes to
+     * @return True if the task was queued, false if the pool is shutting down or the ring is full.
+     */
+    bool lockFreeStart(TaskPtr runnable, TaskPriority priority) {
+        if (isShuttingDown) {
+            return false;
+        }
+
+        // The ring is full: the overflow policy decides
+        QueuedTask item = queued(std::move(runnable));
+        if (!lockFreeTasks->tryPush(item, priority)) {
+            return overflowRefused(std::move(item), priority);
+        }
+
+        // Pairs with the fence of a parking or retiring thread: either it sees the task,
+        // or we see it in idleThreads / nbThreads
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // Fast path: a spinning thread picks the task up, or every thread is busy and no
+        // thread can be created, one will pop the task
+        if (claimSpinner() || (idleThreads == 0 && nbThreads >= threadCap())) {
+            return true;
+        }
+
+        enterMonitor();
+        wakeOrCreateThreads(1);
+        monitorOut();
+        return true;
+    }
+
+    /**
+     * @brief Lock-free version of taskRunner().
+     * Pops the ring buffer without taking the monitor, the monitor is only entered to park.
+     * @param worker The worker thread calling this function
+     * @return True if the worker should keep running, false if it has to exit.
+     */
+    bool lockFreeTaskRunner(ThreadInfo* worker) {
+        QueuedTask task;
+
+        while (!lockFreeTasks->tryPop(task)) {
+            if (isShuttingDown) {
+                if (isDraining && hasLocalTasks()) {
+                    return true;
+                }
+                enterMonitor();
+                retireThread(worker);
+                monitorOut();
+                return false;
+            }
+
+            enterMonitor();
+            if (idleTimeout.count() == 0 && !elasticOn() && nbThreads > minThreadCount) {
+                if (lockFreeRetireThread(worker)) {
+                    countExpiredThread();
+                    monitorOut();
+                    return false;
+                }
+                monitorOut();
+                continue;
+            }
+            if (hasExtraThread()) {
+                if (lockFreeRetireThread(worker)) {
+                    monitorOut();
+                    return false;
+                }
+                monitorOut();
+                continue;
+            }
+
+            // Publish that we are parking, then look at the ring one last time
+            ParkedThread parked{{}, worker};
+            park(parked);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (isShuttingDown || !lockFreeTasks->empty() || hasLocalTasks()) {
+                unparkSelf();
+                monitorOut();
+                return true;
+            }
+            // Signaling the watchdog hands it the monitor, it may pick us before we wait
+            if (idleThreads == 1 || minThreadCount > 0) {
+                signal(condWatchdog);
+            }
+            if (!parked.woken) {
+                wait(parked.cond);
+            }
+            worker->setState(ThreadInfo::State::Busy);
+
+            // Counted once the thread really leaves: a task pushed meanwhile keeps it running
+            if (parked.expire) {
+                if (lockFreeRetireThread(worker)) {
+                    countExpiredThread();
+                    monitorOut();
+                    return false;
+                }
+            }
+            monitorOut();
+
+            // Woken up for a task pushed on a local deque
+            if (hasLocalTasks()) {
+                return true;
+            }
+        }
+
+        // Popped while shutdownNow() was emptying the ring
+        if (isShuttingDown && !isDraining) {
+            cancel(task);
+            enterMonitor();
+            retireThread(worker);
+            monitorOut();
+            return false;
+        }
+
+        // A slot was freed, pairs with the fence of a registering producer of submitFor()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (nbSlotWaiters > 0) {
+            enterMonitor();
+            signalSlotWaiter();
+            monitorOut();
+        }
+
+        runTask(std::move(task));
+        return true;
+    }
+
+    /**
+     * @brief Retires the calling thread unless a task was pushed concurrently (under the monitor).
+     * A producer seeing the old nbThreads would not create a replacement thread, so the
+     * ring is checked again once the decrement is visible.
+     * @param worker The exiting thread
+     * @return True if the thread can exit, false if it has to keep serving the ring.
+     */
+    bool lockFreeRetireThread(ThreadInfo* worker) {
+        --nbThreads;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!isShuttingDown && !lockFreeTasks->empty()) {
+            ++nbThreads;
+            return false;
+        }
+        releaseThread(worker);
+        return true;
+    }
+
+    /**
+     * @brief Main loop of the watchdog.
+     * Sleeps until the oldest parked thread reaches idleTimeout, then tells it to terminate,
+     * or until the deadline of a producer of submitFor(), then tells it to give up. Waits on
+     * condWatchdog while it has no deadline to track. It also joins the retired threads,
+     * outside the monitor.
+     */
+    void watchdogLoop() {
+        enterMonitor();
+        while (!isShuttingDown) {
+            if (!retiredThreads.empty()) {
+                auto reaped = std::move(retiredThreads);
+                retiredThreads.clear();
+                monitorOut();
+                reaped.clear();
+                enterMonitor();
+                continue;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            auto deadline = std::chrono::steady_clock::time_point::max();
+
+            // The elastic sizing replaces idleTimeout, its controller runs every samplePeriod
+            if (elasticOn()) {
+                auto nextSample = lastSample + sizingSettings.samplePeriod;
+                if (now >= nextSample) {
+                    lastSample = now;
+                    if (sampleSizing(now)) {
+                        continue;
+                    }
+                    nextSample = now + sizingSettings.samplePeriod;
+                }
+                deadline = nextSample;
+            }
+
+            // Core threads do not expire: only look at the idle threads above minThreadCount
+            else if (!parkedThreads.empty() && nbThreads > minThreadCount) {
+                deadline = parkedThreads.front()->worker->getIdleSince() + idleTimeout;
+                if (now >= deadline) {
+                    expireOldestIdle();
+                    continue;
+                }
+            }
+
+            auto expired = std::find_if(slotWaiters.begin(), slotWaiters.end(),
+                                        [now](SlotWaiter* waiter) { return now >= waiter->deadline; });
+            if (expired != slotWaiters.end()) {
+                SlotWaiter* waiter = *expired;
+                slotWaiters.erase(expired);
+                --nbSlotWaiters;
+                signal(waiter->cond);
+                continue;
+            }
+            for (SlotWaiter* waiter : slotWaiters) {
+                deadline = std::min(deadline, waiter->deadline);
+            }
+
+            if (deadline == std::chrono::steady_clock::time_point::max()) {
+                wait(condWatchdog);
+                continue;
+            }
+
+            // Sleep outside the monitor, the deadlines are re-evaluated on wake up
+            monitorOut();
+            {
+                std::unique_lock<std::mutex> lock(watchdogMutex);
+                watchdogCond.wait_until(lock, deadline, [this]() { return watchdogStop || watchdogRescan; });
+                watchdogRescan = false;
+            }
+            enterMonitor();
+        }
+        monitorOut();
+    }
+
+    /**
+     * @brief Returns the number of queued tasks, from every queue (under the monitor).
+     * @return An approximation of the number of tasks waiting for a thread.
+     */
+    size_t queueDepth() {
+        size_t depth = waitingTasks.size();
+        if (lockFreeTasks) {
+            depth += lockFreeTasks->sizeApprox();
+        }
+        for (size_t i = 0; i < maxThreadCount; ++i) {
+            depth += localTasks[i].sizeApprox();
+        }
+        if (nodeTasks) {
+            for (size_t node = 0; node < nbNodes(); ++node) {
+                depth += nodeTasks[node].sizeApprox();
+            }
+        }
+        return depth;
+    }
+
+    /**
+     * @brief One sample of the elastic sizing, taken by the watchdog (under the monitor).
+     * Measures the mean queue latency of the tasks started since the last sample, the CPU
+     * utilization of the workers and the workers blocked in a task, then moves the limit,
+     * creates the threads the queued tasks are owed, or terminates an idle thread over it.
+     * @param now Time of the sample
+     * @return True if an idle thread was signaled to terminate, the monitor having been handed over.
+     */
+    bool sampleSizing(std::chrono::steady_clock::time_point now) {
+        const ElasticSizing& sizing = sizingSettings;
+        double wallNs = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - sampleStart).count());
+        sampleStart = now;
+
+        uint64_t waitNs = 0;
+        uint64_t nbStarted = 0;
+        for (size_t i = 0; i <= maxThreadCount; ++i) {
+            waitNs += metricsShards[i].sizingWaitNs.exchange(0, std::memory_order_relaxed);
+            nbStarted += metricsShards[i].sizingTasks.exchange(0, std::memory_order_relaxed);
+        }
+
+        // A worker whose task sequence did not move and stayed odd ran the same task all along
+        size_t blocked = 0;
+        double cpuNs = 0;
+        for (auto &thread : threadPool) {
+            if (!thread->getLocalTasks()) {
+                continue;
+            }
+            WorkerSample& sample = workerSamples[thread->getLocalSlot()];
+            uint64_t sequence = thread->getTaskSequence();
+            uint64_t cpu = thread->getCpuTime();
+            if (sample.thread == thread.get() && cpu != ThreadInfo::NoCpuTime && sample.cpu != ThreadInfo::NoCpuTime &&
+                cpu >= sample.cpu) {
+                double used = static_cast<double>(cpu - sample.cpu);
+                cpuNs += used;
+                // Workers in a BlockingScope are already accounted for
+                if (sequence == sample.sequence && (sequence & 1) && used < sizing.blockedUtilization * wallNs &&
+                    !thread->isBlocking()) {
+                    ++blocked;
+                }
+            }
+            sample = WorkerSample{thread.get(), sequence, cpu};
+        }
+
+        size_t depth = queueDepth();
+        double meanWaitNs = nbStarted > 0 ? static_cast<double>(waitNs) / static_cast<double>(nbStarted) : 0;
+        double targetNs = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(sizing.targetWait).count());
+        double utilization = wallNs > 0 && nbThreads > 0 ? cpuNs / (wallNs * static_cast<double>(nbThreads)) : 0;
+
+        // Tasks left in the queue without any start are late by a whole sample
+        bool late = nbStarted > 0 ? meanWaitNs > targetNs : depth > 0;
+        bool quiet = !late && meanWaitNs < targetNs / 4 && depth == 0 && utilization < sizing.shrinkUtilization;
+        highSamples = late ? highSamples + 1 : 0;
+        quietSamples = quiet ? quietSamples + 1 : 0;
+
+        nbBlocked = blocked;
+        size_t limit = sizingLimit;
+        // Growing only helps once the blocked workers were compensated
+        if (highSamples >= sizing.growAfter && nbThreads >= threadCap()) {
+            limit = std::min(maxThreadCount, limit + std::max<size_t>(1, limit / 4));
+            highSamples = 0;
+        }
+        if (quietSamples >= sizing.shrinkAfter) {
+            limit = std::max<size_t>({minThreadCount, limit - 1, 1});
+            quietSamples = 0;
+        }
+        sizingLimit = limit;
+
+        size_t cap = threadCap();
+        if (depth > 0 && nbThreads < cap) {
+            wakeOrCreateThreads(std::min(depth, cap - nbThreads));
+        }
+        if (nbThreads > cap && !parkedThreads.empty()) {
+            expireOldestIdle();
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Checks if the pool is shut down and every thread retired.
+     * @return True once no task can run anymore, false otherwise.
+     */
+    bool isTerminated() const {
+        return isShuttingDown && nbThreads == 0;
+    }
+
+    /**
+     * @brief Wakes up the callers of awaitTermination() and the destructor.
+     */
+    void notifyTermination() {
+        {
+            std::lock_guard<std::mutex> lock(terminationMutex);
+        }
+        terminationCond.notify_all();
+    }
+
+    /**
+     * @brief Waits without timeout for every thread to retire, used by the destructor.
+     */
+    void waitTermination() {
+        std::unique_lock<std::mutex> lock(terminationMutex);
+        terminationCond.wait(lock, [this]() { return isTerminated(); });
+    }
+
+    /**
+     * @brief Stops accepting tasks and wakes up every parked thread and blocked producer.
+     * The watchdog and the timer thread are stopped and joined by the first call only, and
+     * the pending timers cancelled. A later call without drain
+     * turns a drain into a cancellation, the other way round it does nothing.
+     * @param drain True to let the threads run the queued tasks before exiting
+     */
+    void beginShutdown(bool drain) {
+        enterMonitor();
+        if (isShuttingDown) {
+            if (!drain) {
+                isDraining = false;
+            }
+            monitorOut();
+            return;
+        }
+        // isDraining is set first: a thread seeing isShuttingDown must see it too
+        isDraining = drain;
+        isShuttingDown = true;
+
+        // Wake up all parked threads and blocked producers so they can drain or exit
+        while (idleThreads > 0) {
+            wakeNewestIdle();
+        }
+        while (nbTasksWaitingForThreads > 0) {
+            signal(waitForThread);
+        }
+        while (!slotWaiters.empty()) {
+            signalSlotWaiter();
+        }
+        signal(condWatchdog);
+
+        // Take the threads out of the pool, to be joined by the destructor. Threads retiring
+        // from now on will not find themselves in threadPool.
+        for (auto &thread : threadPool) {
+            retiredThreads.push_back(std::move(thread));
+        }
+        threadPool.clear();
+        monitorOut();
+
+        if (watchdog) {
+            {
+                std::lock_guard<std::mutex> lock(watchdogMutex);
+                watchdogStop = true;
+            }
+            watchdogCond.notify_all();
+            watchdog->join();
+        }
+
+        // The pending timers are cancelled, the due tasks handed over meanwhile are refused
+        timers.stop();
+
+        // No thread may be left to notify
+        notifyTermination();
+    }
+
+    /**
+     * @brief Takes every task out of the queues: the waiting queue, the local deques and the
+     * node queues.
+     * @return The tasks, whose cancelRun() is to be called outside the monitor.
+     */
+    std::vector<QueuedTask> takeQueuedTasks() {
+        std::vector<QueuedTask> tasks;
+        QueuedTask item;
+
+        enterMonitor();
+        while (!waitingTasks.empty()) {
+            tasks.push_back(waitingTasks.pop());
+        }
+        if (lockFreeTasks) {
+            while (lockFreeTasks->tryPop(item)) {
+                tasks.push_back(std::move(item));
+            }
+        }
+        for (size_t i = 0; i < maxThreadCount; ++i) {
+            while (localTasks[i].stealTop(item)) {
+                tasks.push_back(std::move(item));
+            }
+        }
+        if (nodeTasks) {
+            for (size_t node = 0; node < nbNodes(); ++node) {
+                while (nodeTasks[node].stealTop(item)) {
+                    tasks.push_back(std::move(item));
+                }
+            }
+        }
+        monitorOut();
+        return tasks;
+    }
+};
+
+/**
+ * @brief The thread pool with the default policies, whose backend is chosen at runtime.
+ */
+using ThreadPool = BasicThreadPool<>;
 
 #endif // THREADPOOL_H
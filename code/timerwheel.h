@@ -0,0 +1,633 @@
+/**
+ * @file timerwheel.h
+ * @brief Header file defining TimerWheel and TimerQueue, which hand delayed and periodic tasks over to the ThreadPool when they are due.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pcosynchro/pcothread.h>
+
+#include "runnable.h"
+#include "taskslab.h"
+
+/**
+ * @brief Link of a timer in the slot of a TimerWheel, embedded in the timer itself.
+ */
+struct TimerNode {
+    TimerNode* prev = nullptr; // Previous timer of the slot, the slot's head for the first one
+    TimerNode* next = nullptr; // Next timer of the slot, the slot's head for the last one
+    uint64_t expiry = 0;       // Tick at which the timer is due
+    uint16_t slot = 0;         // Level and index of the slot it is linked in, level * Slots + index
+};
+
+/**
+ * @brief Hierarchical timing wheel: Levels wheels of Slots slots, each slot of a level
+ * spanning a whole turn of the level below.
+ * A timer is linked in the slot of the lowest level covering its expiry, then moved down a
+ * level each time the wheel above turns to its slot, so inserting and removing a timer cost
+ * O(1) whatever the number of timers. Timers further than the last level are parked in its
+ * farthest slot and placed again each time it comes round. Not thread-safe: TimerQueue
+ * protects it with its mutex.
+ */
+class TimerWheel {
+public:
+    static constexpr unsigned SlotBits = 6;                        // log2 of the number of slots per level
+    static constexpr size_t Slots = size_t(1) << SlotBits;         // Slots per level
+    static constexpr unsigned Levels = 4;                          // 64^4 ticks, 4.6 hours of 1 ms ticks
+    static constexpr uint64_t Range = uint64_t(1) << (SlotBits * Levels); // Ticks covered by the wheels
+    static constexpr uint64_t NoExpiry = UINT64_MAX;               // Returned by nextExpiry() without timers
+
+    TimerWheel() {
+        for (auto &level : slots) {
+            for (auto &head : level) {
+                head.prev = &head;
+                head.next = &head;
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /**
+     * @brief Returns the last tick the wheel was advanced to.
+     * @return The current tick.
+     */
+    uint64_t current() const {
+        return now;
+    }
+
+    /**
+     * @brief Returns the number of timers in the wheel.
+     * @return The count of pending timers.
+     */
+    size_t size() const {
+        return count;
+    }
+
+    /**
+     * @brief Adds a timer. An expiry not after the current tick is moved to the next tick.
+     * @param timer The timer, whose expiry is set, not linked in any wheel
+     */
+    void insert(TimerNode* timer) {
+        if (timer->expiry <= now) {
+            timer->expiry = now + 1;
+        }
+        link(timer);
+        ++count;
+    }
+
+    /**
+     * @brief Removes a timer before it is due.
+     * @param timer A timer of this wheel
+     */
+    void remove(TimerNode* timer) {
+        unlink(timer);
+        --count;
+    }
+
+    /**
+     * @brief Advances the wheel up to a tick and takes out the timers that became due.
+     * Runs of empty ticks are skipped up to the next turn of the first level.
+     * @param target The tick to advance to, ignored if it is not after the current one
+     * @param due Receives the due timers, in expiry order, unlinked
+     */
+    void advance(uint64_t target, std::vector<TimerNode*>& due) {
+        while (now < target) {
+            if (count == 0) {
+                now = target;
+                break;
+            }
+            if (occupied[0] == 0) {
+                // Nothing in the first level before it turns
+                uint64_t turn = (now | (Slots - 1)) + 1;
+                if (target < turn) {
+                    now = target;
+                    break;
+                }
+                now = turn - 1;
+            }
+            ++now;
+
+            // Each level whose wheel below completed a turn moves its current slot down
+            for (unsigned level = 1; level < Levels; ++level) {
+                if ((now & ((uint64_t(1) << (SlotBits * level)) - 1)) != 0) {
+                    break;
+                }
+                cascade(level, (now >> (SlotBits * level)) & (Slots - 1));
+            }
+
+            size_t slot = now & (Slots - 1);
+            TimerNode& head = slots[0][slot];
+            while (head.next != &head) {
+                TimerNode* timer = head.next;
+                unlink(timer);
+                --count;
+                due.push_back(timer);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the tick the wheel must be advanced to next.
+     * @return The expiry of the next timer of the first level, else its next turn, when timers
+     *         of higher levels may move down, or NoExpiry without timers.
+     */
+    uint64_t nextExpiry() const {
+        if (count == 0) {
+            return NoExpiry;
+        }
+        // Occupancy of the slots after the current one, in the order they come round
+        unsigned shift = static_cast<unsigned>((now + 1) & (Slots - 1));
+        uint64_t ahead = shift == 0 ? occupied[0] : (occupied[0] >> shift) | (occupied[0] << (Slots - shift));
+        if (ahead != 0) {
+            return now + 1 + static_cast<uint64_t>(__builtin_ctzll(ahead));
+        }
+        return (now | (Slots - 1)) + 1;
+    }
+
+    /**
+     * @brief Takes every timer out of the wheel.
+     * @param timers Receives the timers, unlinked
+     */
+    void clear(std::vector<TimerNode*>& timers) {
+        for (unsigned level = 0; level < Levels; ++level) {
+            for (auto &head : slots[level]) {
+                while (head.next != &head) {
+                    TimerNode* timer = head.next;
+                    unlink(timer);
+                    timers.push_back(timer);
+                }
+            }
+        }
+        count = 0;
+    }
+
+private:
+    /**
+     * @brief Links a timer in the slot of the lowest level covering its expiry.
+     * @param timer The timer, due after the current tick
+     */
+    void link(TimerNode* timer) {
+        uint64_t delta = timer->expiry - now;
+        unsigned level = 0;
+        while (level + 1 < Levels && delta >= (uint64_t(1) << (SlotBits * (level + 1)))) {
+            ++level;
+        }
+        // Too far for the wheels: parked in the farthest slot, placed again when it comes round
+        uint64_t expiry = delta >= Range ? now + Range - 1 : timer->expiry;
+        size_t slot = (expiry >> (SlotBits * level)) & (Slots - 1);
+
+        TimerNode& head = slots[level][slot];
+        timer->prev = head.prev;
+        timer->next = &head;
+        head.prev->next = timer;
+        head.prev = timer;
+        occupied[level] |= uint64_t(1) << slot;
+        timer->slot = static_cast<uint16_t>(level * Slots + slot);
+    }
+
+    /**
+     * @brief Unlinks a timer from its slot.
+     * @param timer A linked timer
+     */
+    void unlink(TimerNode* timer) {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        size_t level = timer->slot / Slots;
+        size_t slot = timer->slot % Slots;
+        TimerNode& head = slots[level][slot];
+        if (head.next == &head) {
+            occupied[level] &= ~(uint64_t(1) << slot);
+        }
+        timer->prev = nullptr;
+        timer->next = nullptr;
+    }
+
+    /**
+     * @brief Places the timers of a slot again, in the levels below.
+     * @param level Level of the slot, above the first one
+     * @param slot Index of the slot
+     */
+    void cascade(unsigned level, size_t slot) {
+        TimerNode& head = slots[level][slot];
+        while (head.next != &head) {
+            TimerNode* timer = head.next;
+            unlink(timer);
+            link(timer);
+        }
+    }
+
+    std::array<std::array<TimerNode, Slots>, Levels> slots; // Circular lists of timers, headed by a sentinel
+    std::array<uint64_t, Levels> occupied{};                // One bit per non-empty slot, for each level
+    uint64_t now = 0;                                       // Current tick
+    size_t count = 0;                                       // Timers in the wheel
+};
+
+namespace detail {
+
+/**
+ * @brief A timer of a TimerQueue, linked in its wheel while it waits.
+ */
+struct TimerEntry : TimerNode {
+    enum class Phase {
+        Pending,    // In the wheel
+        Running,    // Periodic timer whose task was handed over to the pool, out of the wheel
+        Done        // Handed over for good, cancelled or stopped
+    };
+
+    TaskPtr task;                       // Task of a one-shot timer, handed over to the pool when due
+    std::shared_ptr<Runnable> periodic; // Task of a periodic timer, run once per period
+    uint64_t period = 0;                // Period in ticks, 0 for a one-shot timer
+    Phase phase = Phase::Pending;       // Where the timer is, under the mutex of its TimerState
+    std::shared_ptr<TimerEntry> self;   // Keeps the timer alive while it is in the wheel
+};
+
+/**
+ * @brief State of a TimerQueue, shared with the ScheduledTask handles so that they may outlive it.
+ */
+struct TimerState {
+    std::mutex mutex;                   // Protects everything below and the timers
+    std::condition_variable cond;       // Wakes the timer thread up
+    TimerWheel wheel;                   // The pending timers
+    bool stopped = false;               // Set by stop(), no timer is armed anymore
+    bool rescan = false;                // Set when a timer due before wakeTick was armed
+    uint64_t wakeTick = TimerWheel::NoExpiry; // Tick the timer thread sleeps until, 0 while it is awake
+    const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now(); // Tick 0
+};
+
+} // namespace detail
+
+/**
+ * @brief Handle of a task given to ThreadPool::schedule() or scheduleAtFixedRate().
+ * A default one, or one returned for a refused task, is not valid() and cancels nothing.
+ */
+class ScheduledTask {
+public:
+    ScheduledTask() = default;
+
+    /**
+     * @brief Checks if the task was accepted by the pool.
+     * @return True if the handle refers to a timer.
+     */
+    bool valid() const {
+        return entry != nullptr;
+    }
+
+    /**
+     * @brief Cancels the timer: the task's cancelRun() is called, unless the task was already
+     * handed over to the pool. A periodic task whose run is in progress is cancelled once it
+     * returns, and is not run again.
+     * @return True if this call cancelled the timer, false if it was not valid, already
+     *         cancelled, or handed over to the pool for good.
+     */
+    bool cancel();
+
+private:
+    friend class TimerQueue;
+
+    ScheduledTask(std::weak_ptr<detail::TimerState> state, std::shared_ptr<detail::TimerEntry> entry)
+        : state(std::move(state)), entry(std::move(entry)) {}
+
+    std::weak_ptr<detail::TimerState> state;   // State of the queue, expired once it is destroyed
+    std::shared_ptr<detail::TimerEntry> entry; // The timer
+};
+
+/**
+ * @brief Delayed and periodic tasks of a pool, kept in a TimerWheel serviced by a single timer
+ * thread started with the first timer.
+ * The timer thread sleeps until the next due timer, then hands every task that became due
+ * to the pool in a single batch through the dispatch function, outside its mutex. A periodic
+ * task runs at a fixed rate: it is armed again once it returns for the next multiple of its
+ * period after its first deadline, so that its runs never overlap and a late run skips the
+ * periods it missed.
+ */
+class TimerQueue {
+public:
+    using Dispatch = std::function<void(std::vector<TaskPtr>&&)>;
+
+    static constexpr std::chrono::milliseconds Tick{1}; // Resolution of the timers
+
+    /**
+     * @brief Constructor
+     * @param dispatch Called by the timer thread with the tasks that became due
+     */
+    explicit TimerQueue(Dispatch dispatch)
+        : state(std::make_shared<detail::TimerState>()), dispatch(std::move(dispatch)) {}
+
+    TimerQueue(const TimerQueue&) = delete;
+    TimerQueue& operator=(const TimerQueue&) = delete;
+
+    /**
+     * @brief Destructor
+     * Stops the queue if stop() was not called before.
+     */
+    ~TimerQueue() {
+        stop();
+    }
+
+    /**
+     * @brief Arms a one-shot timer.
+     * @param task The task, handed over to the pool once delay elapsed
+     * @param delay Time to wait before the task is due
+     * @return The handle of the timer, not valid if the queue was stopped: the task is then cancelled.
+     */
+    ScheduledTask add(TaskPtr task, std::chrono::milliseconds delay) {
+        auto entry = std::make_shared<detail::TimerEntry>();
+        entry->task = std::move(task);
+        return arm(std::move(entry), delay);
+    }
+
+    /**
+     * @brief Arms a periodic timer, first due after one period.
+     * @param task The task, run once per period until the timer is cancelled or stopped
+     * @param period Time between two deadlines, rounded up to whole ticks
+     * @return The handle of the timer, not valid if the queue was stopped: the task is then cancelled.
+     */
+    ScheduledTask addPeriodic(std::shared_ptr<Runnable> task, std::chrono::milliseconds period) {
+        auto entry = std::make_shared<detail::TimerEntry>();
+        entry->periodic = std::move(task);
+        entry->period = std::max<uint64_t>(static_cast<uint64_t>(std::chrono::ceil<std::chrono::milliseconds>(period) / Tick), 1);
+        return arm(std::move(entry), period);
+    }
+
+    /**
+     * @brief Returns the number of timers waiting in the wheel.
+     * @return The count of pending timers.
+     */
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->wheel.size();
+    }
+
+    /**
+     * @brief Stops the timer thread and cancels the pending timers through their task's cancelRun().
+     * Timers armed from now on are refused. Only the first call does something.
+     * @return The number of timers cancelled.
+     */
+    size_t stop() {
+        detail::TimerState& s = *state;
+        std::unique_ptr<PcoThread> worker;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (s.stopped) {
+                return 0;
+            }
+            s.stopped = true;
+            worker = std::move(thread);
+        }
+        s.cond.notify_all();
+        if (worker) {
+            worker->join();
+        }
+
+        std::vector<TimerNode*> timers;
+        std::vector<std::shared_ptr<detail::TimerEntry>> entries;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            s.wheel.clear(timers);
+            for (TimerNode* timer : timers) {
+                auto* entry = static_cast<detail::TimerEntry*>(timer);
+                entry->phase = detail::TimerEntry::Phase::Done;
+                entries.push_back(std::move(entry->self));
+            }
+        }
+        // Done timers are not touched by anyone else anymore
+        for (auto &entry : entries) {
+            cancelTask(*entry);
+        }
+        return entries.size();
+    }
+
+private:
+    friend class ScheduledTask;
+
+    /**
+     * @brief Task handed over to the pool for each period of a periodic timer.
+     * Arms the timer again once the period's run returns, or was refused by the pool.
+     */
+    class PeriodicRun : public Runnable {
+    public:
+        PeriodicRun(std::shared_ptr<detail::TimerState> state, std::shared_ptr<detail::TimerEntry> entry)
+            : state(std::move(state)), entry(std::move(entry)), task(this->entry->periodic) {}
+
+        void run() override {
+            try {
+                task->run();
+            } catch (...) {
+                rearm(*state, entry);
+                throw;
+            }
+            rearm(*state, entry);
+        }
+
+        void cancelRun() override {
+            // Only this period is skipped
+            rearm(*state, entry);
+        }
+
+        std::string id() override {
+            return task->id();
+        }
+
+    private:
+        std::shared_ptr<detail::TimerState> state;  // State of the queue
+        std::shared_ptr<detail::TimerEntry> entry;  // The timer, Running until rearm()
+        std::shared_ptr<Runnable> task;             // The periodic task
+    };
+
+    /**
+     * @brief Arms a new timer and starts the timer thread if needed.
+     * @param entry The timer
+     * @param delay Time until its first deadline
+     * @return Its handle, not valid if the queue was stopped: the task's cancelRun() is then
+     *         called.
+     */
+    ScheduledTask arm(std::shared_ptr<detail::TimerEntry> entry, std::chrono::milliseconds delay) {
+        detail::TimerState& s = *state;
+        auto deadline = std::chrono::steady_clock::now() + delay - s.origin;
+        entry->expiry = static_cast<uint64_t>(std::chrono::ceil<std::chrono::milliseconds>(deadline) / Tick);
+
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (!s.stopped) {
+                insert(s, entry);
+                if (!thread) {
+                    thread = std::make_unique<PcoThread>([this]() {
+                        timerLoop();
+                    });
+                }
+                return ScheduledTask(state, std::move(entry));
+            }
+        }
+
+        // Outside of the mutex: the cancelRun() may arm another timer
+        cancelTask(*entry);
+        return ScheduledTask();
+    }
+
+    /**
+     * @brief Links a timer in the wheel and wakes the timer thread up if it is due before its
+     * wake up time (under the mutex).
+     * @param s State of the queue
+     * @param entry The timer
+     */
+    static void insert(detail::TimerState& s, const std::shared_ptr<detail::TimerEntry>& entry) {
+        entry->phase = detail::TimerEntry::Phase::Pending;
+        entry->self = entry;
+        s.wheel.insert(entry.get());
+        if (entry->expiry < s.wakeTick) {
+            s.rescan = true;
+            s.cond.notify_one();
+        }
+    }
+
+    /**
+     * @brief Arms a periodic timer for its next deadline after a run, or ends it if it was
+     * cancelled or the queue stopped meanwhile.
+     * @param s State of the queue
+     * @param entry The timer, Running
+     */
+    static void rearm(detail::TimerState& s, const std::shared_ptr<detail::TimerEntry>& entry) {
+        std::shared_ptr<Runnable> finished;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (entry->phase == detail::TimerEntry::Phase::Done || s.stopped) {
+                entry->phase = detail::TimerEntry::Phase::Done;
+                finished = std::move(entry->periodic);
+            } else {
+                // Fixed rate: the next multiple of the period that is still ahead
+                uint64_t current = s.wheel.current();
+                entry->expiry += entry->period;
+                if (entry->expiry <= current) {
+                    entry->expiry += ((current - entry->expiry) / entry->period + 1) * entry->period;
+                }
+                insert(s, entry);
+            }
+        }
+        if (finished) {
+            finished->cancelRun();
+        }
+    }
+
+    /**
+     * @brief Cancels a timer through its handle.
+     * @param s State of the queue
+     * @param entry The timer
+     * @return True if the timer was not Done yet.
+     */
+    static bool cancel(detail::TimerState& s, detail::TimerEntry& entry) {
+        std::shared_ptr<detail::TimerEntry> self;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            if (entry.phase == detail::TimerEntry::Phase::Done) {
+                return false;
+            }
+            // A Running timer is ended by the rearm() of its run
+            bool pending = entry.phase == detail::TimerEntry::Phase::Pending;
+            entry.phase = detail::TimerEntry::Phase::Done;
+            if (!pending) {
+                return true;
+            }
+            s.wheel.remove(&entry);
+            self = std::move(entry.self);
+        }
+        cancelTask(entry);
+        return true;
+    }
+
+    /**
+     * @brief Calls the cancelRun() of the task of a Done timer, and releases it.
+     * @param entry The timer
+     */
+    static void cancelTask(detail::TimerEntry& entry) {
+        if (entry.task) {
+            entry.task->cancelRun();
+            entry.task.reset();
+        }
+        if (entry.periodic) {
+            entry.periodic->cancelRun();
+            entry.periodic.reset();
+        }
+    }
+
+    /**
+     * @brief Main loop of the timer thread.
+     * Advances the wheel to the current time, hands the due tasks over as a batch, then
+     * sleeps until the next deadline of the wheel or until an earlier timer is armed.
+     */
+    void timerLoop() {
+        detail::TimerState& s = *state;
+        std::vector<TimerNode*> due;
+        std::vector<TaskPtr> tasks;
+
+        std::unique_lock<std::mutex> lock(s.mutex);
+        while (!s.stopped) {
+            auto elapsed = std::chrono::steady_clock::now() - s.origin;
+            s.wheel.advance(static_cast<uint64_t>(std::chrono::floor<std::chrono::milliseconds>(elapsed) / Tick), due);
+
+            if (!due.empty()) {
+                for (TimerNode* timer : due) {
+                    auto* entry = static_cast<detail::TimerEntry*>(timer);
+                    std::shared_ptr<detail::TimerEntry> owner = std::move(entry->self);
+                    if (entry->period == 0) {
+                        entry->phase = detail::TimerEntry::Phase::Done;
+                        tasks.push_back(std::move(entry->task));
+                    } else {
+                        entry->phase = detail::TimerEntry::Phase::Running;
+                        tasks.push_back(TaskPtr(new PeriodicRun(state, std::move(owner))));
+                    }
+                }
+                due.clear();
+
+                // Awake: timers armed meanwhile are seen on the next pass
+                s.wakeTick = 0;
+                lock.unlock();
+                dispatch(std::move(tasks));
+                tasks.clear();
+                lock.lock();
+                continue;
+            }
+
+            s.wakeTick = s.wheel.nextExpiry();
+            auto woken = [&s]() { return s.stopped || s.rescan; };
+            if (s.wakeTick == TimerWheel::NoExpiry) {
+                s.cond.wait(lock, woken);
+            } else {
+                s.cond.wait_until(lock, s.origin + static_cast<int64_t>(s.wakeTick) * Tick, woken);
+            }
+            s.rescan = false;
+        }
+    }
+
+    std::shared_ptr<detail::TimerState> state; // Shared with the handles and the periodic runs
+    Dispatch dispatch;                         // Hands the due tasks over to the pool
+    std::unique_ptr<PcoThread> thread;         // The timer thread, under the state's mutex
+};
+
+inline bool ScheduledTask::cancel() {
+    std::shared_ptr<detail::TimerState> s = state.lock();
+    if (!s || !entry) {
+        return false;
+    }
+    return TimerQueue::cancel(*s, *entry);
+}
+
+#endif // TIMERWHEEL_H
@@ -6,6 +6,9 @@
  * - Surbeck Léon
  */
 #include <chrono>
+#include <ctime>
+#include <set>
+#include <sstream>
 
 #include <gtest/gtest.h>
 
@@ -13,6 +16,13 @@
 #include <pcosynchro/pcothread.h>
 
 #include "threadpool.h"
+#include "taskgraph.h"
+#include "parallelloop.h"
+#include "poollog.h"
+#include "coroutinetask.h"
+#include "timerwheel.h"
+#include "strand.h"
+#include "executorservice.h"
 
 
 #define RUNTIME 100000
@@ -173,6 +183,42 @@ public:
 };
 
 
+///
+/// \brief The CountingRunnable class
+/// A Runnable that does no work and only counts how many times it was run or cancelled.
+/// Used by the testcases that submit a large number of tiny tasks.
+class CountingRunnable : public Runnable
+{
+    //! Counter incremented by run()
+    std::atomic<int> &m_nbRuns;
+
+    //! Counter incremented by cancelRun()
+    std::atomic<int> &m_nbCancels;
+
+public:
+
+    ///
+    /// \brief CountingRunnable Simple constructor
+    /// \param nbRuns Counter incremented when the Runnable is run
+    /// \param nbCancels Counter incremented when the Runnable is cancelled
+    ///
+    CountingRunnable(std::atomic<int> &nbRuns, std::atomic<int> &nbCancels) : m_nbRuns(nbRuns), m_nbCancels(nbCancels) {
+    }
+
+    void run() override {
+        ++m_nbRuns;
+    }
+
+    std::string id() override {
+        return "Counting";
+    }
+
+    void cancelRun() override {
+        ++m_nbCancels;
+    }
+};
+
+
 typedef struct {
     int thread_id;
     std::unique_ptr<TestRunnable> runnable;
@@ -470,6 +516,1785 @@ TEST_F(ThreadpoolTest, testDynamicIdleTimeout) {
     EXPECT_EQ(pool.currentNbThreads(), 0);
 }
 
+/// \brief A test to verify that idle threads sleep instead of spinning
+/// This test lets 10 threads go idle with a long timeout and checks that the pool
+/// burns almost no CPU time while they are parked.
+TEST_F(ThreadpoolTest, testIdleThreadsDoNotSpin) {
+    ThreadPool pool(10, 100, std::chrono::milliseconds{2000});
+
+    for (int i = 0; i < 10; i++) {
+        std::string id = "Task_" + std::to_string(i);
+        auto runnable = std::make_unique<TestRunnable>(this, id, 10000); // 10 ms
+        pool.start(std::move(runnable));
+    }
+
+    PcoThread::usleep(50000); // Let every task finish
+
+    std::clock_t cpuStart = std::clock();
+    PcoThread::usleep(500000); // Threads are idle for 500 ms
+    std::clock_t cpuEnd = std::clock();
+
+    // The threads are still alive, but parked
+    EXPECT_EQ(pool.currentNbThreads(), 10);
+    EXPECT_LT(1000.0 * (cpuEnd - cpuStart) / CLOCKS_PER_SEC, 50.0) << "Idle threads are spinning";
+}
+
+/// \brief A test of the lock-free queue backend under concurrent producers
+/// 4 threads submit 500 empty tasks each, every one of them has to be run exactly once.
+TEST_F(ThreadpoolTest, testLockFreeBackend) {
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    std::atomic<int> nbAccepted{0};
+    {
+        ThreadPool pool(4, 2000, std::chrono::milliseconds{100}, QueueBackend::LockFree);
+        std::vector<std::unique_ptr<PcoThread>> producers;
+
+        for (int p = 0; p < 4; p++) {
+            producers.push_back(std::make_unique<PcoThread>([&]() {
+                for (int i = 0; i < 500; i++) {
+                    if (pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels))) {
+                        ++nbAccepted;
+                    }
+                }
+            }));
+        }
+        for (auto &producer : producers) {
+            producer->join();
+        }
+
+        PcoThread::usleep(200000); // Let the workers drain the ring
+    }
+
+    EXPECT_EQ(nbAccepted, 2000);
+    EXPECT_EQ(nbRuns, 2000);
+    EXPECT_EQ(nbCancels, 0);
+}
+
+/// \brief A test of the lock-free queue backend with a small ring under contention
+/// A push landing on a cell a consumer is still freeing is refused, never lost: every task
+/// runs or is cancelled, and the global count gives back every slot.
+TEST_F(ThreadpoolTest, testLockFreeBackendContention) {
+    LockFreeLanes<int> lanes(2, WaitingLimit::Global);
+    std::atomic<long> nbPushed{0};
+    std::atomic<long> nbPopped{0};
+    std::atomic<bool> producing{true};
+    std::vector<std::unique_ptr<PcoThread>> threads;
+    for (int p = 0; p < 3; ++p) {
+        threads.push_back(std::make_unique<PcoThread>([&lanes, &nbPushed, p]() {
+            for (int i = 0; i < 20000; ++i) {
+                int value = 1;
+                if (lanes.tryPush(value, static_cast<TaskPriority>(p % 3))) {
+                    ++nbPushed;
+                }
+            }
+        }));
+    }
+    std::vector<std::unique_ptr<PcoThread>> consumers;
+    for (int c = 0; c < 3; ++c) {
+        consumers.push_back(std::make_unique<PcoThread>([&lanes, &nbPopped, &producing]() {
+            int value = 0;
+            while (producing || !lanes.empty()) {
+                if (lanes.tryPop(value)) {
+                    nbPopped += value;
+                }
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread->join();
+    }
+    producing = false;
+    for (auto &consumer : consumers) {
+        consumer->join();
+    }
+    EXPECT_EQ(nbPopped.load(), nbPushed.load());
+    int value = 1;
+    EXPECT_TRUE(lanes.tryPush(value, TaskPriority::Normal));
+    EXPECT_TRUE(lanes.tryPush(value, TaskPriority::High));
+    EXPECT_FALSE(lanes.tryPush(value, TaskPriority::Low));
+
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    std::atomic<int> nbAccepted{0};
+    {
+        ThreadPool pool(4, 4, std::chrono::milliseconds{100}, QueueBackend::LockFree);
+        std::vector<std::unique_ptr<PcoThread>> producers;
+        for (int p = 0; p < 4; ++p) {
+            producers.push_back(std::make_unique<PcoThread>([&]() {
+                for (int i = 0; i < 2000; ++i) {
+                    if (pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels))) {
+                        ++nbAccepted;
+                    }
+                }
+            }));
+        }
+        for (auto &producer : producers) {
+            producer->join();
+        }
+        pool.shutdown();
+        EXPECT_TRUE(pool.awaitTermination(std::chrono::seconds{5}));
+    }
+    EXPECT_EQ(nbRuns.load(), nbAccepted.load());
+    EXPECT_EQ(nbRuns + nbCancels, 8000);
+}
+
+/// \brief A test of the lock-free queue backend when the ring is full
+/// With a single busy thread and 2 slots, the third waiting task is rejected through cancelRun()
+/// and start() returns at once instead of blocking.
+TEST_F(ThreadpoolTest, testLockFreeBackendOverflow) {
+    initTestCase();
+    ThreadPool pool(1, 2, std::chrono::milliseconds{100}, QueueBackend::LockFree);
+
+    for (int i = 0; i < 4; i++) {
+        std::string id = "Task_" + std::to_string(i);
+        runnableStarted(id);
+        bool startStatus = pool.start(std::make_unique<TestRunnable>(this, id));
+        EXPECT_EQ(startStatus, i < 3);
+        if (i == 0) {
+            PcoThread::usleep(20000); // Let the thread pick the first task
+        }
+    }
+
+    // The rejected task was cancelled right away
+    EXPECT_EQ(m_runningState["Task_3"], false);
+    EXPECT_LT(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now() - startingTime).count(), RUNTIMEINMS) << "start() blocked";
+
+    PcoThread::usleep(1000 * (3 * RUNTIMEINMS + 30));
+
+    for (const auto& [key, value] : m_runningState) {
+        EXPECT_EQ(value, false) << key;
+    }
+}
+
+/// \brief A test of work stealing with recursively spawned tasks
+/// Every task of a binary tree of depth 10 spawns its two children from inside run().
+/// The queue only accepts 4 waiting tasks, so the 2047 tasks can only get through if the
+/// subtasks go to the local deques of the threads.
+TEST_F(ThreadpoolTest, testWorkStealing) {
+    class SpawningRunnable : public Runnable {
+    private:
+        ThreadPool &pool;
+        int depth;
+        std::atomic<int> &nbLeaves;
+
+    public:
+        SpawningRunnable(ThreadPool &pool, int depth, std::atomic<int> &nbLeaves)
+            : pool(pool), depth(depth), nbLeaves(nbLeaves) {}
+
+        void run() override {
+            if (depth == 0) {
+                ++nbLeaves;
+                return;
+            }
+            EXPECT_TRUE(pool.start(std::make_unique<SpawningRunnable>(pool, depth - 1, nbLeaves)));
+            EXPECT_TRUE(pool.start(std::make_unique<SpawningRunnable>(pool, depth - 1, nbLeaves)));
+        }
+
+        void cancelRun() override {}
+
+        std::string id() override {
+            return "Spawning_" + std::to_string(depth);
+        }
+    };
+
+    for (auto backend : {QueueBackend::Monitor, QueueBackend::LockFree}) {
+        std::atomic<int> nbLeaves{0};
+        {
+            ThreadPool pool(4, 4, std::chrono::milliseconds{100}, backend);
+            EXPECT_TRUE(pool.start(std::make_unique<SpawningRunnable>(pool, 10, nbLeaves)));
+
+            for (int i = 0; i < 100 && nbLeaves < 1024; i++) {
+                PcoThread::usleep(10000);
+            }
+        }
+        EXPECT_EQ(nbLeaves, 1024);
+    }
+}
+
+/// \brief A test of the thread accounting under bursty traffic
+/// 30 bursts of 4 tasks are separated by pauses longer than the idle timeout,
+/// so every burst creates new threads that expire (and are reaped) before the next one.
+TEST_F(ThreadpoolTest, testBurstyThreadAccounting) {
+    ThreadPool pool(4, 100, std::chrono::milliseconds{2});
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+
+    for (int burst = 0; burst < 30; burst++) {
+        for (int i = 0; i < 4; i++) {
+            EXPECT_TRUE(pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels)));
+        }
+        EXPECT_LE(pool.currentNbThreads(), 4);
+        PcoThread::usleep(20000);
+        EXPECT_EQ(pool.currentNbThreads(), 0);
+    }
+
+    EXPECT_EQ(nbRuns, 120);
+}
+
+/// \brief A test of batch submission
+/// A batch of 20 tasks on 4 threads and 10 queue slots accepts the first 14 tasks
+/// and cancels the 6 others. A batch of 500 tasks on the lock-free backend is fully run.
+/// With OverflowPolicy::CallerRuns, the tasks left out of a batch are run by the caller.
+TEST_F(ThreadpoolTest, testStartBatch) {
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    {
+        ThreadPool pool(4, 10, std::chrono::milliseconds{100});
+        std::vector<std::unique_ptr<Runnable>> batch;
+        for (int i = 0; i < 20; i++) {
+            batch.push_back(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+        }
+
+        auto status = pool.startBatch(batch.begin(), batch.end());
+        ASSERT_EQ(status.size(), 20u);
+        for (int i = 0; i < 20; i++) {
+            EXPECT_EQ(status[i], i < 14) << i;
+        }
+        PcoThread::usleep(50000);
+    }
+    EXPECT_EQ(nbRuns, 14);
+    EXPECT_EQ(nbCancels, 6);
+
+    nbRuns = 0;
+    nbCancels = 0;
+    {
+        ThreadPool pool(2, 1000, std::chrono::milliseconds{100}, QueueBackend::LockFree);
+        std::vector<std::unique_ptr<Runnable>> batch;
+        for (int i = 0; i < 500; i++) {
+            batch.push_back(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+        }
+
+        auto status = pool.startBatch(std::move(batch));
+        EXPECT_EQ(std::count(status.begin(), status.end(), true), 500);
+        PcoThread::usleep(50000);
+    }
+    EXPECT_EQ(nbRuns, 500);
+    EXPECT_EQ(nbCancels, 0);
+
+    nbRuns = 0;
+    {
+        ThreadPool pool(1, 1, std::chrono::milliseconds{100});
+        pool.enableMetrics();
+        pool.setOverflowPolicy(OverflowPolicy::CallerRuns);
+        std::vector<std::unique_ptr<Runnable>> batch;
+        for (int i = 0; i < 6; i++) {
+            batch.push_back(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+        }
+
+        auto status = pool.startBatch(std::move(batch));
+        EXPECT_EQ(std::count(status.begin(), status.end(), true), 6);
+        EXPECT_EQ(pool.snapshot().tasksRunByCaller, 4u);
+        pool.shutdown(true);
+        EXPECT_TRUE(pool.awaitTermination(std::chrono::seconds{5}));
+    }
+    EXPECT_EQ(nbRuns, 6);
+    EXPECT_EQ(nbCancels, 0);
+}
+
+/// \brief A test of the non-blocking and timed submissions
+/// With a single busy thread and a single queue slot, trySubmit() queues a task without
+/// blocking and then reports a full queue, submitFor() gives up after its timeout or
+/// succeeds once the thread frees the slot.
+TEST_F(ThreadpoolTest, testTrySubmitAndSubmitFor) {
+    for (auto backend : {QueueBackend::Monitor, QueueBackend::LockFree}) {
+        ThreadPool pool(1, 1, std::chrono::milliseconds{100}, backend);
+        auto now = []() { return std::chrono::steady_clock::now(); };
+        auto elapsedMs = [&now](auto since) {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(now() - since).count();
+        };
+
+        runnableStarted("Long");
+        EXPECT_EQ(pool.trySubmit(std::make_unique<TestRunnable>(this, "Long")), SubmitStatus::Accepted);
+        PcoThread::usleep(10000); // Let the thread pick the task
+
+        auto since = now();
+        runnableStarted("Queued");
+        EXPECT_EQ(pool.trySubmit(std::make_unique<TestRunnable>(this, "Queued")), SubmitStatus::Accepted);
+        runnableStarted("Rejected");
+        EXPECT_EQ(pool.trySubmit(std::make_unique<TestRunnable>(this, "Rejected")), SubmitStatus::QueueFull);
+        EXPECT_EQ(m_runningState["Rejected"], false) << "cancelRun() not called";
+        EXPECT_LT(elapsedMs(since), 10) << "trySubmit() blocked";
+
+        since = now();
+        runnableStarted("TimedOut");
+        EXPECT_EQ(pool.submitFor(std::make_unique<TestRunnable>(this, "TimedOut"), std::chrono::milliseconds{30}), SubmitStatus::QueueFull);
+        EXPECT_EQ(m_runningState["TimedOut"], false) << "cancelRun() not called";
+        EXPECT_GE(elapsedMs(since), 30);
+        EXPECT_LT(elapsedMs(since), 60);
+
+        // The long task ends about 100 ms after it started, freeing the slot
+        runnableStarted("Waited");
+        EXPECT_EQ(pool.submitFor(std::make_unique<TestRunnable>(this, "Waited"), std::chrono::milliseconds{500}), SubmitStatus::Accepted);
+        EXPECT_LT(elapsedMs(since), 100);
+
+        PcoThread::usleep(1000 * (2 * RUNTIMEINMS + 30));
+        for (const auto& [key, value] : m_runningState) {
+            EXPECT_EQ(value, false) << key;
+        }
+    }
+}
+
+/// \brief A test of the submission of plain callables
+/// Checks the returned value, the arguments, the propagation of exceptions, and that a
+/// callable rejected on overflow makes its future throw TaskCancelledError.
+TEST_F(ThreadpoolTest, testSubmitCallable) {
+    ThreadPool pool(1, 1, std::chrono::milliseconds{100}, QueueBackend::LockFree);
+
+    int base = 40;
+    auto add = [base](int value) { return base + value; };
+    static_assert(FunctionTask::fitsInline<PackagedCall<int, decltype(add), int>>(), "Small captures must not allocate");
+
+    auto sum = pool.submit(add, 2);
+    EXPECT_EQ(sum.get(), 42);
+    EXPECT_FALSE(sum.valid());
+
+    auto text = pool.submit([](std::string a, std::string b) { return a + b; }, std::string("Thread"), std::string("Pool"));
+    EXPECT_EQ(text.get(), "ThreadPool");
+
+    auto failing = pool.submit([]() -> int { throw std::runtime_error("Failure"); });
+    EXPECT_THROW(failing.get(), std::runtime_error);
+
+    // One task running, one waiting in the single slot, the third one overflows
+    auto sleeping = pool.submit([]() { PcoThread::usleep(50000); });
+    PcoThread::usleep(10000);
+    auto waiting = pool.submit([]() { return 1; });
+    auto rejected = pool.submit([]() { return 2; });
+    EXPECT_TRUE(rejected.isReady());
+    EXPECT_THROW(rejected.get(), TaskCancelledError);
+    EXPECT_EQ(waiting.get(), 1);
+    EXPECT_NO_THROW(sleeping.get());
+}
+
+/// \brief A test for the tasks allocated in the pool's slab
+/// Tasks built with makeTask() from outside and from inside the pool must all run, including
+/// types too big for the slab, and the blocks must survive many reuse cycles.
+TEST_F(ThreadpoolTest, testSlabAllocatedTasks) {
+    struct BigRunnable : public CountingRunnable {
+        using CountingRunnable::CountingRunnable;
+        char padding[1024] = {};
+    };
+
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    {
+        ThreadPool pool(4, 1000, std::chrono::milliseconds{100}, QueueBackend::LockFree);
+        for (int i = 0; i < 500; ++i) {
+            if (!pool.start(pool.makeTask<CountingRunnable>(nbRuns, nbCancels))) {
+                PcoThread::usleep(100); // The ring is full, cancelRun() was called
+            }
+        }
+        EXPECT_TRUE(pool.start(pool.makeTask<BigRunnable>(nbRuns, nbCancels)));
+
+        // Tasks submitted by the workers use their own slab cache
+        std::vector<TaskFuture<void>> futures;
+        for (int i = 0; i < 20; ++i) {
+            futures.push_back(pool.submit([&pool, &nbRuns, &nbCancels]() {
+                for (int j = 0; j < 100; ++j) {
+                    pool.start(pool.makeTask<CountingRunnable>(nbRuns, nbCancels));
+                }
+            }));
+        }
+        for (auto &future : futures) {
+            future.get();
+        }
+        for (int i = 0; i < 500 && nbRuns + nbCancels < 500 + 1 + 20 * 100; ++i) {
+            PcoThread::usleep(10000);
+        }
+    }
+    EXPECT_EQ(nbRuns + nbCancels, 500 + 1 + 20 * 100);
+}
+
+/// \brief A test for the priority lanes of the waiting queue
+/// High priority tasks overtake the queued low priority ones, aging still lets a low priority
+/// task through a flood of high priority ones, and the limit can be set per lane.
+TEST_F(ThreadpoolTest, testPriorityLanes) {
+    struct RecordingRunnable : public Runnable {
+        std::mutex &mutex;
+        std::vector<std::string> &order;
+        std::string name;
+
+        RecordingRunnable(std::mutex &mutex, std::vector<std::string> &order, std::string name)
+            : mutex(mutex), order(order), name(std::move(name)) {}
+
+        void run() override {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(name);
+        }
+        void cancelRun() override {}
+        std::string id() override { return name; }
+    };
+
+    for (auto backend : {QueueBackend::Monitor, QueueBackend::LockFree}) {
+        std::mutex orderMutex;
+        std::vector<std::string> order;
+        auto make = [&](const std::string &name) {
+            return std::make_unique<RecordingRunnable>(orderMutex, order, name);
+        };
+        {
+            ThreadPool pool(1, 50, std::chrono::milliseconds{100}, backend);
+            auto blocker = pool.submit([]() { PcoThread::usleep(50000); });
+            PcoThread::usleep(10000);
+
+            for (int i = 0; i < 3; ++i) {
+                EXPECT_EQ(pool.trySubmit(make("Low"), TaskPriority::Low), SubmitStatus::Accepted);
+            }
+            for (int i = 0; i < 2; ++i) {
+                EXPECT_EQ(pool.trySubmit(make("High"), TaskPriority::High), SubmitStatus::Accepted);
+            }
+            blocker.get();
+            PcoThread::usleep(50000);
+        }
+        ASSERT_EQ(order.size(), 5u);
+        EXPECT_EQ(order[0], "High");
+        EXPECT_EQ(order[1], "High");
+        EXPECT_EQ(order[2], "Low");
+
+        // Flood of high priority tasks behind a single low priority one
+        order.clear();
+        {
+            ThreadPool pool(1, 50, std::chrono::milliseconds{100}, backend);
+            auto blocker = pool.submit([]() { PcoThread::usleep(50000); });
+            PcoThread::usleep(10000);
+
+            EXPECT_EQ(pool.trySubmit(make("Low"), TaskPriority::Low), SubmitStatus::Accepted);
+            for (int i = 0; i < 30; ++i) {
+                EXPECT_EQ(pool.trySubmit(make("High"), TaskPriority::High), SubmitStatus::Accepted);
+            }
+            blocker.get();
+            PcoThread::usleep(50000);
+        }
+        auto low = std::find(order.begin(), order.end(), "Low");
+        ASSERT_NE(low, order.end());
+        EXPECT_LE(low - order.begin(), static_cast<long>(Lanes::AgingThreshold));
+    }
+
+    // Each priority has its own maxNbWaiting slots
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    ThreadPool pool(1, 2, std::chrono::milliseconds{100}, QueueBackend::Monitor, WaitingLimit::PerLane);
+    auto blocker = pool.submit([]() { PcoThread::usleep(50000); });
+    PcoThread::usleep(10000);
+    EXPECT_EQ(pool.trySubmit(std::make_unique<CountingRunnable>(nbRuns, nbCancels), TaskPriority::Low), SubmitStatus::Accepted);
+    EXPECT_EQ(pool.trySubmit(std::make_unique<CountingRunnable>(nbRuns, nbCancels), TaskPriority::Low), SubmitStatus::Accepted);
+    EXPECT_EQ(pool.trySubmit(std::make_unique<CountingRunnable>(nbRuns, nbCancels), TaskPriority::Low), SubmitStatus::QueueFull);
+    EXPECT_EQ(pool.trySubmit(std::make_unique<CountingRunnable>(nbRuns, nbCancels), TaskPriority::High), SubmitStatus::Accepted);
+    blocker.get();
+}
+
+/// \brief A test for the metrics returned by snapshot()
+/// Counts must match what the pool did once the metrics are enabled, and nothing is
+/// recorded while they are disabled.
+TEST_F(ThreadpoolTest, testMetricsSnapshot) {
+    struct ThrowingRunnable : public Runnable {
+        void run() override { throw std::runtime_error("expected failure"); }
+        void cancelRun() override {}
+        std::string id() override { return "Throwing"; }
+    };
+
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    ThreadPool pool(2, 1, std::chrono::milliseconds{20}, QueueBackend::LockFree);
+
+    // Disabled by default
+    pool.submit([]() {}).get();
+    EXPECT_EQ(pool.snapshot().tasksSubmitted, 0u);
+
+    pool.enableMetrics();
+    std::vector<TaskFuture<void>> futures;
+    for (int i = 0; i < 10; ++i) {
+        futures.push_back(pool.submit([]() { PcoThread::usleep(1000); }));
+        futures.back().wait();
+    }
+    pool.start(std::make_unique<ThrowingRunnable>());
+    PcoThread::usleep(10000);
+
+    // Two busy threads and a full ring: the fourth task is rejected
+    auto first = pool.submit([]() { PcoThread::usleep(50000); });
+    PcoThread::usleep(10000);
+    auto second = pool.submit([]() { PcoThread::usleep(50000); });
+    PcoThread::usleep(10000);
+    EXPECT_TRUE(pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels)));
+    EXPECT_FALSE(pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels)));
+    first.get();
+    second.get();
+
+    // Let the threads expire
+    PcoThread::usleep(200000);
+
+    PoolMetrics metrics = pool.snapshot();
+    EXPECT_EQ(metrics.tasksSubmitted, 15u);
+    EXPECT_EQ(metrics.tasksRejected, 1u);
+    EXPECT_EQ(metrics.tasksRun, 14u);
+    EXPECT_EQ(metrics.tasksFailed, 1u);
+    EXPECT_EQ(metrics.runTime.count, 14u);
+    EXPECT_EQ(metrics.waitTime.count, 14u);
+    EXPECT_GE(metrics.runTime.percentile(0.99), std::chrono::milliseconds(50));
+    EXPECT_GE(metrics.runTime.mean(), std::chrono::microseconds(1000));
+    EXPECT_GE(metrics.threadsExpired, 1u);
+    EXPECT_EQ(metrics.queueDepth, 0u);
+    EXPECT_EQ(metrics.nbThreads, pool.currentNbThreads());
+    EXPECT_EQ(nbCancels, 1);
+
+    // An expiry is only counted once the thread left, even with tasks arriving while it retires
+    std::atomic<int> nbChurnRuns{0};
+    std::atomic<int> nbChurnCancels{0};
+    ThreadPool churning(4, 64, std::chrono::milliseconds{1}, QueueBackend::LockFree);
+    churning.enableMetrics();
+    for (int round = 0; round < 50; ++round) {
+        for (int i = 0; i < 8; ++i) {
+            churning.start(std::make_unique<CountingRunnable>(nbChurnRuns, nbChurnCancels));
+        }
+        PcoThread::usleep(2000);
+    }
+    PcoThread::usleep(200000);
+    metrics = churning.snapshot();
+    EXPECT_EQ(metrics.nbThreads, 0u);
+    EXPECT_EQ(metrics.threadsExpired, metrics.threadsCreated);
+}
+
+/// \brief A test for the core threads
+/// prestart() creates minThreadCount threads, the threads above it expire through
+/// idleTimeout while the core threads stay, with both backends.
+TEST_F(ThreadpoolTest, testCoreThreads) {
+    for (auto backend : {QueueBackend::Monitor, QueueBackend::LockFree}) {
+        ThreadPool pool(4, 10, std::chrono::milliseconds{20}, backend, WaitingLimit::Global, 2);
+        EXPECT_EQ(pool.currentNbThreads(), 0u);
+        EXPECT_EQ(pool.prestart(), 2u);
+        EXPECT_EQ(pool.currentNbThreads(), 2u);
+        EXPECT_EQ(pool.prestart(), 0u);
+
+        // Idle core threads do not expire
+        PcoThread::usleep(100000);
+        EXPECT_EQ(pool.currentNbThreads(), 2u);
+
+        std::vector<TaskFuture<void>> futures;
+        for (int i = 0; i < 4; ++i) {
+            futures.push_back(pool.submit([]() { PcoThread::usleep(30000); }));
+        }
+        for (auto &future : futures) {
+            future.get();
+        }
+        EXPECT_EQ(pool.currentNbThreads(), 4u);
+
+        // Only the threads above the core size expire
+        PcoThread::usleep(200000);
+        EXPECT_EQ(pool.currentNbThreads(), 2u);
+    }
+
+    // Core threads are also kept with a zero idleTimeout
+    ThreadPool pool(4, 10, std::chrono::milliseconds{0}, QueueBackend::Monitor, WaitingLimit::Global, 1);
+    pool.submit([]() {}).get();
+    PcoThread::usleep(20000);
+    EXPECT_EQ(pool.currentNbThreads(), 1u);
+
+    EXPECT_THROW(ThreadPool(2, 10, std::chrono::milliseconds{10}, QueueBackend::Monitor, WaitingLimit::Global, 3),
+                 std::invalid_argument);
+    EXPECT_THROW(ThreadPool(2, 10, std::chrono::milliseconds{10}, QueueBackend::Monitor, WaitingLimit::Global, -1),
+                 std::invalid_argument);
+}
+
+/// \brief A test for the order in which idle threads are reused and expire
+/// A task goes to the most recently parked thread, and idleTimeout expires the thread parked
+/// for the longest time, with both backends.
+TEST_F(ThreadpoolTest, testIdleExpiryOrder) {
+    for (auto backend : {QueueBackend::Monitor, QueueBackend::LockFree}) {
+        ThreadPool pool(2, 10, std::chrono::milliseconds{600}, backend);
+        std::atomic<size_t> oldest{0};
+        std::atomic<size_t> newest{0};
+        std::atomic<bool> started{false};
+
+        // Two threads, the first one parking 300 ms before the second
+        auto first = pool.submit([&]() {
+            oldest = ThreadInfo::current()->getId();
+            while (!started) {
+                PcoThread::usleep(1000);
+            }
+        });
+        auto second = pool.submit([&]() {
+            newest = ThreadInfo::current()->getId();
+            started = true;
+            PcoThread::usleep(300000);
+        });
+        first.get();
+        second.get();
+        ASSERT_NE(oldest.load(), newest.load());
+        EXPECT_EQ(pool.currentNbThreads(), 2u);
+
+        // The newest idle thread runs the next task and parks again, the oldest one expires first
+        PcoThread::usleep(100000);
+        EXPECT_EQ(pool.submit([]() { return ThreadInfo::current()->getId(); }).get(), newest.load());
+        PcoThread::usleep(400000);
+        EXPECT_EQ(pool.currentNbThreads(), 1u);
+        EXPECT_EQ(pool.submit([]() { return ThreadInfo::current()->getId(); }).get(), newest.load());
+    }
+}
+
+/// \brief A test for the placement of the threads on the CPUs
+/// Checks the parsing of the sysfs CPU lists, the pinning of PinCores threads and the
+/// node queues of PerNode.
+TEST_F(ThreadpoolTest, testPlacement) {
+    EXPECT_EQ(CpuTopology::parseCpuList("0-3,8,10-11\n"), (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    CpuTopology twoNodes({{0, 1, 2}, {4, 5}});
+    EXPECT_EQ(twoNodes.interleavedCpus(), (std::vector<int>{0, 4, 1, 5, 2}));
+    EXPECT_EQ(twoNodes.nodeOf(5), 1u);
+
+    CpuTopology machine = CpuTopology::detect();
+    ASSERT_GE(machine.nbNodes(), 1u);
+    EXPECT_FALSE(machine.cpusOf(0).empty());
+
+#ifdef __linux__
+    ThreadPool pinned(2, 10, std::chrono::milliseconds{100}, QueueBackend::Monitor, WaitingLimit::Global, 0,
+                      Placement::PinCores);
+    auto nbCpus = pinned.submit([]() {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        sched_getaffinity(0, sizeof(set), &set);
+        return CPU_COUNT(&set);
+    });
+    EXPECT_EQ(nbCpus.get(), 1);
+#endif
+
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    ThreadPool pool(2, 10, std::chrono::milliseconds{100}, QueueBackend::LockFree, WaitingLimit::Global, 0,
+                    Placement::PerNode);
+    EXPECT_EQ(pool.nbNodes(), machine.nbNodes());
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_TRUE(pool.startOnNode(std::make_unique<CountingRunnable>(nbRuns, nbCancels), pool.nbNodes() - 1));
+    }
+    EXPECT_THROW(pool.startOnNode(std::make_unique<CountingRunnable>(nbRuns, nbCancels), pool.nbNodes()),
+                 std::invalid_argument);
+    for (int i = 0; i < 100 && nbRuns < 5; ++i) {
+        PcoThread::usleep(1000);
+    }
+    EXPECT_EQ(nbRuns, 5);
+    EXPECT_EQ(ThreadPool(1, 1, std::chrono::milliseconds{10}).nbNodes(), 1u);
+}
+
+/// \brief A test for the shutdown of the pool
+/// shutdown() runs the queued tasks before the threads exit, including the subtasks pushed
+/// while draining, shutdownNow() cancels them through cancelRun(), with both backends.
+TEST_F(ThreadpoolTest, testShutdown) {
+    class SleepingRunnable : public Runnable {
+    private:
+        std::atomic<int> &nbRuns;
+        std::atomic<int> &nbCancels;
+        uint64_t runTimeInUs;
+
+    public:
+        SleepingRunnable(std::atomic<int> &nbRuns, std::atomic<int> &nbCancels, uint64_t runTimeInUs)
+            : nbRuns(nbRuns), nbCancels(nbCancels), runTimeInUs(runTimeInUs) {}
+
+        void run() override {
+            PcoThread::usleep(runTimeInUs);
+            ++nbRuns;
+        }
+
+        void cancelRun() override {
+            ++nbCancels;
+        }
+
+        std::string id() override {
+            return "Sleeping";
+        }
+    };
+
+    for (auto backend : {QueueBackend::Monitor, QueueBackend::LockFree}) {
+        std::atomic<int> nbRuns{0};
+        std::atomic<int> nbCancels{0};
+        {
+            ThreadPool pool(2, 20, std::chrono::milliseconds{100}, backend);
+            auto parent = pool.submit([&pool, &nbRuns]() {
+                PcoThread::usleep(20000);
+                for (int i = 0; i < 4; ++i) {
+                    pool.submit([&nbRuns]() { ++nbRuns; });
+                }
+            });
+            for (int i = 0; i < 10; ++i) {
+                EXPECT_EQ(pool.trySubmit(std::make_unique<SleepingRunnable>(nbRuns, nbCancels, 5000)),
+                          SubmitStatus::Accepted);
+            }
+            pool.shutdown();
+            EXPECT_EQ(pool.trySubmit(std::make_unique<SleepingRunnable>(nbRuns, nbCancels, 0)),
+                      SubmitStatus::ShuttingDown);
+            EXPECT_TRUE(pool.awaitTermination(std::chrono::seconds{5}));
+            EXPECT_EQ(pool.currentNbThreads(), 0u);
+            EXPECT_NO_THROW(parent.get());
+        }
+        EXPECT_EQ(nbRuns, 14);
+        EXPECT_EQ(nbCancels, 0);
+
+        nbRuns = 0;
+        {
+            ThreadPool pool(1, 20, std::chrono::milliseconds{100}, backend);
+            pool.enableMetrics();
+            pool.trySubmit(std::make_unique<SleepingRunnable>(nbRuns, nbCancels, 50000));
+            PcoThread::usleep(10000);
+            for (int i = 0; i < 9; ++i) {
+                pool.trySubmit(std::make_unique<SleepingRunnable>(nbRuns, nbCancels, 5000));
+            }
+            EXPECT_EQ(pool.shutdownNow(), 9u);
+            EXPECT_EQ(nbCancels, 9);
+            EXPECT_EQ(pool.snapshot().tasksCancelled, 9u);
+
+            // The running task is let to finish
+            EXPECT_FALSE(pool.awaitTermination(std::chrono::milliseconds{1}));
+            EXPECT_TRUE(pool.awaitTermination(std::chrono::seconds{5}));
+        }
+        EXPECT_EQ(nbRuns, 1);
+        nbCancels = 0;
+    }
+
+    // Tasks still queued when the pool is destroyed are cancelled
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    {
+        ThreadPool pool(1, 20, std::chrono::milliseconds{100});
+        pool.trySubmit(std::make_unique<SleepingRunnable>(nbRuns, nbCancels, 20000));
+        PcoThread::usleep(5000);
+        for (int i = 0; i < 5; ++i) {
+            pool.trySubmit(std::make_unique<SleepingRunnable>(nbRuns, nbCancels, 0));
+        }
+    }
+    EXPECT_EQ(nbRuns + nbCancels, 6);
+    EXPECT_EQ(nbCancels, 5);
+}
+
+/// \brief A test for the spin-then-park idle strategy
+/// With a spin budget, tasks submitted one after the other are picked up by the spinning
+/// thread, and the threads still end up parked once there is no more work, with both backends.
+TEST_F(ThreadpoolTest, testSpinThenPark) {
+    for (auto backend : {QueueBackend::Monitor, QueueBackend::LockFree}) {
+        ThreadPool pool(2, 10, std::chrono::milliseconds{1000}, backend);
+        pool.setIdleStrategy(IdleStrategy{50000, 100, true});
+        pool.enableMetrics();
+
+        std::atomic<int> nbRuns{0};
+        for (int i = 0; i < 200; ++i) {
+            pool.submit([&nbRuns]() { ++nbRuns; }).get();
+        }
+        EXPECT_EQ(nbRuns, 200);
+
+        for (int i = 0; i < 200 && pool.snapshot().nbIdleThreads < pool.currentNbThreads(); ++i) {
+            PcoThread::usleep(10000);
+        }
+        PoolMetrics metrics = pool.snapshot();
+        EXPECT_GT(metrics.spinSuccesses, 0u);
+        EXPECT_GT(metrics.spinFailures, 0u);
+        EXPECT_EQ(metrics.nbIdleThreads, pool.currentNbThreads());
+    }
+}
+
+/// \brief A test for the task graph
+/// A diamond runs in dependency order, a fan-out/fan-in runs every node once, a failing node
+/// cancels the nodes depending on it through cancelRun(), and cycles are refused.
+TEST_F(ThreadpoolTest, testTaskGraph) {
+    ThreadPool pool(4, 100, std::chrono::milliseconds{100});
+
+    // Diamond: a -> (b, c) -> d, each node records its position in the execution order
+    std::atomic<int> clock{0};
+    int stamps[4] = {-1, -1, -1, -1};
+    TaskGraph diamond(pool);
+    std::vector<TaskGraph::NodeId> ids;
+    for (int i = 0; i < 4; ++i) {
+        ids.push_back(diamond.addFunction([&clock, &stamps, i]() {
+            PcoThread::usleep(1000);
+            stamps[i] = clock++;
+        }));
+    }
+    diamond.precede(ids[0], ids[1]);
+    diamond.precede(ids[0], ids[2]);
+    diamond.precede(ids[1], ids[3]);
+    diamond.precede(ids[2], ids[3]);
+    for (int round = 0; round < 2; ++round) {
+        clock = 0;
+        diamond.run();
+        EXPECT_THROW(diamond.run(), std::logic_error);
+        diamond.wait();
+        EXPECT_EQ(stamps[0], 0);
+        EXPECT_EQ(stamps[3], 3);
+        EXPECT_EQ(diamond.cancelledCount(), 0u);
+    }
+
+    // Fan-out/fan-in of 200 nodes, started by the last predecessor of each node
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    TaskGraph fan(pool);
+    auto source = fan.add(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+    auto sink = fan.add(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+    for (int i = 0; i < 200; ++i) {
+        auto middle = fan.add(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+        fan.precede(source, middle);
+        fan.precede(middle, sink);
+    }
+    fan.run();
+    fan.wait();
+    EXPECT_EQ(nbRuns, 202);
+    EXPECT_EQ(nbCancels, 0);
+
+    // A failure cancels the whole chain below it, but not the other branch
+    nbRuns = 0;
+    TaskGraph chain(pool);
+    auto root = chain.add(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+    auto failing = chain.addFunction([]() { throw std::runtime_error("failed"); });
+    auto other = chain.add(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+    chain.precede(root, failing);
+    chain.precede(root, other);
+    auto previous = failing;
+    for (int i = 0; i < 10000; ++i) {
+        auto next = chain.add(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+        chain.precede(previous, next);
+        previous = next;
+    }
+    chain.precede(other, previous);
+    chain.run();
+    EXPECT_THROW(chain.wait(), std::runtime_error);
+    EXPECT_EQ(nbRuns, 2);
+    EXPECT_EQ(nbCancels, 10000);
+    EXPECT_EQ(chain.cancelledCount(), 10000u);
+
+    TaskGraph cycle(pool);
+    auto first = cycle.addFunction([]() {});
+    auto second = cycle.addFunction([]() {});
+    cycle.precede(first, second);
+    cycle.precede(second, first);
+    EXPECT_THROW(cycle.run(), std::logic_error);
+    EXPECT_THROW(cycle.precede(first, first), std::invalid_argument);
+    EXPECT_THROW(cycle.precede(first, 2), std::invalid_argument);
+}
+
+/// \brief A test for the parallel loops
+/// A reduce gives the sequential result, a loop visits each index exactly once, with or without
+/// a grain, an exception reaches the caller, and loops nested in a task of the pool complete.
+TEST_F(ThreadpoolTest, testParallelLoops) {
+    for (QueueBackend backend : {QueueBackend::Monitor, QueueBackend::LockFree}) {
+        ThreadPool pool(4, 100, std::chrono::milliseconds{100}, backend);
+
+        const int64_t n = 100000;
+        int64_t sum = parallelReduce(pool, int64_t{0}, n, int64_t{0},
+                                     [](int64_t partial, int64_t i) { return partial + i; },
+                                     [](int64_t left, int64_t right) { return left + right; });
+        EXPECT_EQ(sum, n * (n - 1) / 2);
+
+        // Non-commutative combine: the partial results are merged in the order of the indices
+        std::string digits = parallelReduce(pool, 0, 1000, std::string(),
+                                            [](std::string partial, int i) { return partial + char('0' + i % 10); },
+                                            [](std::string left, std::string right) { return left + right; }, 7);
+        ASSERT_EQ(digits.size(), 1000u);
+        for (int i = 0; i < 1000; ++i) {
+            EXPECT_EQ(digits[i], char('0' + i % 10));
+        }
+
+        for (size_t grain : {size_t{0}, size_t{1}, size_t{64}}) {
+            std::vector<std::atomic<int>> visits(5000);
+            parallelFor(pool, 0, 5000, [&visits](int i) { visits[i]++; }, grain);
+            for (auto &visit : visits) {
+                EXPECT_EQ(visit, 1);
+            }
+        }
+
+        int nbCalls = 0;
+        parallelFor(pool, 10, 10, [&nbCalls](int) { nbCalls++; });
+        EXPECT_EQ(nbCalls, 0);
+        EXPECT_EQ(parallelReduce(pool, 5, 3, 42, [](int a, int) { return a; }, [](int a, int) { return a; }), 42);
+
+        EXPECT_THROW(parallelFor(pool, 0, 10000, [](int i) {
+            if (i == 7777) {
+                throw std::runtime_error("failed");
+            }
+        }, 16), std::runtime_error);
+
+        // Each task runs a loop of its own: the worker works on it instead of blocking
+        std::vector<TaskFuture<int64_t>> results;
+        for (int t = 0; t < 8; ++t) {
+            results.push_back(pool.submit([&pool]() {
+                return parallelReduce(pool, 0, 1000, int64_t{0},
+                                      [](int64_t partial, int i) { return partial + i; },
+                                      [](int64_t left, int64_t right) { return left + right; }, 10);
+            }));
+        }
+        for (auto &result : results) {
+            EXPECT_EQ(result.get(), 999 * 1000 / 2);
+        }
+    }
+}
+
+/// \brief A test for the layout of the per-worker state
+/// The deques of a pool are allocated side by side and each must start its own cache line.
+TEST_F(ThreadpoolTest, testCacheLineLayout) {
+    static_assert(alignof(ThreadInfo) == 64, "ThreadInfo must be cache-line aligned");
+    static_assert(alignof(LocalTaskDeque) == 64, "LocalTaskDeque must be cache-line aligned");
+    static_assert(sizeof(LocalTaskDeque) % 64 == 0, "LocalTaskDeque must be padded to whole lines");
+
+    auto deques = std::make_unique<LocalTaskDeque[]>(3);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(&deques[i]) % 64, 0u);
+    }
+    auto info = std::make_unique<ThreadInfo>(0, nullptr);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(info.get()) % 64, 0u);
+}
+
+/// \brief A test for the asynchronous log sink
+/// Records of concurrent threads all reach the output in the order of their thread, numbers
+/// are formatted without a stream, a full ring drops records instead of blocking, and a task
+/// throwing from run() is reported through the sink.
+TEST_F(ThreadpoolTest, testAsyncLog) {
+    AsyncLogSink& sink = AsyncLogSink::instance();
+    std::mutex outputMutex;
+    std::vector<std::string> lines;
+    sink.setOutput([&outputMutex, &lines](LogLevel level, std::string_view text) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        lines.push_back(std::string(AsyncLogSink::levelName(level)) + " " + std::string(text));
+    });
+
+    const int nbThreads = 4;
+    const int nbRecords = 100;
+    std::vector<std::unique_ptr<PcoThread>> threads;
+    for (int t = 0; t < nbThreads; ++t) {
+        threads.push_back(std::make_unique<PcoThread>([t]() {
+            for (int i = 0; i < nbRecords; ++i) {
+                poolLog<LogLevel::Warning>("thread ", t, " record ", i);
+                if (i % 50 == 49) {
+                    PcoThread::usleep(1000);
+                }
+            }
+        }));
+    }
+    for (auto &thread : threads) {
+        thread->join();
+    }
+    poolLog<LogLevel::Debug>("compiled out");
+    poolLog<LogLevel::Info>(std::string(500, 'x'));
+    poolLog<LogLevel::Error>(-12, ' ', 2.5, ' ', true);
+    sink.flush();
+    {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        ASSERT_EQ(lines.size(), static_cast<size_t>(nbThreads * nbRecords + 2));
+        std::vector<int> next(nbThreads, 0);
+        for (size_t i = 0; i < lines.size() - 2; ++i) {
+            int t = lines[i][15] - '0';
+            EXPECT_EQ(lines[i], "WARNING thread " + std::to_string(t) + " record " + std::to_string(next[t]));
+            next[t]++;
+        }
+        EXPECT_EQ(lines[lines.size() - 2], "INFO " + std::string(LogRecord::MaxText, 'x'));
+        EXPECT_EQ(lines.back(), "ERROR -12 2.5 true");
+        lines.clear();
+    }
+
+    // The writer blocks in the output: the ring of this thread fills up and drops records
+    std::atomic<bool> inOutput{false};
+    std::atomic<bool> release{false};
+    sink.setOutput([&inOutput, &release](LogLevel, std::string_view) {
+        inOutput = true;
+        while (!release) {
+            PcoThread::usleep(100);
+        }
+    });
+    poolLog<LogLevel::Error>("first");
+    while (!inOutput) {
+        PcoThread::usleep(100);
+    }
+    uint64_t droppedBefore = sink.droppedCount();
+    for (size_t i = 0; i < LogRing::Capacity + 10; ++i) {
+        poolLog<LogLevel::Error>("filler");
+    }
+    EXPECT_GE(sink.droppedCount() - droppedBefore, 10u);
+    release = true;
+    sink.flush();
+
+    sink.setOutput([&outputMutex, &lines](LogLevel level, std::string_view text) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        lines.push_back(std::string(AsyncLogSink::levelName(level)) + " " + std::string(text));
+    });
+    class ThrowingRunnable : public Runnable {
+    public:
+        void run() override {
+            throw std::runtime_error("boom");
+        }
+        void cancelRun() override {}
+        std::string id() override {
+            return "Throwing";
+        }
+    };
+    {
+        ThreadPool pool(1, 10, std::chrono::milliseconds{100});
+        pool.start(std::make_unique<ThrowingRunnable>());
+        pool.shutdown();
+    }
+    sink.flush();
+    sink.setOutput(nullptr);
+    std::lock_guard<std::mutex> lock(outputMutex);
+    ASSERT_EQ(lines.size(), 1u);
+    EXPECT_EQ(lines[0], "ERROR Task execution failed: boom");
+}
+
+/// \brief A test for the compile-time policies
+/// A low-latency pool runs tasks and their subtasks on its fixed lock-free backend, refuses
+/// another backend, and a batch pool rejects the new task on overflow instead of the oldest.
+TEST_F(ThreadpoolTest, testPoolPolicies) {
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    {
+        BasicThreadPool<LowLatencyPoolPolicy> pool(2, 100, std::chrono::milliseconds{100});
+        for (int i = 0; i < 10; ++i) {
+            pool.submit([&pool, &nbRuns, &nbCancels]() {
+                pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+            });
+        }
+        pool.shutdown();
+        EXPECT_TRUE(pool.awaitTermination(std::chrono::seconds{5}));
+    }
+    EXPECT_EQ(nbRuns, 10);
+    EXPECT_EQ(nbCancels, 0);
+    EXPECT_THROW((BasicThreadPool<LowLatencyPoolPolicy>(1, 1, std::chrono::milliseconds{100}, QueueBackend::Monitor)),
+                 std::invalid_argument);
+
+    // The single thread is held, a producer waits with its task queued, then the queue overflows
+    class GateRunnable : public Runnable {
+    public:
+        GateRunnable(std::atomic<bool> &open, std::atomic<bool> &held) : open(open), held(held) {}
+        void run() override {
+            held = true;
+            while (!open) {
+                PcoThread::usleep(1000);
+            }
+        }
+        void cancelRun() override {}
+        std::string id() override {
+            return "Gate";
+        }
+    private:
+        std::atomic<bool> &open;
+        std::atomic<bool> &held;
+    };
+    std::atomic<bool> open{false};
+    std::atomic<bool> held{false};
+    std::atomic<int> nbRunsOld{0};
+    std::atomic<int> nbCancelsOld{0};
+    std::atomic<int> nbRunsNew{0};
+    std::atomic<int> nbCancelsNew{0};
+    BasicThreadPool<BatchPoolPolicy> pool(1, 1, std::chrono::milliseconds{100});
+    pool.start(std::make_unique<GateRunnable>(open, held));
+    while (!held) {
+        PcoThread::usleep(1000);
+    }
+    PcoThread producer([&pool, &nbRunsOld, &nbCancelsOld]() {
+        pool.start(std::make_unique<CountingRunnable>(nbRunsOld, nbCancelsOld));
+    });
+    while (pool.snapshot().queueDepth == 0) {
+        PcoThread::usleep(1000);
+    }
+    EXPECT_FALSE(pool.start(std::make_unique<CountingRunnable>(nbRunsNew, nbCancelsNew)));
+    EXPECT_EQ(nbCancelsNew, 1);
+    open = true;
+    producer.join();
+    pool.shutdown();
+    EXPECT_TRUE(pool.awaitTermination(std::chrono::seconds{5}));
+    EXPECT_EQ(nbRunsOld, 1);
+    EXPECT_EQ(nbCancelsOld, 0);
+    EXPECT_EQ(nbRunsNew, 0);
+}
+
+/// \brief Coroutine moving to the pool, returning the id of the thread it ended on
+static Task<std::thread::id> hopToPool(ThreadPool &pool) {
+    co_await pool.schedule();
+    co_return std::this_thread::get_id();
+}
+
+/// \brief Coroutine awaiting another one, which resumes it inline on the same thread
+static Task<int> addOnPool(ThreadPool &pool, int a, int b) {
+    std::thread::id inner = co_await hopToPool(pool);
+    if (inner != std::this_thread::get_id()) {
+        co_return -1;
+    }
+    co_return a + b;
+}
+
+/// \brief Coroutine failing on the pool
+static Task<int> failOnPool(ThreadPool &pool) {
+    co_await pool.schedule();
+    throw std::runtime_error("Coroutine failure");
+}
+
+/// \brief Coroutine hopping several times through the pool before counting its end
+static Task<void> hopAndCount(ThreadPool &pool, int nbHops, std::atomic<int> &nbDone) {
+    for (int i = 0; i < nbHops; ++i) {
+        co_await pool.schedule(i % 2 ? TaskPriority::High : TaskPriority::Normal);
+    }
+    ++nbDone;
+}
+
+/// \brief A test for the coroutines run on the pool
+/// schedule() moves a coroutine to a thread of the pool, a Task awaited by another resumes it
+/// inline, exceptions reach the awaiting side, many detached coroutines hopping through the
+/// pool all end, and scheduling on a shut down pool throws TaskCancelledError.
+TEST_F(ThreadpoolTest, testCoroutines) {
+    ThreadPool pool(4, 100, std::chrono::milliseconds{100});
+
+    EXPECT_NE(syncWait(hopToPool(pool)), std::this_thread::get_id());
+    EXPECT_EQ(syncWait(addOnPool(pool, 20, 22)), 42);
+    EXPECT_THROW(syncWait(failOnPool(pool)), std::runtime_error);
+
+    constexpr int NbCoroutines = 2000;
+    std::atomic<int> nbDone{0};
+    for (int i = 0; i < NbCoroutines; ++i) {
+        detach(hopAndCount(pool, 4, nbDone));
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+    while (nbDone < NbCoroutines && std::chrono::steady_clock::now() < deadline) {
+        PcoThread::usleep(1000);
+    }
+    EXPECT_EQ(nbDone, NbCoroutines);
+
+    pool.shutdown();
+    EXPECT_TRUE(pool.awaitTermination(std::chrono::seconds{5}));
+    EXPECT_THROW(syncWait(hopToPool(pool)), TaskCancelledError);
+}
+
+/// \brief A test for the delayed and periodic tasks
+/// The timer wheel hands timers out in expiry order across its levels, delayed tasks run once
+/// due without holding a thread before, a hundred thousand timers are armed and cancelled in
+/// no time, periodic tasks run until cancelled, and the shutdown cancels the pending timers.
+TEST_F(ThreadpoolTest, testTimers) {
+    TimerWheel wheel;
+    std::vector<uint64_t> expiries = {1, 63, 64, 65, 4095, 4096, 300000, TimerWheel::Range + 5};
+    std::vector<TimerNode> nodes(expiries.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i].expiry = expiries[i];
+        wheel.insert(&nodes[i]);
+    }
+    std::vector<TimerNode*> due;
+    for (uint64_t expiry : expiries) {
+        wheel.advance(expiry - 1, due);
+        EXPECT_TRUE(due.empty());
+        wheel.advance(expiry, due);
+        ASSERT_EQ(due.size(), 1u);
+        EXPECT_EQ(due[0]->expiry, expiry);
+        due.clear();
+    }
+    EXPECT_EQ(wheel.size(), 0u);
+
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    ThreadPool pool(4, 100, std::chrono::milliseconds{1000});
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_TRUE(pool.schedule(std::make_unique<CountingRunnable>(nbRuns, nbCancels),
+                                  std::chrono::milliseconds{100}).valid());
+    }
+    PcoThread::usleep(20000);
+    EXPECT_EQ(nbRuns, 0);
+    EXPECT_EQ(pool.currentNbThreads(), 0u);
+    EXPECT_EQ(pool.nbScheduledTasks(), 3u);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+    while (nbRuns < 3 && std::chrono::steady_clock::now() < deadline) {
+        PcoThread::usleep(1000);
+    }
+    EXPECT_EQ(nbRuns, 3);
+
+    // Arming and cancelling many timers is O(1) each
+    constexpr int NbTimers = 100000;
+    std::atomic<int> nbLateRuns{0};
+    std::atomic<int> nbLateCancels{0};
+    std::vector<ScheduledTask> handles;
+    auto armStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < NbTimers; ++i) {
+        handles.push_back(pool.schedule(std::make_unique<CountingRunnable>(nbLateRuns, nbLateCancels),
+                                        std::chrono::milliseconds{10000 + (i * 7919) % 36000000}));
+    }
+    EXPECT_EQ(pool.nbScheduledTasks(), size_t(NbTimers));
+    for (auto &handle : handles) {
+        EXPECT_TRUE(handle.cancel());
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - armStart, std::chrono::seconds{5});
+    EXPECT_FALSE(handles[0].cancel());
+    EXPECT_EQ(pool.nbScheduledTasks(), 0u);
+    EXPECT_EQ(nbLateCancels, NbTimers);
+    EXPECT_EQ(nbLateRuns, 0);
+
+    std::atomic<int> nbTicks{0};
+    std::atomic<int> nbTickCancels{0};
+    ScheduledTask ticker = pool.scheduleAtFixedRate(std::make_unique<CountingRunnable>(nbTicks, nbTickCancels),
+                                                    std::chrono::milliseconds{10});
+    deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+    while (nbTicks < 5 && std::chrono::steady_clock::now() < deadline) {
+        PcoThread::usleep(1000);
+    }
+    EXPECT_GE(nbTicks, 5);
+    EXPECT_TRUE(ticker.cancel());
+    PcoThread::usleep(50000);
+    int nbTicksAfterCancel = nbTicks;
+    PcoThread::usleep(50000);
+    EXPECT_EQ(nbTicks, nbTicksAfterCancel);
+    EXPECT_EQ(nbTickCancels, 1);
+
+    EXPECT_THROW(pool.schedule(std::unique_ptr<Runnable>(), std::chrono::milliseconds{1}), std::invalid_argument);
+    EXPECT_THROW(pool.schedule(std::make_unique<CountingRunnable>(nbRuns, nbCancels), std::chrono::milliseconds{-1}),
+                 std::invalid_argument);
+    EXPECT_THROW(pool.scheduleAtFixedRate(std::make_unique<CountingRunnable>(nbRuns, nbCancels), std::chrono::milliseconds{0}),
+                 std::invalid_argument);
+
+    // Pending timers, one-shot and periodic, are cancelled by the shutdown
+    pool.schedule(std::make_unique<CountingRunnable>(nbRuns, nbCancels), std::chrono::seconds{10});
+    pool.scheduleAtFixedRate(std::make_unique<CountingRunnable>(nbRuns, nbCancels), std::chrono::seconds{10});
+    pool.shutdown();
+    EXPECT_TRUE(pool.awaitTermination(std::chrono::seconds{5}));
+    EXPECT_EQ(nbCancels, 2);
+
+    // Timers armed after the shutdown are refused and cancelled, not lost
+    EXPECT_FALSE(pool.schedule(std::make_unique<CountingRunnable>(nbRuns, nbCancels), std::chrono::milliseconds{1}).valid());
+    EXPECT_FALSE(pool.scheduleAtFixedRate(std::make_unique<CountingRunnable>(nbRuns, nbCancels),
+                                          std::chrono::milliseconds{1}).valid());
+    EXPECT_EQ(nbCancels, 4);
+    TimerQueue stopped([](std::vector<TaskPtr>&&) {});
+    stopped.stop();
+    EXPECT_FALSE(stopped.add(TaskPtr(new CountingRunnable(nbRuns, nbCancels)), std::chrono::milliseconds{1}).valid());
+    EXPECT_FALSE(stopped.addPeriodic(std::make_shared<CountingRunnable>(nbRuns, nbCancels), std::chrono::milliseconds{1}).valid());
+    EXPECT_EQ(nbCancels, 6);
+    EXPECT_EQ(nbRuns, 3);
+}
+
+/// \brief A test for the elastic sizing
+/// A burst of sleeping tasks grows the thread limit from one thread, a quiet pool shrinks
+/// back to its core size, and a worker blocked in a task gets a compensating thread so that
+/// the tasks queued behind it still run.
+TEST_F(ThreadpoolTest, testElasticSizing) {
+    ThreadPool pool(8, 1000, std::chrono::milliseconds{10});
+    ElasticSizing sizing;
+    sizing.enabled = true;
+    sizing.samplePeriod = std::chrono::milliseconds{10};
+    sizing.shrinkAfter = 5;
+    pool.setElasticSizing(sizing);
+    EXPECT_EQ(pool.targetNbThreads(), 1u);
+
+    std::vector<TaskFuture<void>> results;
+    for (int i = 0; i < 200; ++i) {
+        results.push_back(pool.submit([]() {
+            PcoThread::usleep(2000);
+        }));
+    }
+    for (auto &result : results) {
+        result.get();
+    }
+    EXPECT_GT(pool.targetNbThreads(), 1u);
+
+    auto waitFor = [](auto condition) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+        while (!condition() && std::chrono::steady_clock::now() < deadline) {
+            PcoThread::usleep(1000);
+        }
+        return condition();
+    };
+    EXPECT_TRUE(waitFor([&pool]() { return pool.targetNbThreads() == 1 && pool.currentNbThreads() == 1; }));
+
+    // The single thread blocks, the next task needs a compensating thread
+    std::atomic<bool> open{false};
+    std::atomic<bool> ranBehind{false};
+    auto blocked = pool.submit([&open]() {
+        while (!open) {
+            PcoThread::usleep(1000);
+        }
+    });
+    PcoThread::usleep(20000);
+    auto behind = pool.submit([&ranBehind]() {
+        ranBehind = true;
+    });
+    EXPECT_TRUE(waitFor([&ranBehind]() { return ranBehind.load(); }));
+    EXPECT_EQ(pool.nbBlockedThreads(), 1u);
+    EXPECT_EQ(pool.targetNbThreads(), 1u);
+    open = true;
+    blocked.get();
+    behind.get();
+
+    EXPECT_THROW(pool.setElasticSizing(ElasticSizing{true, std::chrono::microseconds{1000}, std::chrono::milliseconds{0}}),
+                 std::invalid_argument);
+    pool.setElasticSizing(ElasticSizing());
+    EXPECT_EQ(pool.targetNbThreads(), 8u);
+    EXPECT_EQ(pool.nbBlockedThreads(), 0u);
+    // A zero idleTimeout does not apply either: idle threads wait for the controller to shrink
+    ThreadPool instant(4, 1000, std::chrono::milliseconds{0});
+    sizing.shrinkAfter = 1000;
+    instant.setElasticSizing(sizing);
+    results.clear();
+    for (int i = 0; i < 200; ++i) {
+        results.push_back(instant.submit([]() {
+            PcoThread::usleep(2000);
+        }));
+    }
+    for (auto &result : results) {
+        result.get();
+    }
+    EXPECT_GT(instant.targetNbThreads(), 1u);
+    PcoThread::usleep(50000);
+    EXPECT_GT(instant.currentNbThreads(), 1u);
+}
+
+/// \brief A test for the blocking sections
+/// With every thread blocked inside a BlockingScope, a task submitted next still runs on an
+/// extra thread above maxThreadCount, which retires once the sections ended. Nested sections
+/// only count once, and a section outside of the pool's threads does nothing.
+TEST_F(ThreadpoolTest, testBlockingScope) {
+    ThreadPool pool(2, 100, std::chrono::milliseconds{1000});
+    {
+        ThreadPool::BlockingScope outside(pool);
+    }
+
+    std::atomic<bool> open{false};
+    std::atomic<int> nbBlocked{0};
+    std::vector<TaskFuture<void>> blocked;
+    for (int i = 0; i < 2; ++i) {
+        blocked.push_back(pool.submit([&pool, &open, &nbBlocked]() {
+            ThreadPool::BlockingScope scope(pool);
+            ThreadPool::BlockingScope nested(pool);
+            ++nbBlocked;
+            while (!open) {
+                PcoThread::usleep(1000);
+            }
+        }));
+    }
+    while (nbBlocked < 2) {
+        PcoThread::usleep(1000);
+    }
+
+    auto behind = pool.submit([]() {
+        return 42;
+    });
+    EXPECT_EQ(behind.get(), 42);
+    EXPECT_EQ(pool.currentNbThreads(), 3u);
+
+    open = true;
+    for (auto &result : blocked) {
+        result.get();
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+    while (pool.currentNbThreads() > 2 && std::chrono::steady_clock::now() < deadline) {
+        PcoThread::usleep(1000);
+    }
+    EXPECT_EQ(pool.currentNbThreads(), 2u);
+}
+
+/// \brief A test for the identity of the tasks
+/// Every task gets a distinct number, never 0, at submission; its name is only built when asked
+/// for, and both are empty outside of a task.
+TEST_F(ThreadpoolTest, testTaskIds) {
+    ThreadPool pool(4, 1000, std::chrono::milliseconds{100});
+    EXPECT_EQ(ThreadPool::currentTaskId(), 0u);
+    EXPECT_TRUE(ThreadPool::currentTaskName().empty());
+
+    constexpr int NbTasks = 200;
+    std::vector<TaskFuture<uint64_t>> ids;
+    for (int i = 0; i < NbTasks; ++i) {
+        ids.push_back(pool.submit([]() {
+            return ThreadPool::currentTaskId();
+        }));
+    }
+    // Tasks submitted by the pool's threads are numbered too
+    auto nested = pool.submit([&pool]() {
+        return pool.submit([]() {
+            return ThreadPool::currentTaskId();
+        }).get();
+    });
+
+    std::set<uint64_t> distinct;
+    for (auto &id : ids) {
+        uint64_t value = id.get();
+        EXPECT_NE(value, 0u);
+        distinct.insert(value);
+    }
+    uint64_t nestedId = nested.get();
+    EXPECT_NE(nestedId, 0u);
+    distinct.insert(nestedId);
+    EXPECT_EQ(distinct.size(), static_cast<size_t>(NbTasks + 1));
+
+    auto name = pool.submit([]() {
+        return ThreadPool::currentTaskName();
+    }).get();
+    EXPECT_NE(name.find('#'), std::string::npos);
+}
+
+/// \brief A test for the timeline export
+/// While the tracing is enabled, every task leaves its submission, its run and the thread that
+/// ran it in the Chrome trace; writing the trace empties the buffers, and nothing is recorded
+/// once the tracing is disabled.
+TEST_F(ThreadpoolTest, testTracing) {
+    ThreadPool pool(2, 100, std::chrono::milliseconds{100});
+    pool.enableTracing();
+
+    constexpr int NbTasks = 20;
+    std::vector<TaskFuture<void>> results;
+    for (int i = 0; i < NbTasks; ++i) {
+        results.push_back(pool.submit([]() {
+            PcoThread::usleep(100);
+        }));
+    }
+    for (auto &result : results) {
+        result.get();
+    }
+
+    auto count = [](const std::string& text, const std::string& pattern) {
+        size_t nb = 0;
+        for (size_t at = text.find(pattern); at != std::string::npos; at = text.find(pattern, at + 1)) {
+            ++nb;
+        }
+        return nb;
+    };
+    // The futures are set from within run(), the end of the last runs may still be recorded
+    std::string trace;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{5};
+    do {
+        std::ostringstream part;
+        pool.writeTrace(part);
+        trace += part.str();
+    } while (count(trace, "{\"name\":\"task\",\"ph\":\"E\"") < static_cast<size_t>(NbTasks) && std::chrono::steady_clock::now() < deadline);
+    EXPECT_EQ(trace.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0), 0u);
+    EXPECT_EQ(count(trace, "{\"name\":\"task\",\"ph\":\"B\""), static_cast<size_t>(NbTasks));
+    EXPECT_EQ(count(trace, "{\"name\":\"task\",\"ph\":\"E\""), static_cast<size_t>(NbTasks));
+    EXPECT_EQ(count(trace, "{\"name\":\"queued\",\"ph\":\"b\""), static_cast<size_t>(NbTasks));
+    EXPECT_EQ(count(trace, "{\"name\":\"queued\",\"ph\":\"e\""), static_cast<size_t>(NbTasks));
+    EXPECT_GE(count(trace, "\"thread spawn\""), 1u);
+    EXPECT_GE(count(trace, "\"name\":\"Thread-"), 1u);
+    EXPECT_EQ(count(trace, "{"), count(trace, "}"));
+    EXPECT_EQ(pool.nbDroppedTraceEvents(), 0u);
+
+    pool.enableTracing(false);
+    pool.submit([]() {}).get();
+    std::ostringstream second;
+    pool.writeTrace(second);
+    EXPECT_EQ(count(second.str(), "\"ph\":\"B\""), 0u);
+}
+
+/// \brief A test for the strands
+/// The tasks of a key run one at a time and in the order they were posted, while different
+/// keys run in parallel; a key leaves no entry behind once its tasks ran. A key refused by a
+/// full pool is parked and run later, its tasks are only cancelled by the shutdown.
+TEST_F(ThreadpoolTest, testStrands) {
+    ThreadPool pool(4, 1000, std::chrono::milliseconds{100});
+    constexpr int NbKeys = 6;
+    constexpr int NbTasks = 60;
+
+    std::vector<std::vector<int>> order(NbKeys);
+    std::vector<std::atomic<int>> running(NbKeys);
+    std::atomic<int> nbRunning{0};
+    std::atomic<int> maxRunning{0};
+    std::atomic<bool> overlapped{false};
+    {
+        KeyedStrands<int> strands(pool);
+        EXPECT_THROW(strands.post(0, std::unique_ptr<Runnable>()), std::invalid_argument);
+        for (int i = 0; i < NbTasks; ++i) {
+            for (int key = 0; key < NbKeys; ++key) {
+                strands.submit(key, [&, key, i]() {
+                    if (running[key].fetch_add(1) != 0) {
+                        overlapped = true;
+                    }
+                    int now = ++nbRunning;
+                    int seen = maxRunning;
+                    while (now > seen && !maxRunning.compare_exchange_weak(seen, now)) {
+                    }
+                    order[key].push_back(i);
+                    if (i % 10 == 0) {
+                        PcoThread::usleep(1000);
+                    }
+                    --nbRunning;
+                    running[key].fetch_sub(1);
+                });
+            }
+        }
+        strands.wait();
+        EXPECT_EQ(strands.nbActiveKeys(), 0u);
+    }
+
+    EXPECT_FALSE(overlapped);
+    EXPECT_GE(maxRunning, 2);
+    for (int key = 0; key < NbKeys; ++key) {
+        ASSERT_EQ(order[key].size(), static_cast<size_t>(NbTasks));
+        for (int i = 0; i < NbTasks; ++i) {
+            EXPECT_EQ(order[key][i], i);
+        }
+    }
+
+    Strand strand(pool);
+    std::vector<TaskFuture<int>> results;
+    int counter = 0;
+    for (int i = 0; i < 50; ++i) {
+        results.push_back(strand.submit([&counter]() {
+            return counter++;
+        }));
+    }
+    for (int i = 0; i < 50; ++i) {
+        EXPECT_EQ(results[i].get(), i);
+    }
+
+    // A refusal of the pool parks a key without cancelling any task nor blocking post()
+    ThreadPool full(1, 1, std::chrono::milliseconds{100});
+    ThreadPool closing(1, 1, std::chrono::milliseconds{100});
+    std::atomic<bool> held{false};
+    std::atomic<bool> release{false};
+    auto hold = [&](ThreadPool& pool) {
+        held = false;
+        release = false;
+        return pool.submit([&]() {
+            held = true;
+            while (!release) {
+                PcoThread::usleep(1000);
+            }
+        });
+    };
+    auto holder = hold(full);
+    while (!held) {
+        PcoThread::usleep(1000);
+    }
+    std::atomic<int> nbRuns[4] = {0, 0, 0, 0};
+    std::atomic<int> nbCancels[4] = {0, 0, 0, 0};
+    {
+        KeyedStrands<int> strands(full);
+        strands.post(1, std::make_unique<CountingRunnable>(nbRuns[1], nbCancels[1]));
+        strands.post(1, std::make_unique<CountingRunnable>(nbRuns[1], nbCancels[1]));
+
+        // The unrelated task drops the queued task of key 1, which is parked
+        full.start(std::make_unique<CountingRunnable>(nbRuns[0], nbCancels[0]));
+        EXPECT_EQ(nbCancels[1], 0);
+
+        // No room for key 2: it is parked as well
+        strands.post(2, std::make_unique<CountingRunnable>(nbRuns[2], nbCancels[2]));
+        EXPECT_EQ(nbCancels[2], 0);
+        EXPECT_EQ(strands.nbActiveKeys(), 2u);
+
+        // wait() queues the parked keys once the pool frees a slot
+        release = true;
+        holder.get();
+        strands.wait();
+        EXPECT_EQ(strands.nbActiveKeys(), 0u);
+    }
+    EXPECT_EQ(nbRuns[0], 1);
+    EXPECT_EQ(nbRuns[1], 2);
+    EXPECT_EQ(nbCancels[1], 0);
+    EXPECT_EQ(nbRuns[2], 1);
+    EXPECT_EQ(nbCancels[2], 0);
+
+    // The shutdown of the pool cancels every task of a parked key
+    holder = hold(closing);
+    while (!held) {
+        PcoThread::usleep(1000);
+    }
+    {
+        KeyedStrands<int> strands(closing);
+        strands.post(3, std::make_unique<CountingRunnable>(nbRuns[3], nbCancels[3]));
+        strands.post(3, std::make_unique<CountingRunnable>(nbRuns[3], nbCancels[3]));
+        closing.start(std::make_unique<CountingRunnable>(nbRuns[0], nbCancels[0]));
+        EXPECT_EQ(strands.nbActiveKeys(), 1u);
+        closing.shutdownNow();
+        strands.wait();
+        EXPECT_EQ(strands.nbActiveKeys(), 0u);
+    }
+    release = true;
+    holder.get();
+    EXPECT_EQ(nbCancels[0], 1);
+    EXPECT_EQ(nbRuns[3], 0);
+    EXPECT_EQ(nbCancels[3], 2);
+}
+
+/// \brief A test for the overflow policies
+/// With the single thread held and the single slot of the queue taken, each policy handles
+/// the next task its own way and counts it in the metrics.
+TEST_F(ThreadpoolTest, testOverflowPolicies) {
+    ThreadPool pool(1, 1, std::chrono::milliseconds{100});
+    pool.enableMetrics();
+    EXPECT_THROW(pool.setOverflowPolicy(OverflowPolicy::BlockWithTimeout, std::chrono::milliseconds{-1}),
+                 std::invalid_argument);
+
+    std::atomic<bool> open{false};
+    auto gate = pool.submit([&open]() {
+        while (!open) {
+            PcoThread::usleep(1000);
+        }
+    });
+    PcoThread::usleep(10000);
+    std::atomic<int> nbRunsQueued{0};
+    std::atomic<int> nbCancelsQueued{0};
+    PcoThread producer([&pool, &nbRunsQueued, &nbCancelsQueued]() {
+        pool.start(std::make_unique<CountingRunnable>(nbRunsQueued, nbCancelsQueued));
+    });
+    PcoThread::usleep(20000);
+
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    pool.setOverflowPolicy(OverflowPolicy::RejectNew);
+    EXPECT_FALSE(pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels)));
+    EXPECT_EQ(nbCancels, 1);
+
+    // The producer runs the task itself, right away
+    pool.setOverflowPolicy(OverflowPolicy::CallerRuns);
+    class CallerRunnable : public Runnable {
+    public:
+        explicit CallerRunnable(std::thread::id &caller) : caller(caller) {}
+        void run() override {
+            caller = std::this_thread::get_id();
+        }
+        void cancelRun() override {}
+        std::string id() override {
+            return "Caller";
+        }
+    private:
+        std::thread::id &caller;
+    };
+    std::thread::id caller;
+    EXPECT_TRUE(pool.start(std::make_unique<CallerRunnable>(caller)));
+    EXPECT_EQ(caller, std::this_thread::get_id());
+
+    pool.setOverflowPolicy(OverflowPolicy::BlockWithTimeout, std::chrono::milliseconds{20});
+    auto begin = std::chrono::steady_clock::now();
+    EXPECT_FALSE(pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels)));
+    EXPECT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds{20});
+    EXPECT_EQ(nbCancels, 2);
+
+    // The queued task of the producer makes room for the new one
+    pool.setOverflowPolicy(OverflowPolicy::DropOldest);
+    EXPECT_FALSE(pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels)));
+    EXPECT_EQ(nbCancelsQueued, 1);
+
+    // A producer blocked past the end of the gate gets its slot
+    pool.setOverflowPolicy(OverflowPolicy::BlockWithTimeout, std::chrono::milliseconds{5000});
+    bool accepted = false;
+    PcoThread blocked([&pool, &nbRuns, &nbCancels, &accepted]() {
+        accepted = pool.start(std::make_unique<CountingRunnable>(nbRuns, nbCancels));
+    });
+    PcoThread::usleep(20000);
+    open = true;
+    blocked.join();
+    producer.join();
+    gate.get();
+    pool.shutdown();
+    EXPECT_TRUE(pool.awaitTermination(std::chrono::seconds{5}));
+    EXPECT_TRUE(accepted);
+    EXPECT_EQ(nbRuns, 2);
+    EXPECT_EQ(nbCancels, 2);
+    EXPECT_EQ(nbRunsQueued, 0);
+
+    PoolMetrics metrics = pool.snapshot();
+    EXPECT_EQ(metrics.tasksRejectedNew, 1u);
+    EXPECT_EQ(metrics.tasksRunByCaller, 1u);
+    EXPECT_EQ(metrics.tasksTimedOut, 1u);
+    EXPECT_EQ(metrics.tasksDroppedOldest, 1u);
+    EXPECT_EQ(metrics.tasksRejected, 3u);
+    // A producer blocked when the pool shuts down gets its task cancelled, not lost
+    ThreadPool closing(1, 1, std::chrono::milliseconds{100});
+    closing.setOverflowPolicy(OverflowPolicy::BlockWithTimeout, std::chrono::milliseconds{5000});
+    std::atomic<bool> closed{false};
+    auto holder = closing.submit([&closed]() {
+        while (!closed) {
+            PcoThread::usleep(1000);
+        }
+    });
+    PcoThread::usleep(10000);
+    std::atomic<int> nbRunsClosing{0};
+    std::atomic<int> nbCancelsClosing{0};
+    EXPECT_EQ(closing.trySubmit(std::make_unique<CountingRunnable>(nbRunsClosing, nbCancelsClosing)), SubmitStatus::Accepted);
+    bool acceptedClosing = true;
+    PcoThread waiting([&closing, &nbRunsClosing, &nbCancelsClosing, &acceptedClosing]() {
+        acceptedClosing = closing.start(std::make_unique<CountingRunnable>(nbRunsClosing, nbCancelsClosing));
+    });
+    PcoThread::usleep(20000);
+    closing.shutdownNow();
+    waiting.join();
+    closed = true;
+    holder.get();
+    EXPECT_TRUE(closing.awaitTermination(std::chrono::seconds{5}));
+    EXPECT_FALSE(acceptedClosing);
+    EXPECT_EQ(nbRunsClosing, 0);
+    EXPECT_EQ(nbCancelsClosing, 2);
+}
+
+/// \brief A test for the executor service
+/// Competing logical pools share the workers in proportion to their weight, a pool of a
+/// higher priority goes first, a lone pool gets the whole budget and a full queue rejects.
+TEST_F(ThreadpoolTest, testExecutorService) {
+    EXPECT_THROW(ExecutorService(0, std::chrono::milliseconds{100}), std::invalid_argument);
+    ExecutorService service(2, std::chrono::milliseconds{100});
+    EXPECT_THROW(service.addPool(LogicalPoolConfig{"zero", 0}), std::invalid_argument);
+    auto gate = service.addPool(LogicalPoolConfig{"gate"});
+    auto heavy = service.addPool(LogicalPoolConfig{"heavy", 3});
+    auto light = service.addPool(LogicalPoolConfig{"light", 1});
+    auto urgent = service.addPool(LogicalPoolConfig{"urgent", 1, 1000, TaskPriority::High});
+    auto small = service.addPool(LogicalPoolConfig{"small", 1, 2});
+    EXPECT_EQ(service.nbPools(), 5u);
+
+    // Both workers are held while the pools fill up
+    std::atomic<bool> open{false};
+    std::vector<TaskFuture<void>> held;
+    for (int i = 0; i < 2; ++i) {
+        held.push_back(service.submit(gate, [&open]() {
+            while (!open) {
+                PcoThread::usleep(1000);
+            }
+        }));
+    }
+    PcoThread::usleep(20000);
+
+    std::mutex orderMutex;
+    std::vector<ExecutorService::PoolId> order;
+    auto record = [&orderMutex, &order](ExecutorService::PoolId id) {
+        std::lock_guard<std::mutex> lock(orderMutex);
+        order.push_back(id);
+    };
+    constexpr int NbTasks = 200;
+    std::vector<TaskFuture<void>> results;
+    for (int i = 0; i < NbTasks; ++i) {
+        results.push_back(service.submit(heavy, record, heavy));
+        results.push_back(service.submit(light, record, light));
+    }
+    for (int i = 0; i < 5; ++i) {
+        results.push_back(service.submit(urgent, record, urgent));
+    }
+    std::atomic<int> nbRuns{0};
+    std::atomic<int> nbCancels{0};
+    EXPECT_TRUE(service.start(small, std::make_unique<CountingRunnable>(nbRuns, nbCancels)));
+    EXPECT_TRUE(service.start(small, std::make_unique<CountingRunnable>(nbRuns, nbCancels)));
+    EXPECT_FALSE(service.start(small, std::make_unique<CountingRunnable>(nbRuns, nbCancels)));
+    EXPECT_EQ(nbCancels, 1);
+
+    open = true;
+    for (auto &result : results) {
+        result.get();
+    }
+    for (auto &result : held) {
+        result.get();
+    }
+
+    ASSERT_EQ(order.size(), static_cast<size_t>(2 * NbTasks + 5));
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(order[i], urgent);
+    }
+    // While both pools had work, heavy got about three tasks for each task of light
+    size_t nbHeavy = std::count(order.begin() + 5, order.begin() + 205, heavy);
+    EXPECT_GE(nbHeavy, 135u);
+    EXPECT_LE(nbHeavy, 165u);
+
+    // Alone, a pool gets both workers
+    std::atomic<int> nbRunning{0};
+    std::atomic<int> maxRunning{0};
+    std::vector<TaskFuture<void>> alone;
+    for (int i = 0; i < 20; ++i) {
+        alone.push_back(service.submit(light, [&nbRunning, &maxRunning]() {
+            int now = ++nbRunning;
+            int seen = maxRunning;
+            while (now > seen && !maxRunning.compare_exchange_weak(seen, now)) {
+            }
+            PcoThread::usleep(2000);
+            --nbRunning;
+        }));
+    }
+    for (auto &result : alone) {
+        result.get();
+    }
+    EXPECT_EQ(maxRunning, 2);
+
+    LogicalPoolStats stats = service.stats(small);
+    EXPECT_EQ(stats.name, "small");
+    EXPECT_EQ(stats.tasksSubmitted, 2u);
+    EXPECT_EQ(stats.tasksRejected, 1u);
+    EXPECT_EQ(service.stats(heavy).tasksRun, static_cast<uint64_t>(NbTasks));
+    EXPECT_EQ(service.stats(heavy).queueDepth, 0u);
+}
+
 /// \brief A test to validate the handling of invalid parameters in the pool constructor
 /// This test ensures the pool correctly handles invalid inputs such as negative or zero values.
 TEST_F(ThreadpoolTest, testInvalidParameters) {
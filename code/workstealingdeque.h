@@ -0,0 +1,117 @@
+/**
+ * @file workstealingdeque.h
+ * @brief Header file defining WorkStealingDeque, the local task deque owned by each worker thread.
+ * @authors
+ * - Nicolet Victor
+ * - Surbeck Léon
+ */
+
+#ifndef WORKSTEALINGDEQUE_H
+#define WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <deque>
+
+#include <pcosynchro/pcomutex.h>
+
+/**
+ * @brief Double-ended task queue for work stealing.
+ * The owner thread pushes and pops at the bottom (LIFO, keeps recently spawned work hot in
+ * its cache) while other threads steal at the top (FIFO, takes the oldest and usually biggest
+ * pieces of work). The mutex is almost only taken by the owner, so it is rarely contended.
+ * Aligned on a cache line: the deques of a pool are allocated as one array, and the owner of
+ * one must not invalidate the line of its neighbour.
+ * @tparam T Type of the stored elements, must be movable
+ */
+template<typename T>
+class alignas(64) WorkStealingDeque {
+public:
+    WorkStealingDeque() : size(0) {}
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    /**
+     * @brief Pushes an element at the bottom (owner side).
+     * @param value The element to push
+     */
+    void pushBottom(T value) {
+        mutex.lock();
+        items.push_back(std::move(value));
+        ++size;
+        mutex.unlock();
+    }
+
+    /**
+     * @brief Pops the most recently pushed element (owner side).
+     * @param value Receives the element if the pop succeeds
+     * @return True if an element was removed, false if the deque is empty.
+     */
+    bool popBottom(T& value) {
+        if (size == 0) {
+            return false;
+        }
+        mutex.lock();
+        bool found = !items.empty();
+        if (found) {
+            value = std::move(items.back());
+            items.pop_back();
+            --size;
+        }
+        mutex.unlock();
+        return found;
+    }
+
+    /**
+     * @brief Steals the oldest element (thief side).
+     * @param value Receives the element if the steal succeeds
+     * @return True if an element was removed, false if the deque is empty.
+     */
+    bool stealTop(T& value) {
+        if (size == 0) {
+            return false;
+        }
+        mutex.lock();
+        bool found = !items.empty();
+        if (found) {
+            value = std::move(items.front());
+            items.pop_front();
+            --size;
+        }
+        mutex.unlock();
+        return found;
+    }
+
+    /**
+     * @brief Checks if the deque looks empty, without taking the mutex.
+     * @return True if no element is queued, false otherwise.
+     */
+    bool empty() const {
+        return size == 0;
+    }
+
+    /**
+     * @brief Returns the number of queued elements, without taking the mutex.
+     * @return The number of elements in the deque.
+     */
+    size_t sizeApprox() const {
+        return size;
+    }
+
+    /**
+     * @brief Removes every element.
+     */
+    void clear() {
+        mutex.lock();
+        items.clear();
+        size = 0;
+        mutex.unlock();
+    }
+
+private:
+    PcoMutex mutex;              // Protects items
+    std::deque<T> items;         // The queued elements, bottom is the back
+    std::atomic<size_t> size;    // Number of elements, readable without the mutex
+};
+
+#endif // WORKSTEALINGDEQUE_H